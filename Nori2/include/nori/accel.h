@@ -1,162 +1,900 @@
-/*
-    This file is part of Nori, a simple educational ray tracer
-
-    Copyright (c) 2015 by Wenzel Jakob
-
-    Nori is free software; you can redistribute it and/or modify
-    it under the terms of the GNU General Public License Version 3
-    as published by the Free Software Foundation.
-
-    Nori is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
-    GNU General Public License for more details.
-
-    You should have received a copy of the GNU General Public License
-    along with this program. If not, see <http://www.gnu.org/licenses/>.
-*/
-
-#pragma once
-
-#include <nori/mesh.h>
-
-NORI_NAMESPACE_BEGIN
-
-/**
- * \brief Acceleration data structure for ray intersection queries
- *
- * The current implementation falls back to a brute force loop
- * through the geometry.
- */
-class Accel {
-	friend class BVHBuildTask;
-public:
-	/// Create a new and empty BVH
-	Accel() { m_meshOffset.push_back(0u); }
-
-	/// Release all resources
-	virtual ~Accel() { clear(); };
-
-	/// Release all resources
-	void clear();
-
-	/**
-	 * \brief Register a triangle mesh for inclusion in the BVH.
-	 *
-	 * This function can only be used before \ref build() is called
-	 */
-	void addMesh(Mesh *mesh);
-
-	/// Build the BVH
-	void build();
-
-	/**
-	 * \brief Intersect a ray against all triangle meshes registered
-	 * with the BVH
-	 *
-	 * Detailed information about the intersection, if any, will be
-	 * stored in the provided \ref Intersection data record.
-	 *
-	 * The <tt>shadowRay</tt> parameter specifies whether this detailed
-	 * information is really needed. When set to \c true, the
-	 * function just checks whether or not there is occlusion, but without
-	 * providing any more detail (i.e. \c its will not be filled with
-	 * contents). This is usually much faster.
-	 *
-	 * \return \c true If an intersection was found
-	 */
-	bool rayIntersect(const Ray3f &ray, Intersection &its,
-		bool shadowRay = false) const;
-
-	/// Return the total number of meshes registered with the BVH
-	n_UINT getMeshCount() const { return (n_UINT)m_meshes.size(); }
-
-	/// Return the total number of internally represented triangles 
-	n_UINT getTriangleCount() const { return m_meshOffset.back(); }
-
-	/// Return one of the registered meshes
-	Mesh *getMesh(n_UINT idx) { return m_meshes[idx]; }
-
-	/// Return one of the registered meshes (const version)
-	const Mesh *getMesh(n_UINT idx) const { return m_meshes[idx]; }
-
-	//// Return an axis-aligned bounding box containing the entire tree
-	const BoundingBox3f &getBoundingBox() const {
-		return m_bbox;
-	}
-
-protected:
-	/**
-	 * \brief Compute the mesh and triangle indices corresponding to
-	 * a primitive index used by the underlying generic BVH implementation.
-	 */
-	n_UINT findMesh(n_UINT &idx) const {
-		auto it = std::lower_bound(m_meshOffset.begin(), m_meshOffset.end(), idx + 1) - 1;
-		idx -= *it;
-		return (n_UINT)(it - m_meshOffset.begin());
-	}
-
-	//// Return an axis-aligned bounding box containing the given triangle
-	BoundingBox3f getBoundingBox(n_UINT index) const {
-		n_UINT meshIdx = findMesh(index);
-		return m_meshes[meshIdx]->getBoundingBox(index);
-	}
-
-	//// Return the centroid of the given triangle
-	Point3f getCentroid(n_UINT index) const {
-		n_UINT meshIdx = findMesh(index);
-		return m_meshes[meshIdx]->getCentroid(index);
-	}
-
-	/// Compute internal tree statistics
-	std::pair<float, n_UINT> statistics(n_UINT index = 0) const;
-
-	/* BVH node in 32 bytes */
-	struct BVHNode {
-		union {
-			struct {
-				unsigned flag : 1;
-				uint32_t size : 31;
-				n_UINT start;
-			} leaf;
-
-			struct {
-				unsigned flag : 1;
-				uint32_t axis : 31;
-				n_UINT rightChild;
-			} inner;
-
-			uint64_t data;
-		};
-		BoundingBox3f bbox;
-
-		bool isLeaf() const {
-			return leaf.flag == 1;
-		}
-
-		bool isInner() const {
-			return leaf.flag == 0;
-		}
-
-		bool isUnused() const {
-			return data == 0;
-		}
-
-		n_UINT start() const {
-			return leaf.start;
-		}
-
-		n_UINT end() const {
-			return leaf.start + leaf.size;
-		}
-	};
-private:
-	std::vector<Mesh *> m_meshes;       ///< List of meshes registered with the BVH
-	std::vector<n_UINT> m_meshOffset; ///< Index of the first triangle for each shape
-	std::vector<BVHNode> m_nodes;       ///< BVH nodes
-	std::vector<n_UINT> m_indices;    ///< Index references by BVH nodes
-	BoundingBox3f m_bbox;               ///< Bounding box of the entire BVH
-};
-
-
-NORI_NAMESPACE_END
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+#include <nori/pagecache.h>
+#include <nori/simd.h>
+#include <nori/transform.h>
+#include <map>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Per-ray traversal counters
+ *
+ * Can optionally be passed to \ref Accel::rayIntersect() to find out
+ * how much work a single query performed.
+ */
+struct TraversalStats {
+	uint32_t nodesVisited = 0;  ///< BVH nodes that were entered
+	uint32_t nodesCulled = 0;   ///< Stacked nodes skipped since they begin beyond the closest hit
+	uint32_t boxTests = 0;      ///< Ray-box slab tests
+	uint32_t triangleTests = 0; ///< Ray-triangle tests
+	uint32_t stackDepth = 0;    ///< Largest number of deferred nodes on the traversal stack
+
+	/// Reset all counters to zero
+	void reset() { *this = TraversalStats(); }
+
+	/// Add the work of another query (the stack depth is the maximum of both)
+	TraversalStats &operator+=(const TraversalStats &other) {
+		nodesVisited += other.nodesVisited;
+		nodesCulled += other.nodesCulled;
+		boxTests += other.boxTests;
+		triangleTests += other.triangleTests;
+		stackDepth = std::max(stackDepth, other.stackDepth);
+		return *this;
+	}
+};
+
+/**
+ * \brief Traversal work of many single-ray queries
+ *
+ * When Nori is compiled with \c NORI_TRAVERSAL_STATS, every query records
+ * its \ref TraversalStats in a summary of the calling thread, and
+ * \ref Accel::getTraversalSummary() combines them. Packet queries are
+ * not included.
+ */
+struct TraversalSummary {
+	uint64_t rays = 0;             ///< Number of queries
+	uint64_t nodesVisited = 0;     ///< Sum of \ref TraversalStats::nodesVisited
+	uint64_t nodesCulled = 0;      ///< Sum of \ref TraversalStats::nodesCulled
+	uint64_t boxTests = 0;         ///< Sum of \ref TraversalStats::boxTests
+	uint64_t triangleTests = 0;    ///< Sum of \ref TraversalStats::triangleTests
+	uint64_t stackDepth = 0;       ///< Sum of \ref TraversalStats::stackDepth
+	uint32_t maxNodesVisited = 0;  ///< Most nodes visited by a single query
+	uint32_t maxTriangleTests = 0; ///< Most triangles tested by a single query
+	uint32_t maxStackDepth = 0;    ///< Deepest stack of a single query
+
+	/// Add a single query
+	void add(const TraversalStats &query);
+
+	/// Add the queries of another summary
+	void merge(const TraversalSummary &other);
+
+	/// Return the counters as a JSON object
+	std::string toJSON() const;
+};
+
+/// Structure and memory footprint of a BVH, see \ref Accel::getStatistics()
+struct BVHStatistics {
+	n_UINT innerNodes = 0;            ///< Number of inner nodes of the binary BVH
+	n_UINT leaves = 0;                ///< Number of leaves of the binary BVH
+	float sahCost = 0;                ///< SAH cost of the binary BVH
+	std::vector<uint32_t> leafSizes;  ///< Number of leaves with a given triangle count
+	std::vector<uint32_t> leafDepths; ///< Number of leaves at a given depth
+	float emptySpace = 0;             ///< Mean fraction of the volume of an inner node that neither child covers
+	size_t memory = 0;                ///< Bytes used by all nodes, indices and triangle packets
+
+	/// Return the statistics as a JSON object
+	std::string toJSON() const;
+};
+
+/**
+ * \brief Group of \c Size rays that are traced through the BVH together
+ *
+ * Ray data is stored in SoA layout so that a node can be tested against
+ * all rays of the packet with a few SIMD slab tests. Only the rays whose
+ * bit is set in \c active are traced. Each of them receives a compact hit
+ * record (like \ref Accel::rayIntersect()), and its \c maxt is shortened
+ * to the distance of the closest hit.
+ */
+template <int Size> struct RayPacket {
+	float o[3][Size];    ///< Ray origins (axis, ray)
+	float d[3][Size];    ///< Ray directions
+	float dRcp[3][Size]; ///< Componentwise reciprocals of the directions
+	float mint[Size];    ///< Minimum distance along each ray
+	float maxt[Size];    ///< Maximum distance along each ray
+	uint32_t active = 0; ///< Bit mask of the rays that should be traced
+
+	/* Closest hit of each ray */
+	const Mesh *mesh[Size];  ///< Mesh containing the triangle (\c nullptr if there is none)
+	n_UINT f[Size];          ///< Triangle index within the mesh
+	float u[Size], v[Size];  ///< Barycentric coordinates
+	const Matrix3x4f *instanceToWorld[Size]; ///< Transformation of the mesh instance, if any
+
+	/// Store a ray in slot \c i and mark it as active
+	void setRay(int i, const Ray3f &ray) {
+		for (int axis = 0; axis < 3; ++axis) {
+			o[axis][i] = ray.o[axis];
+			d[axis][i] = ray.d[axis];
+			dRcp[axis][i] = ray.dRcp[axis];
+		}
+		mint[i] = ray.mint;
+		maxt[i] = ray.maxt;
+		active |= 1u << i;
+	}
+
+	/// Return the ray in slot \c i
+	Ray3f getRay(int i) const {
+		return Ray3f(Point3f(o[0][i], o[1][i], o[2][i]),
+			Vector3f(d[0][i], d[1][i], d[2][i]), mint[i], maxt[i]);
+	}
+
+	/**
+	 * \brief Fill the compact hit record of \c its with the closest
+	 * hit of ray \c i
+	 *
+	 * \return \c false if the ray did not hit anything
+	 */
+	bool getIntersection(int i, Intersection &its) const {
+		if (!mesh[i])
+			return false;
+		its.t = maxt[i];
+		its.mesh = mesh[i];
+		its.f = f[i];
+		its.bary = Point2f(u[i], v[i]);
+		its.instanceToWorld = instanceToWorld[i];
+		return true;
+	}
+};
+
+/**
+ * \brief Acceleration data structure for ray intersection queries
+ *
+ * The current implementation falls back to a brute force loop
+ * through the geometry.
+ */
+class Accel {
+	friend class BVHBuildTask;
+	friend class SBVHBuilder;
+	friend class LBVHBuilder;
+public:
+	/// Construction algorithms for the binary BVH
+	enum EBuilder {
+		/// Binned SAH partitioning of the triangles (fast to build)
+		EBinnedSAH = 0,
+
+		/// SAH partitioning with spatial splits (higher quality, slower build)
+		ESpatialSplits,
+
+		/// Linear BVH over Morton-sorted centroids (fastest build, for previews)
+		ELinear
+	};
+
+	/// Memory layouts of the wide BVH nodes
+	enum ENodeLayout {
+		/// Depth-first order in which the nodes are collapsed
+		EDepthFirst = 0,
+
+		/// Breadth-first order (the upper levels are packed together)
+		EBreadthFirst,
+
+		/**
+		 * Page-sized clusters that are grown from their root by adding the
+		 * child that is most likely to be visited (largest surface area)
+		 */
+		ETreelets,
+
+		/// Recursive van Emde Boas layout (split at half the subtree height)
+		EVanEmdeBoas
+	};
+
+	/// Create a new and empty BVH
+	Accel() { m_meshOffset.push_back(0u); }
+
+	/// Release all resources
+	virtual ~Accel() { clear(); };
+
+	/// Release all resources
+	void clear();
+
+	/**
+	 * \brief Register a triangle mesh for inclusion in the BVH.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void addMesh(Mesh *mesh);
+
+	/**
+	 * \brief Register a placement of a triangle mesh
+	 *
+	 * All instances of a mesh share one bottom-level BVH, which takes
+	 * ownership of the mesh. \ref build() constructs these BVHs and a
+	 * top-level BVH over the instances (and the meshes registered with
+	 * \ref addMesh(), if any). Rays are transformed into the local space
+	 * of each instance that they reach during traversal.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void addInstance(Mesh *mesh, const Transform &toWorld);
+
+	/**
+	 * \brief Set the branching factor used for traversal
+	 *
+	 * The SAH build always produces a binary tree. For a width of 4 or 8,
+	 * \ref build() additionally collapses it into a wide BVH whose nodes
+	 * store the bounding boxes of all children in SoA layout, so that they
+	 * can be tested against a ray with a single SIMD slab test.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setWidth(int width);
+
+	/// Return the branching factor used for traversal
+	int getWidth() const { return m_width; }
+
+	/**
+	 * \brief Set the algorithm used to build the binary BVH
+	 *
+	 * \ref ESpatialSplits additionally considers splitting triangles
+	 * that straddle a partitioning plane, so that a triangle may be
+	 * referenced by several leaves. This pays off for scenes with long,
+	 * thin or unevenly sized triangles. The number of references may
+	 * grow by at most the given \c budget (relative to the triangle count).
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setBuilder(EBuilder builder, float budget = 0.3f);
+
+	/// Return the algorithm used to build the binary BVH
+	EBuilder getBuilder() const { return m_builder; }
+
+	/**
+	 * \brief Enable the treelet restructuring pass of the \ref ELinear builder
+	 *
+	 * This improves the SAH cost of the Morton-ordered hierarchy by
+	 * rearranging small subtrees, for a moderate increase in build time.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setTreeletOptimization(bool enabled) { m_treeletOptimization = enabled; }
+
+	/**
+	 * \brief Store the wide BVH with quantized child bounding boxes
+	 *
+	 * Each plane of a child box is stored as an 8-bit offset relative to
+	 * the bounds of its parent node, which roughly halves the size of the
+	 * wide nodes. The boxes are rounded outwards, so rays may enter a few
+	 * more nodes but never miss a triangle. Requires a width of 4 or 8.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setCompression(bool enabled) { m_compression = enabled; }
+
+	/**
+	 * \brief Set the memory layout of the wide BVH nodes
+	 *
+	 * The binary BVH is always stored in depth-first order, since the
+	 * traversal finds the left child of a node right after it. Wide
+	 * nodes refer to all of their children by index, so they can be
+	 * rearranged to keep nodes that are visited together in the same
+	 * cache lines and pages. Requires a width of 4 or 8 unless the
+	 * layout is \ref EDepthFirst.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setNodeLayout(ENodeLayout layout) { m_layout = layout; }
+
+	/// Return the memory layout of the wide BVH nodes
+	ENodeLayout getNodeLayout() const { return m_layout; }
+
+	/**
+	 * \brief Return the number of bytes of node memory saved after the
+	 * build, summed over this BVH and its instances
+	 *
+	 * Compares all nodes that exist right after the wide BVH was collapsed
+	 * (binary and wide) with those that remain once the wide nodes were
+	 * quantized and the binary nodes were released.
+	 */
+	size_t getCompressionSavings() const { return m_compressionSavings; }
+
+	/**
+	 * \brief Cache the BVH in the given file
+	 *
+	 * \ref build() loads the nodes and triangle packets from this file
+	 * instead of constructing them when it was written for the same
+	 * geometry and build settings, and (re)writes it otherwise.
+	 * An empty filename disables the cache.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setCacheFile(const std::string &filename) { m_cacheFile = filename; }
+
+	/**
+	 * \brief Keep the triangle packets on disk instead of in memory
+	 *
+	 * The packets of consecutive leaves are grouped into pages of about
+	 * \ref PAGE_SIZE bytes (a leaf never straddles two pages), and each
+	 * page is built right before it is written to \c filename. After the
+	 * build, the meshes move their vertex attributes into the same file
+	 * (see \ref Mesh::pageOut()) unless \ref setRefitSupport() keeps them
+	 * in memory. Traversal and shading then page the data in through an
+	 * LRU cache that holds at most \c budget bytes, while the nodes stay
+	 * resident. Bottom-level BVHs of instanced meshes use their own page
+	 * files and budgets. An empty filename disables paging.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setPaging(const std::string &filename, size_t budget) {
+		m_pageFile = filename;
+		m_pageBudget = budget;
+	}
+
+	/// Return the work done by the page caches of this BVH and its instances
+	PageCacheStats getPagingStatistics() const;
+
+	/// Build the BVH
+	void build();
+
+	/**
+	 * \brief Update the BVH after the vertex positions of its meshes changed
+	 *
+	 * Recomputes the node bounds bottom-up while keeping the topology,
+	 * which is much cheaper than a rebuild but lets the tree degrade as
+	 * the geometry deforms. To counter this, the SAH cost of every
+	 * subtree is compared to its cost right after it was built. Subtrees
+	 * whose cost has grown by more than the rebuild threshold are rebuilt
+	 * with the binned SAH builder, and the entire BVH is rebuilt when the
+	 * root has degraded. Instanced meshes are refitted as well. Wide BVHs
+	 * are always rebuilt unless \ref setRefitSupport() kept their binary
+	 * nodes.
+	 *
+	 * The triangle count and connectivity of the meshes must not change.
+	 */
+	void refit();
+
+	/**
+	 * \brief Set the relative SAH cost increase after which \ref refit()
+	 * rebuilds a subtree (0.5 = 50%)
+	 *
+	 * A threshold of zero disables rebuilds.
+	 */
+	void setRebuildThreshold(float threshold);
+
+	/**
+	 * \brief Keep the binary BVH after it was collapsed into a wide one
+	 *
+	 * A 4- or 8-wide BVH is traversed without the binary nodes it was
+	 * collapsed from, so they and their build costs are released at the
+	 * end of \ref build(). \ref refit() needs them, however, and otherwise
+	 * has to rebuild the entire BVH. Enable this for meshes that are
+	 * refitted repeatedly. Binary BVHs always keep their nodes. With
+	 * paging, this also keeps the meshes in memory, which \ref refit()
+	 * requires.
+	 *
+	 * This function can only be used before \ref build() is called
+	 */
+	void setRefitSupport(bool enabled) { m_refitSupport = enabled; }
+
+	/**
+	 * \brief Intersect a ray against all triangle meshes registered
+	 * with the BVH
+	 *
+	 * The closest intersection, if any, is stored in the compact hit
+	 * record of \c its (distance, mesh, triangle index and barycentric
+	 * coordinates). Call \ref Intersection::computeSurfaceData() to
+	 * obtain the position, UV coordinates and frames.
+	 *
+	 * The <tt>shadowRay</tt> parameter specifies whether this detailed
+	 * information is really needed. When set to \c true, the
+	 * function just checks whether or not there is occlusion, but without
+	 * providing any more detail (i.e. \c its will not be filled with
+	 * contents). This is usually much faster.
+	 *
+	 * When \c stats is given, the work done by the query is added to it.
+	 *
+	 * \return \c true If an intersection was found
+	 */
+	bool rayIntersect(const Ray3f &ray, Intersection &its,
+		bool shadowRay = false, TraversalStats *stats = nullptr) const;
+
+	/**
+	 * \brief Check whether any triangle intersects the segment
+	 * <tt>[ray.mint, ray.maxt]</tt>
+	 *
+	 * This any-hit query stops at the first triangle it finds and
+	 * never computes intersection details.
+	 */
+	bool rayOccluded(const Ray3f &ray, TraversalStats *stats = nullptr) const;
+
+	/**
+	 * \brief Find the closest intersection of every active ray of a packet
+	 *
+	 * The packet descends through the BVH as a whole: every node
+	 * is fetched once and tested against all rays that are still active
+	 * in it, which amortizes the memory traffic for coherent rays such as
+	 * the camera rays of an image block. Rays that leave the packet's
+	 * path through the tree cost extra box tests, so incoherent rays are
+	 * better served by \ref rayIntersect(). Packets are traced ray by ray
+	 * when the BVH contains instances.
+	 *
+	 * \c Size can be 8 or 16. The counters in \c stats count a node once
+	 * per packet, but box and triangle tests once per ray.
+	 */
+	template <int Size> void rayIntersect(RayPacket<Size> &packet,
+		TraversalStats *stats = nullptr) const;
+
+	/**
+	 * \brief Any-hit query for all active rays of a packet (e.g. shadow rays)
+	 *
+	 * \return A bit mask of the rays that are occluded
+	 */
+	template <int Size> uint32_t rayOccluded(RayPacket<Size> &packet,
+		TraversalStats *stats = nullptr) const;
+
+	/**
+	 * \brief Gather the structure and memory footprint of the BVH
+	 *
+	 * The histograms cover the BVH over the meshes registered with
+	 * \ref addMesh() as well as the bottom-level BVH of every instanced
+	 * mesh (with depths relative to its own root). The SAH cost is that
+	 * of the former.
+	 */
+	BVHStatistics getStatistics() const;
+
+	/**
+	 * \brief Return the traversal work of all queries since the last call
+	 * to \ref resetTraversalSummary(), combined across threads
+	 *
+	 * The summary remains empty unless Nori was compiled with
+	 * \c NORI_TRAVERSAL_STATS. Must not be called while other threads
+	 * trace rays.
+	 */
+	static TraversalSummary getTraversalSummary();
+
+	/// Discard the traversal work recorded so far
+	static void resetTraversalSummary();
+
+	/// Return the total number of meshes registered with the BVH
+	n_UINT getMeshCount() const { return (n_UINT)m_meshes.size(); }
+
+	/// Return the total number of internally represented triangles 
+	n_UINT getTriangleCount() const { return m_meshOffset.back(); }
+
+	/// Return one of the registered meshes
+	Mesh *getMesh(n_UINT idx) { return m_meshes[idx]; }
+
+	/// Return one of the registered meshes (const version)
+	const Mesh *getMesh(n_UINT idx) const { return m_meshes[idx]; }
+
+	//// Return an axis-aligned bounding box containing the entire tree
+	const BoundingBox3f &getBoundingBox() const {
+		return m_bbox;
+	}
+
+protected:
+	/**
+	 * \brief Compute the mesh and triangle indices corresponding to
+	 * a primitive index used by the underlying generic BVH implementation.
+	 */
+	n_UINT findMesh(n_UINT &idx) const {
+		auto it = std::lower_bound(m_meshOffset.begin(), m_meshOffset.end(), idx + 1) - 1;
+		idx -= *it;
+		return (n_UINT)(it - m_meshOffset.begin());
+	}
+
+	//// Return an axis-aligned bounding box containing the given triangle
+	BoundingBox3f getBoundingBox(n_UINT index) const {
+		n_UINT meshIdx = findMesh(index);
+		return m_meshes[meshIdx]->getBoundingBox(index);
+	}
+
+	//// Return the centroid of the given triangle
+	Point3f getCentroid(n_UINT index) const {
+		n_UINT meshIdx = findMesh(index);
+		return m_meshes[meshIdx]->getCentroid(index);
+	}
+
+	/// Compute internal tree statistics
+	std::pair<float, n_UINT> statistics(n_UINT index = 0) const;
+
+	/// Add the histograms and the memory footprint of the BVH to \c stats
+	void collectStatistics(BVHStatistics &stats) const;
+
+	/// Record the work of a query in the summary of the calling thread
+	static void recordQuery(const TraversalStats &query);
+
+	enum {
+		/// Number of triangles intersected together by the SIMD leaf test
+		PACKET_SIZE = NORI_SIMD_WIDTH,
+
+		/// Heuristic cost value for traversal operations (SAH of all builders)
+		TRAVERSAL_COST = 1,
+
+		/// Heuristic cost value for intersection operations (per triangle packet)
+		INTERSECTION_COST = 1
+	};
+
+	/// Number of triangle packets needed by a leaf with \c size triangles
+	static n_UINT packetCount(n_UINT size) {
+		return (size + PACKET_SIZE - 1) / PACKET_SIZE;
+	}
+
+	/// Build the BVH over the meshes registered with \ref addMesh()
+	void buildTree(bool useCache = true);
+
+	/// Build the binary BVH with the binned SAH builder
+	void buildBinned();
+
+	/**
+	 * \brief Build a binary BVH over the triangles listed in \ref m_indices
+	 * with the binned SAH builder (\c bbox must contain all of them)
+	 */
+	void buildBinned(const BoundingBox3f &bbox);
+
+	/// Collapse the binary BVH into wide nodes (for a width of 4 or 8)
+	void collapseNodes();
+
+	/// Rearrange the wide nodes according to \ref m_layout
+	void reorderNodes();
+
+	/// Replace the wide nodes by their quantized counterparts
+	void compressNodes();
+
+	/// Return whether the binary nodes are kept after the build
+	bool keepsBinaryNodes() const { return m_width == 2 || m_refitSupport; }
+
+	/// Free the binary nodes and their build costs, keeping their statistics
+	void releaseBinaryNodes();
+
+	/// Return whether a BVH over the meshes registered with \ref addMesh() exists
+	bool hasNodes() const {
+		return !m_nodes.empty() || !m_nodes4.empty() || !m_nodes8.empty() ||
+			!m_qnodes4.empty() || !m_qnodes8.empty();
+	}
+
+	/// Return the number of bytes used by all nodes and their build costs
+	size_t nodeMemory() const;
+
+	/// Return the bounds of the root of the BVH
+	BoundingBox3f getRootBounds() const;
+
+	/// Add the structure of the binary BVH to \c stats
+	void collectTreeStatistics(BVHStatistics &stats) const;
+
+	/// Build the bottom-level BVHs and the top-level BVH over all instances
+	void buildInstances();
+
+	/// Recompute the world space bounds of all instances and the top-level BVH
+	void updateInstances();
+
+	/// Recursively build the top-level BVH over <tt>m_instances[start, end)</tt>
+	n_UINT buildTopLevel(n_UINT start, n_UINT end, int depth);
+
+	/// Recompute all node bounding boxes from the current vertex positions
+	void refitNodes();
+
+	/// Compute the SAH cost of every node relative to its own surface area
+	void computeCosts(std::vector<float> &costs) const;
+
+	/**
+	 * \brief Rebuild the given subtrees and splice them into the BVH
+	 *
+	 * The subtrees must be disjoint and listed in depth-first order.
+	 */
+	void rebuildSubtrees(const std::vector<n_UINT> &roots);
+
+	/// Hash of the registered geometry and the build settings
+	uint64_t cacheKey() const;
+
+	/// Load the BVH from the cache file, unless it is missing or stale
+	bool loadCache(uint64_t key);
+
+	/// Write the BVH to the cache file
+	void saveCache(uint64_t key) const;
+
+	/// Marks an unused slot of \ref m_indices
+	static const n_UINT INVALID_INDEX = (n_UINT) -1;
+
+	/**
+	 * \brief Group of PACKET_SIZE triangles that are intersected at once
+	 *
+	 * Packets follow the final order of \ref m_indices: lane \c j of
+	 * packet \c i holds the triangle <tt>m_indices[i * PACKET_SIZE + j]</tt>.
+	 * Vertex positions are stored in SoA layout across the lanes, and
+	 * unused lanes hold NaN vertices that can never produce a hit.
+	 */
+	struct TrianglePacket {
+		float v[3][3][PACKET_SIZE];   ///< Vertex positions (vertex, axis, lane)
+		uint32_t meshId[PACKET_SIZE]; ///< Index of the mesh in \ref m_meshes
+		n_UINT primId[PACKET_SIZE];   ///< Triangle index within that mesh
+	};
+
+	/// Per-ray constants shared by all box and triangle tests of a query
+	struct RayData;
+
+	/**
+	 * \brief Move each leaf to a multiple of PACKET_SIZE within
+	 * \ref m_indices, padding the gaps with INVALID_INDEX
+	 */
+	void packLeaves();
+
+	/// Fill \ref m_packets from the final order of \ref m_indices
+	void buildTrianglePackets();
+
+	/// Build the triangle packets <tt>[first, last)</tt> into \c packets
+	void buildTrianglePackets(n_UINT first, n_UINT last, TrianglePacket *packets) const;
+
+	/**
+	 * \brief Write the triangle packets to a new page file (see \ref setPaging())
+	 *
+	 * Pages are built one at a time unless \ref m_packets is already filled
+	 */
+	void pageOutPackets();
+
+	/// Move the vertex attributes of the meshes into the page file
+	void pageOutMeshes();
+
+	/// Target size of the pages of triangle packets in bytes
+	static const size_t PAGE_SIZE = 64 * 1024;
+
+	/// Placement of a bottom-level BVH in the scene
+	struct Instance {
+		const Accel *accel;  ///< Shared bottom-level BVH (\c this for the own meshes)
+		Matrix3x4f toWorld;  ///< Affine instance-to-world transformation
+		Matrix3x4f toLocal;  ///< Inverse of \c toWorld
+		BoundingBox3f bbox;  ///< World space bounding box
+
+		/// Transform a point into world space
+		Point3f pointToWorld(const Point3f &p) const {
+			return toWorld.leftCols<3>() * p + toWorld.col(3);
+		}
+	};
+
+	/// Closest triangle found during traversal (its distance is \c ray.maxt)
+	struct Hit {
+		const Mesh *mesh = nullptr; ///< Mesh containing the triangle
+		n_UINT f = 0;               ///< Triangle index within the mesh
+		float u = 0, v = 0;         ///< Barycentric coordinates
+		const Instance *instance = nullptr; ///< Instance of the mesh, if any
+	};
+
+	/**
+	 * \brief Intersect a ray against the triangles of a leaf node
+	 *
+	 * Tests one \ref TrianglePacket at a time with a vectorized version
+	 * of the watertight algorithm by Woop et al. Shortens \c ray.maxt and
+	 * updates \c hit whenever a closer triangle is found. When
+	 * \c shadowRay is set, returns on the first intersection.
+	 */
+	bool intersectLeaf(n_UINT start, n_UINT end, Ray3f &ray,
+		const RayData &rayData, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const;
+
+	/// Run a closest-hit (or any-hit, when \c shadowRay is set) traversal
+	bool traverse(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const;
+
+	/// Select the traversal routine for a query
+	bool traverseQuery(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const;
+
+	/// Traverse the BVH over the meshes registered with \ref addMesh()
+	bool traverseTree(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const;
+
+	/**
+	 * \brief Traverse the top-level BVH, descending into the bottom-level
+	 * BVH of each instance that the ray reaches
+	 */
+	bool traverseInstances(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const;
+
+	/**
+	 * \brief Traverse the binary BVH
+	 *
+	 * Children are visited front to back using the split axis stored
+	 * in each inner node, and deferred nodes whose entry distance lies
+	 * beyond the closest hit found so far are skipped.
+	 */
+	bool traverseBinary(Ray3f &ray, const RayData &rayData, Hit &hit,
+		bool shadowRay, TraversalStats *stats) const;
+
+	/**
+	 * \brief Traverse the BVH with a packet of rays
+	 *
+	 * Uses the same nodes as \ref traverseTree() (binary, wide or
+	 * quantized). Returns the mask of the rays that found an intersection.
+	 */
+	template <int Size> uint32_t traversePacket(RayPacket<Size> &packet,
+		bool shadowRay, TraversalStats *stats) const;
+
+	/**
+	 * \brief Traverse the binary BVH with the rays of a packet in \c mask
+	 *
+	 * \c rays, \c rayData and \c hits hold the scalar state of each ray.
+	 * Returns the mask of the rays that found an intersection.
+	 */
+	template <int Size> uint32_t traversePacketBinary(RayPacket<Size> &packet,
+		Ray3f *rays, const RayData *rayData, Hit *hits, uint32_t mask,
+		bool shadowRay, TraversalStats *stats) const;
+
+	/// Like \ref traversePacketBinary(), for a wide BVH (with full precision or quantized nodes)
+	template <typename Node, int Size> uint32_t traversePacketWide(
+		const std::vector<Node> &nodes, RayPacket<Size> &packet,
+		Ray3f *rays, const RayData *rayData, Hit *hits, uint32_t mask,
+		bool shadowRay, TraversalStats *stats) const;
+
+	/* BVH node in 32 bytes */
+	struct BVHNode {
+		union {
+			struct {
+				unsigned flag : 1;
+				uint32_t size : 31;
+				n_UINT start;
+			} leaf;
+
+			struct {
+				unsigned flag : 1;
+				uint32_t axis : 31;
+				n_UINT rightChild;
+			} inner;
+
+			uint64_t data;
+		};
+		BoundingBox3f bbox;
+
+		bool isLeaf() const {
+			return leaf.flag == 1;
+		}
+
+		bool isInner() const {
+			return leaf.flag == 0;
+		}
+
+		bool isUnused() const {
+			return data == 0;
+		}
+
+		n_UINT start() const {
+			return leaf.start;
+		}
+
+		n_UINT end() const {
+			return leaf.start + leaf.size;
+		}
+	};
+
+	/**
+	 * \brief Collapsed BVH node with up to \c Width children
+	 *
+	 * Child bounding boxes are stored in SoA layout (one row per plane).
+	 * Unused child slots hold an inverted box that no ray can hit.
+	 */
+	template <int Width> struct WideBVHNode {
+		enum { ChildCount = Width };
+
+		float bounds[6][Width]; ///< min.x, min.y, min.z, max.x, max.y, max.z
+		n_UINT child[Width];    ///< Wide node index, or first index of a leaf
+		uint32_t count[Width];  ///< Triangle count of a leaf, 0 for inner children
+
+		/// Bit mask of the used child slots
+		uint32_t getChildMask() const {
+			uint32_t mask = 0;
+			for (int i = 0; i < Width; ++i)
+				if (count[i] > 0 || bounds[0][i] <= bounds[3][i])
+					mask |= 1u << i;
+			return mask;
+		}
+
+		/// Bounding box of child \c i
+		BoundingBox3f getChildBounds(int i) const {
+			return BoundingBox3f(Point3f(bounds[0][i], bounds[1][i], bounds[2][i]),
+				Point3f(bounds[3][i], bounds[4][i], bounds[5][i]));
+		}
+	};
+
+	/**
+	 * \brief Wide BVH node with child bounding boxes quantized to 8 bits
+	 *
+	 * A plane with code \c q lies at <tt>origin + q * scale</tt>. Since
+	 * the scales are powers of two, the product is exact and decoding
+	 * involves a single rounding, which is accounted for when the codes
+	 * are chosen. Unused child slots are cleared in \c valid.
+	 */
+	template <int Width> struct QuantizedBVHNode {
+		enum { ChildCount = Width };
+
+		float origin[3];         ///< Minimum corner of the union of the child boxes
+		float scale[3];          ///< Size of one quantization step per axis
+		uint8_t bounds[6][Width]; ///< Quantized planes in the order of \ref WideBVHNode
+		n_UINT child[Width];     ///< Wide node index, or first index of a leaf
+		uint32_t count[Width];   ///< Triangle count of a leaf, 0 for inner children
+		uint32_t valid;          ///< Bit mask of the used child slots
+
+		/// Bit mask of the used child slots
+		uint32_t getChildMask() const { return valid; }
+
+		/// Conservatively decoded bounding box of child \c i
+		BoundingBox3f getChildBounds(int i) const;
+	};
+
+	/// Recursively collapse the binary subtree at \c node_idx into wide nodes
+	template <int Width> n_UINT collapse(
+		std::vector<WideBVHNode<Width>> &nodes, n_UINT node_idx) const;
+
+	/// Quantize the child bounding boxes of a list of wide nodes
+	template <int Width> static void quantize(
+		const std::vector<WideBVHNode<Width>> &nodes,
+		std::vector<QuantizedBVHNode<Width>> &result);
+
+	/**
+	 * \brief Slab test of a ray against all children of a wide node
+	 *
+	 * Returns a bit mask of the children whose box overlaps [mint, maxt]
+	 * and writes their entry distances to \c tNear.
+	 */
+	template <int Width> static uint32_t intersectChildren(
+		const float (&bounds)[6][Width], const RayData &rayData,
+		float mint, float maxt, float *tNear);
+
+	/// Slab test against the children of a wide node
+	template <int Width> static uint32_t intersectChildren(
+		const WideBVHNode<Width> &node, const RayData &rayData,
+		float mint, float maxt, float *tNear) {
+		return intersectChildren<Width>(node.bounds, rayData, mint, maxt, tNear);
+	}
+
+	/// Slab test against the conservatively decoded children of a quantized node
+	template <int Width> static uint32_t intersectChildren(
+		const QuantizedBVHNode<Width> &node, const RayData &rayData,
+		float mint, float maxt, float *tNear);
+
+	/// Traverse a wide BVH (with full precision or quantized nodes)
+	template <typename Node> bool traverseWide(
+		const std::vector<Node> &nodes, Ray3f &ray,
+		const RayData &rayData, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const;
+private:
+	std::vector<Mesh *> m_meshes;       ///< List of meshes registered with the BVH
+	std::vector<n_UINT> m_meshOffset; ///< Index of the first triangle for each shape
+	std::vector<BVHNode> m_nodes;       ///< BVH nodes
+	std::vector<n_UINT> m_indices;    ///< Index references by BVH nodes
+	std::vector<TrianglePacket> m_packets; ///< Triangles in leaf order
+	std::vector<WideBVHNode<4>> m_nodes4; ///< Collapsed 4-wide BVH nodes
+	std::vector<WideBVHNode<8>> m_nodes8; ///< Collapsed 8-wide BVH nodes
+	std::vector<QuantizedBVHNode<4>> m_qnodes4; ///< Quantized 4-wide BVH nodes
+	std::vector<QuantizedBVHNode<8>> m_qnodes8; ///< Quantized 8-wide BVH nodes
+	int m_width = 2;                    ///< Branching factor used for traversal
+	EBuilder m_builder = EBinnedSAH;    ///< Construction algorithm of the binary BVH
+	float m_splitBudget = 0.3f;         ///< Relative reference growth allowed for spatial splits
+	bool m_treeletOptimization = true;  ///< Restructure treelets after a linear build
+	bool m_compression = false;         ///< Quantize the wide nodes after the build
+	ENodeLayout m_layout = EDepthFirst; ///< Memory layout of the wide nodes
+	size_t m_compressionSavings = 0;    ///< Bytes of node memory saved after the build
+	float m_rebuildThreshold = 0.5f;    ///< Relative SAH cost increase that triggers a rebuild
+	std::vector<float> m_buildCosts;    ///< SAH cost of each node right after it was built
+	bool m_refitSupport = false;        ///< Keep the binary nodes of a wide BVH for refit()
+	BVHStatistics m_treeStats;          ///< Structure of the binary BVH after it was released
+	std::string m_cacheFile;            ///< BVH cache file (disabled if empty)
+	std::string m_pageFile;             ///< Page file of the triangle packets (disabled if empty)
+	size_t m_pageBudget = 0;            ///< Bytes of triangle packets kept in memory when paging
+	std::unique_ptr<PageCache> m_pager; ///< Paged triangle packets (replaces m_packets)
+	std::vector<n_UINT> m_pageStart;    ///< First packet of each page
+	std::vector<Instance> m_instances;  ///< Instances in top-level BVH order
+	std::vector<BVHNode> m_topNodes;    ///< Top-level BVH nodes (leaves index m_instances)
+	std::vector<std::unique_ptr<Accel>> m_blas; ///< Bottom-level BVHs, one per instanced mesh
+	std::map<const Mesh *, const Accel *> m_blasIndex; ///< Bottom-level BVH of each instanced mesh
+	BoundingBox3f m_bbox;               ///< Bounding box of the entire BVH
+};
+
+
+NORI_NAMESPACE_END
@@ -0,0 +1,97 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/film.h>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Distributes the samples of each pass of a progressive render
+ * over the pixels
+ *
+ * Before every pass, \ref plan() looks at the \ref PixelStatistics of
+ * the film: pixels that do not have the minimum number of samples yet
+ * are topped up first, and the rest of the budget of the pass goes to
+ * the remaining pixels in proportion to the relative standard error of
+ * their mean, taking the largest error in a small neighbourhood of each
+ * pixel. Pixels whose neighbourhood is below the threshold have
+ * converged and receive no further samples, and blocks without any
+ * samples are skipped altogether.
+ */
+class AdaptiveSampling {
+public:
+    /**
+     * \param size
+     *     Size of the image
+     * \param threshold
+     *     Relative standard error below which a pixel is converged
+     * \param minSampleCount
+     *     Number of samples each pixel receives before its error is trusted
+     * \param maxPassSampleCount
+     *     Largest number of samples a pixel may receive in one pass
+     */
+    AdaptiveSampling(const Vector2i &size, float threshold,
+                     uint32_t minSampleCount, uint32_t maxPassSampleCount);
+
+    /**
+     * \brief Distribute the samples of the next pass
+     *
+     * \param film
+     *     Film of the render so far (with statistics)
+     * \param budget
+     *     Number of samples that may be taken in the pass. It is only
+     *     exceeded to give every pixel the minimum number of samples.
+     * \return
+     *     Number of samples planned (0 once all pixels have converged)
+     */
+    uint64_t plan(const Film &film, uint64_t budget);
+
+    /// Return the number of samples planned for a pixel (in image coordinates)
+    uint32_t getSampleCount(const Point2i &pixel) const {
+        return m_counts[pixel.y() * m_size.x() + pixel.x()];
+    }
+
+    /// Return the largest number of samples planned for a pixel of the given block
+    uint32_t getMaxSampleCount(const Point2i &offset, const Vector2i &size) const;
+
+    /// Return the number of converged pixels as of the last \ref plan()
+    size_t getConvergedPixels() const { return m_converged; }
+
+    /// Return the RMS relative error of the pixels as of the last \ref plan()
+    float getRelativeError() const { return m_error; }
+
+    /// Return a human-readable string summary
+    std::string toString() const;
+
+private:
+    Vector2i m_size;
+    float m_threshold;
+    uint32_t m_minSampleCount;
+    uint32_t m_maxPassSampleCount;
+    std::vector<uint32_t> m_counts;  ///< Samples of each pixel in the next pass
+    std::vector<float> m_errors;     ///< Relative error of each pixel
+    std::vector<float> m_weights;    ///< Share of the budget of each unconverged pixel
+    std::vector<float> m_residual;   ///< Fractional samples carried over to the next pass
+    size_t m_converged = 0;
+    float m_error = 0;
+};
+
+NORI_NAMESPACE_END
@@ -22,6 +22,29 @@
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Ray data that is precomputed once for many ray-box tests
+ *
+ * Stores the reciprocal direction and which of the two planes of each
+ * slab the ray reaches first, so that a slab test needs neither
+ * divisions nor data-dependent branches.
+ */
+struct RaySlabData {
+    float o[3];    ///< Ray origin
+    float dRcp[3]; ///< Component-wise reciprocal of the ray direction
+    int sign[3];   ///< 1 if the ray enters the slab through its maximum plane
+
+    RaySlabData() { }
+
+    RaySlabData(const Ray3f &ray) {
+        for (int i = 0; i < 3; ++i) {
+            o[i] = ray.o[i];
+            dRcp[i] = ray.dRcp[i];
+            sign[i] = ray.dRcp[i] < 0 ? 1 : 0;
+        }
+    }
+};
+
 /**
  * \brief Generic n-dimensional bounding box data structure
  *
@@ -331,64 +354,42 @@ template <typename _PointType> struct TBoundingBox {
             return tfm::format("BoundingBox[min=%s, max=%s]", min.toString(), max.toString());
     }
 
-    /// Check if a ray intersects a bounding box
-    bool rayIntersect(const Ray3f &ray) const {
-        float nearT = -std::numeric_limits<float>::infinity();
-        float farT = std::numeric_limits<float>::infinity();
-
-        for (int i=0; i<3; i++) {
-            float origin = ray.o[i];
-            float minVal = min[i], maxVal = max[i];
-
-            if (ray.d[i] == 0) {
-                if (origin < minVal || origin > maxVal)
-                    return false;
-            } else {
-                float t1 = (minVal - origin) * ray.dRcp[i];
-                float t2 = (maxVal - origin) * ray.dRcp[i];
-
-                if (t1 > t2)
-                    std::swap(t1, t2);
-
-                nearT = std::max(t1, nearT);
-                farT = std::min(t2, farT);
-
-                if (!(nearT <= farT))
-                    return false;
-            }
+    /**
+     * \brief Branch-free slab test against the segment [\c mint, \c maxt]
+     * of a ray
+     *
+     * Writes the overlap of the box and the segment to \c nearT and
+     * \c farT. A zero direction component yields infinite plane distances
+     * of the appropriate signs; if the origin also lies exactly on one of
+     * the planes, the slab produces a NaN and is ignored, since the
+     * comparisons below keep the current interval bound in that case.
+     *
+     * \return \c true if the overlap is nonempty
+     */
+    bool rayIntersect(const RaySlabData &ray, float mint, float maxt,
+                      float &nearT, float &farT) const {
+        float tn = mint, tf = maxt;
+        for (int i = 0; i < 3; ++i) {
+            float t0 = ((ray.sign[i] ? max : min)[i] - ray.o[i]) * ray.dRcp[i];
+            float t1 = ((ray.sign[i] ? min : max)[i] - ray.o[i]) * ray.dRcp[i];
+            tn = t0 > tn ? t0 : tn;
+            tf = t1 < tf ? t1 : tf;
         }
+        nearT = tn;
+        farT = tf;
+        return tn <= tf;
+    }
 
-        return ray.mint <= farT && nearT <= ray.maxt;
+    /// Check if a ray intersects the bounding box within [mint, maxt]
+    bool rayIntersect(const Ray3f &ray) const {
+        float nearT, farT;
+        return rayIntersect(RaySlabData(ray), ray.mint, ray.maxt, nearT, farT);
     }
 
     /// Return the overlapping region of the bounding box and an unbounded ray
     bool rayIntersect(const Ray3f &ray, float &nearT, float &farT) const {
-        nearT = -std::numeric_limits<float>::infinity();
-        farT = std::numeric_limits<float>::infinity();
-
-        for (int i=0; i<3; i++) {
-            float origin = ray.o[i];
-            float minVal = min[i], maxVal = max[i];
-
-            if (ray.d[i] == 0) {
-                if (origin < minVal || origin > maxVal)
-                    return false;
-            } else {
-                float t1 = (minVal - origin) * ray.dRcp[i];
-                float t2 = (maxVal - origin) * ray.dRcp[i];
-
-                if (t1 > t2)
-                    std::swap(t1, t2);
-
-                nearT = std::max(t1, nearT);
-                farT = std::min(t2, farT);
-
-                if (!(nearT <= farT))
-                    return false;
-            }
-        }
-
-        return true;
+        return rayIntersect(RaySlabData(ray), -std::numeric_limits<float>::infinity(),
+                            std::numeric_limits<float>::infinity(), nearT, farT);
     }
 
     PointType min; ///< Component-wise minimum 
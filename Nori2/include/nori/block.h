@@ -24,7 +24,11 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
-#include <tbb/mutex.h>
+#include <nori/bbox.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "nori/bitmap.h"
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
@@ -91,18 +95,49 @@ public:
         setConstant(Color4f()); 
     }
 
+    /// Pixels of the block covered by a sample, and their filter weights
+    struct Footprint {
+        BoundingBox2i bbox;     ///< Covered pixels (including the border)
+        const float *weightsX;  ///< Filter weight of each column of \c bbox
+        const float *weightsY;  ///< Filter weight of each row of \c bbox
+    };
+
+    /**
+     * \brief Compute the footprint of a sample at the given position
+     *
+     * The weights are stored in the block and remain valid until the
+     * next call. The footprint can be passed to any block with the same
+     * offset, size and reconstruction filter.
+     */
+    Footprint getFootprint(const Point2f &pos);
+
     /// Record a sample with the given position and radiance value
     void put(const Point2f &pos, const Color3f &value);
 
+    /// Record a sample whose footprint has already been computed (the value is not checked)
+    void put(const Footprint &footprint, const Color3f &value);
+
     /**
      * \brief Merge another image block into this one
      *
-     * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * Several threads may merge blocks at the same time, provided that
+     * the blocks partition the image into disjoint rectangles, like the
+     * blocks (and split blocks) handed out by a \ref BlockGenerator.
+     * Including their borders, such blocks only overlap their
+     * neighbours within a band of twice the border size along their
+     * edges, so only that band is synchronized, using one lock per row
+     * of the destination; the interior of \c b is added without
+     * locking. Blocks that overlap further must not be merged
+     * concurrently.
      */
     void put(ImageBlock &b);
 
-    /// Lock the image block (using an internal mutex)
+    /**
+     * \brief Lock the image block (using an internal mutex)
+     *
+     * Merges do not take this lock, so a reader (e.g. the preview
+     * window) may see a partially merged block.
+     */
     inline void lock() const { m_mutex.lock(); }
     
     /// Unlock the image block
@@ -120,16 +155,27 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
-    mutable tbb::mutex m_mutex;
+    mutable std::mutex m_mutex;
+    std::unique_ptr<std::mutex[]> m_rowLocks; ///< Lock of each row (see \ref put(ImageBlock &))
 };
 
 /**
- * \brief Spiraling block generator
+ * \brief Lock-free, cost-aware block generator
  *
  * This class can be used to chop up an image into many small
- * rectangular blocks suitable for parallel rendering. The blocks
- * are ordered in spiraling pattern so that the center is
- * rendered first.
+ * rectangular blocks suitable for parallel rendering. The blocks of a
+ * pass are handed out from a shared queue with a single atomic
+ * increment, so a thread that finishes early simply continues with the
+ * next block instead of waiting for a fixed share of the image.
+ *
+ * The generator is reused for all passes of a render. Without cost
+ * information, the blocks are ordered in spiraling pattern so that the
+ * center is rendered first. When the cost of the blocks is reported with
+ * \ref addCost(), the next pass starts with the most expensive blocks,
+ * and the cheap ones fill the gaps at the end. Blocks that would still
+ * keep one thread busy while the others run out of work are split into
+ * quadrants. Split blocks partition the image like the regular ones, so
+ * they can be merged concurrently as well (see \ref ImageBlock::put()).
  */
 class BlockGenerator {
 public:
@@ -141,30 +187,62 @@ public:
      *      Maximum size of the individual blocks
      */
     BlockGenerator(const Vector2i &size, int blockSize);
-    
+
+    /**
+     * \brief Start a new pass over the image
+     *
+     * Orders the blocks by the costs reported since the previous call
+     * (most expensive first) and clears them.
+     *
+     * \param threadCount
+     *      Number of threads that render the pass. Blocks expected to
+     *      take more than an eighth of the average work of a thread
+     *      are split (0: never split)
+     */
+    void reset(int threadCount = 0);
+
     /**
      * \brief Return the next block to be rendered
      *
-     * This function is thread-safe
+     * This function is thread-safe and does not block
      *
      * \return \c false if there were no more blocks
      */
     bool next(ImageBlock &block);
 
-    /// Return the total number of blocks
-    int getBlockCount() const { return m_blocksLeft; }
+    /**
+     * \brief Report the cost of rendering a block of the current pass
+     * (e.g. in nanoseconds)
+     *
+     * This function is thread-safe
+     */
+    void addCost(const ImageBlock &block, uint64_t cost);
+
+    /// Return the total number of blocks of the current pass
+    int getBlockCount() const { return (int) m_blocks.size(); }
+
+    /// Return the number of blocks that were split in the current pass
+    int getSplitCount() const { return m_splitCount; }
 protected:
     enum EDirection { ERight = 0, EDown, ELeft, EUp };
 
-    Point2i m_block;
+    struct Block {
+        Point2i offset;
+        Vector2i size;
+        double cost;
+    };
+
+    /// Append a block, split into quadrants while it is more expensive than \c maxCost
+    void addBlock(const Point2i &offset, const Vector2i &size, double cost, double maxCost);
+
     Vector2i m_numBlocks;
     Vector2i m_size;
     int m_blockSize;
-    int m_numSteps;
-    int m_blocksLeft;
-    int m_stepsLeft;
-    int m_direction;
-    tbb::mutex m_mutex;
+    std::vector<Point2i> m_spiral;  ///< Grid position of each block, in spiral order
+    std::vector<Block> m_blocks;    ///< Blocks of the current pass, in the order they are handed out
+    std::atomic<int> m_next;        ///< Index of the next block in \ref m_blocks
+    std::unique_ptr<std::atomic<uint64_t>[]> m_costs; ///< Cost of each grid cell in the current pass
+    int m_splitCount = 0;
 };
 
 NORI_NAMESPACE_END
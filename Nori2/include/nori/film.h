@@ -0,0 +1,177 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <nori/integrator.h>
+#include <memory>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Running mean and variance of the luminance of the samples in a
+ * pixel (Welford's algorithm)
+ */
+struct PixelStatistics {
+    uint32_t count = 0; ///< Number of samples
+    float mean = 0;     ///< Mean luminance
+    float m2 = 0;       ///< Sum of the squared deviations from the mean
+
+    /// Record a sample
+    void put(float value) {
+        count++;
+        float delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    /// Add the statistics of further samples of the same pixel
+    void put(const PixelStatistics &other) {
+        if (other.count == 0)
+            return;
+        uint32_t total = count + other.count;
+        float delta = other.mean - mean;
+        mean += delta * ((float) other.count / total);
+        m2 += other.m2 + delta * delta * ((float) count * other.count / total);
+        count = total;
+    }
+
+    /// Return the sample variance
+    float getVariance() const { return count > 1 ? m2 / (count - 1) : 0.0f; }
+
+    /**
+     * \brief Return the standard error of the mean relative to the mean
+     *
+     * The offset keeps dark pixels from dominating.
+     */
+    float getRelativeError() const {
+        return std::sqrt(getVariance() / std::max(count, 1u)) / (std::abs(mean) + 1e-2f);
+    }
+};
+
+/**
+ * \brief Image block for the radiance plus one image block per AOV
+ *
+ * Receives the \ref RadianceSample of each camera ray at once: the
+ * footprint of the sample under the reconstruction filter is computed
+ * a single time and then splatted into every enabled channel. Disabled
+ * AOVs take no memory.
+ *
+ * The film can also keep \ref PixelStatistics of the samples that fall
+ * into each pixel (without the reconstruction filter), which adaptive
+ * sampling and the sample count AOV are based on. Like the interior of
+ * a block, they are merged without locking.
+ */
+class Film {
+public:
+    /**
+     * \param size
+     *     Desired maximum size of the blocks
+     * \param filter
+     *     Image reconstruction filter
+     * \param aovs
+     *     Bit mask of the AOVs to store (bit <tt>1 << EAOV...</tt>)
+     * \param statistics
+     *     Keep the \ref PixelStatistics of each pixel (always done
+     *     if the sample count AOV is requested)
+     */
+    Film(const Vector2i &size, const ReconstructionFilter *filter, uint32_t aovs,
+         bool statistics = false);
+
+    /// Return the bit mask of stored AOVs
+    uint32_t getAOVs() const { return m_aovMask; }
+
+    /// Return the radiance image
+    ImageBlock &getImage() { return m_image; }
+
+    /// Return the radiance image (const version)
+    const ImageBlock &getImage() const { return m_image; }
+
+    /// Return the image of an AOV (\c nullptr if it is not stored)
+    const ImageBlock *getAOV(EAOV aov) const { return m_aovs[aov].get(); }
+
+    /// Does the film keep per-pixel statistics?
+    bool hasStatistics() const { return !m_statistics.empty(); }
+
+    /// Return the statistics of a pixel (in image coordinates)
+    const PixelStatistics &getStatistics(const Point2i &pixel) const {
+        return m_statistics[(pixel.y() - getOffset().y()) * m_stride + pixel.x() - getOffset().x()];
+    }
+
+    /// Configure the offset of all blocks within the main image
+    void setOffset(const Point2i &offset);
+
+    /// Return the offset of the blocks within the main image
+    const Point2i &getOffset() const { return m_image.getOffset(); }
+
+    /// Configure the size of all blocks within the main image
+    void setSize(const Vector2i &size);
+
+    /// Return the size of the blocks within the main image
+    const Vector2i &getSize() const { return m_image.getSize(); }
+
+    /// Clear all contents
+    void clear();
+
+    /// Record a sample with the given position in all channels
+    void put(const Point2f &pos, const RadianceSample &sample);
+
+    /**
+     * \brief Merge another film with the same AOVs into this one
+     *
+     * Like \ref ImageBlock::put(ImageBlock &), films may be merged
+     * concurrently as long as they cover disjoint rectangles of the image
+     * (e.g. the blocks, or parts of split blocks, handed out by a
+     * \ref BlockGenerator). The pixel statistics are merged without
+     * locking, since each pixel belongs to exactly one of them.
+     */
+    void put(Film &film);
+
+    /**
+     * \brief Write the radiance and every AOV to OpenEXR files
+     *
+     * The radiance is written to \c <name>.exr, and each AOV to a file
+     * whose name is prefixed with the name of the AOV (e.g.
+     * \c direct_<name>.exr). The radiance and the direct and indirect
+     * images are also written as tonemapped PNG files.
+     */
+    void save(const std::string &name) const;
+
+    /// Parse a comma-separated list of AOV names (e.g. "direct,normal") into a bit mask
+    static uint32_t parseAOVs(const std::string &names);
+
+    /// Return the name of an AOV
+    static const char *getAOVName(EAOV aov);
+
+    /// Return a human-readable string summary
+    std::string toString() const;
+
+private:
+    Film(const Film &) = delete;
+    Film &operator=(const Film &) = delete;
+
+    ImageBlock m_image;
+    std::unique_ptr<ImageBlock> m_aovs[EAOVCount];
+    uint32_t m_aovMask;
+    std::vector<PixelStatistics> m_statistics; ///< Row-major, \c m_stride pixels per row
+    int m_stride;
+};
+
+NORI_NAMESPACE_END
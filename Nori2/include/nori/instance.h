@@ -0,0 +1,62 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/object.h>
+#include <nori/transform.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Placement of a mesh in the scene
+ *
+ * A mesh with one or more <tt>&lt;instance&gt;</tt> children is not added
+ * to the scene directly. Instead, its geometry is stored once in a shared
+ * bottom-level BVH, and each instance places a copy of it using its
+ * \c toWorld transformation:
+ *
+ * \code
+ * <mesh type="obj">
+ *     <string name="filename" value="chair.obj"/>
+ *     <instance>
+ *         <transform name="toWorld"> <translate value="1, 0, 0"/> </transform>
+ *     </instance>
+ *     <instance>
+ *         <transform name="toWorld"> <translate value="3, 0, 0"/> </transform>
+ *     </instance>
+ * </mesh>
+ * \endcode
+ */
+class MeshInstance : public NoriObject {
+public:
+    MeshInstance(const PropertyList &propList);
+
+    /// Return the instance-to-world transformation
+    const Transform &getTransform() const { return m_toWorld; }
+
+    /// Return a human-readable summary of this instance
+    std::string toString() const;
+
+    EClassType getClassType() const { return EInstance; }
+
+private:
+    Transform m_toWorld;
+};
+
+NORI_NAMESPACE_END
@@ -19,9 +19,92 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/color.h>
+#include <nori/ray.h>
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief State of a path that is traced one bounce at a time
+ *
+ * See \ref Integrator::shade().
+ */
+struct PathState {
+    Ray3f ray;          ///< Next ray along the path
+    Color3f throughput; ///< Path weight up to the origin of \c ray
+    Color3f radiance;   ///< Radiance gathered along the path so far
+    Color3f direct;     ///< Part of \c radiance that is direct illumination (see \ref add())
+    bool wasSmooth;     ///< Was \c ray sampled from a discrete BSDF?
+    int depth;          ///< Number of bounces so far (0 for the camera ray)
+
+    PathState() { }
+
+    /// Start a path with the given camera ray
+    PathState(const Ray3f &ray) : ray(ray), throughput(1.0f), radiance(0.0f),
+        direct(0.0f), wasSmooth(false), depth(0) { }
+
+    /**
+     * \brief Does emitted radiance found at the end of \c ray count as
+     * direct illumination?
+     *
+     * This is the case for emitters seen from the camera and for those
+     * reached by one non-specular bounce, however they are weighted
+     * (e.g. by MIS). Light sampled explicitly at a vertex is direct if
+     * the vertex is the first hit, i.e. if \c depth is 0.
+     */
+    bool isDirectEmission() const { return depth == 0 || (depth == 1 && !wasSmooth); }
+
+    /// Add radiance gathered at the current vertex
+    void add(const Color3f &value, bool isDirect) {
+        radiance += value;
+        if (isDirect)
+            direct += value;
+    }
+};
+
+/// Auxiliary images (AOVs) that can be rendered next to the radiance
+enum EAOV {
+    EAOVDirect = 0, ///< Emitted and direct illumination at the first hit (see \ref PathState::add())
+    EAOVIndirect,   ///< Illumination that bounced more than once
+    EAOVNormal,     ///< Shading normal at the first hit
+    EAOVDepth,      ///< Distance to the first hit
+    EAOVSampleCount,///< Number of samples taken in each pixel (kept by the \ref Film itself)
+    EAOVCount
+};
+
+/**
+ * \brief Radiance estimate of a camera ray together with its AOVs
+ *
+ * See \ref Integrator::sample().
+ */
+struct RadianceSample {
+    Color3f radiance;   ///< Total radiance along the ray
+    Color3f direct;     ///< Part of \c radiance that is direct illumination
+    Color3f indirect;   ///< Remainder of \c radiance
+    Normal3f normal;    ///< Shading normal at the first hit (zero if the ray escaped)
+    float depth;        ///< Distance to the first hit (zero if the ray escaped)
+
+    RadianceSample() : radiance(0.0f), direct(0.0f), indirect(0.0f),
+        normal(0.0f), depth(0.0f) { }
+
+    /// Record the radiance of an integrator that does not trace paths (all of it is direct)
+    void setRadiance(const Color3f &value) {
+        radiance = direct = value;
+        indirect = Color3f(0.0f);
+    }
+
+    /// Record the geometric AOVs of the first hit (if requested in \c aovs)
+    void setPrimaryHit(const Intersection &its, uint32_t aovs);
+
+    /// Scale the radiometric channels, e.g. by the weight of the camera ray
+    RadianceSample &operator*=(const Color3f &weight) {
+        radiance *= weight;
+        direct *= weight;
+        indirect *= weight;
+        return *this;
+    }
+};
+
 /**
  * \brief Abstract integrator (i.e. a rendering technique)
  *
@@ -53,18 +136,103 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Sample the incident radiance along a camera ray whose first
+     * intersection has already been found
+     *
+     * When \ref usesPrimaryHits() returns \c true, the renderer traces the
+     * camera rays of each image block through the BVH in packets and
+     * passes the compact hit record of every ray to this function
+     * (\c nullptr if the ray escaped). Call
+     * \ref Intersection::computeSurfaceData() if the shading data is needed.
+     * The default implementation traces the ray again.
+     */
+    virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, Intersection *its) const {
+        return Li(scene, sampler, ray);
+    }
+
+    /**
+     * \brief Sample the radiance along a camera ray together with the
+     * requested AOVs
+     *
+     * Everything is estimated from a single path, so that rendering AOVs
+     * does not cost a second path per sample. \c aovs is a bit mask with
+     * bit <tt>1 << EAOV...</tt> set for each requested output; the others
+     * may be left unset. The default implementation calls \ref Li() and
+     * reports all of the radiance as direct; the geometric AOVs cost an
+     * extra camera ray. Path tracers that implement \ref shade() forward
+     * to \ref tracePath(), which splits the radiance properly.
+     */
+    virtual void sample(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                        uint32_t aovs, RadianceSample &result) const;
+
+    /**
+     * \brief Variant of \ref sample() for a camera ray whose first
+     * intersection has already been found (see \ref usesPrimaryHits())
+     */
+    virtual void sample(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                        Intersection *its, uint32_t aovs, RadianceSample &result) const;
+
+    /// Does this integrator make use of precomputed camera ray intersections?
+    virtual bool usesPrimaryHits() const { return false; }
 
-    virtual void LiSeparated(const Scene *scene, Sampler *sampler, const Ray3f &ray, Color3f &direct, Color3f &indirect, Color3f throughput = Color3f(1.f), bool wasSmooth = false, bool first = true) const {
-        direct = Color3f(0.f);
-        indirect = Color3f(0.f);
+
+    /**
+     * \brief Advance a path by one bounce
+     *
+     * Path tracers that implement this function can be rendered in
+     * batches: the renderer traces the next ray of many paths at once
+     * (sorted for coherence, see \ref PathBatch) and passes the compact
+     * hit record of each ray here, or \c nullptr if the ray escaped.
+     * The radiance gathered at the vertex is added with \c state.add(),
+     * which also keeps track of the direct illumination.
+     *
+     * \return \c true after setting \c state.ray to the next ray, or
+     *    \c false if the path terminates
+     */
+    virtual bool shade(const Scene *scene, Sampler *sampler, PathState &state, Intersection *its) const {
+        throw NoriException("Integrator::shade(): not implemented by this integrator!");
     }
-    
+
+    /// Should the renderer trace the paths of each image block in batches (see \ref shade())?
+    bool isBatched() const { return m_batched; }
+
+    /// Are the rays of each bounce of a batch sorted for coherence?
+    bool sortsRays() const { return m_sortRays; }
+
+    /// Does the renderer also time each bounce of a batch without sorting, for comparison?
+    bool comparesUnsorted() const { return m_compareUnsorted; }
 
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
      * */
     EClassType getClassType() const { return EIntegrator; }
+
+protected:
+    /// Read the batching options of an integrator that implements \ref shade()
+    void setBatching(const PropertyList &props) {
+        m_batched = props.getBoolean("batched", false);
+        m_sortRays = props.getBoolean("sortRays", true);
+        m_compareUnsorted = props.getBoolean("compareUnsorted", false);
+    }
+
+    /// Trace a path ray by ray, calling \ref shade() at each bounce
+    Color3f tracePath(const Scene *scene, Sampler *sampler, const Ray3f &ray) const;
+
+    /**
+     * \brief Trace a path ray by ray and also record its AOVs
+     *
+     * The radiance that \ref shade() marks as direct (see
+     * \ref PathState::add()) goes to the direct AOV, the rest to the
+     * indirect one.
+     */
+    void tracePath(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                   uint32_t aovs, RadianceSample &result) const;
+
+    bool m_batched = false;
+    bool m_sortRays = true;
+    bool m_compareUnsorted = false;
 };
 
 NORI_NAMESPACE_END
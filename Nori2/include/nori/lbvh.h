@@ -0,0 +1,102 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/accel.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Linear BVH builder based on Morton codes
+ *
+ * Triangles are sorted along a Z-order curve through their centroids with
+ * a parallel radix sort, after which the hierarchy follows directly from
+ * the bits of the sorted codes. No SAH evaluation is involved, so the
+ * build is much faster than that of the binned builder, at the cost of a
+ * worse tree. This makes it a good fit for interactive previews of large
+ * meshes, where build time dominates render time.
+ *
+ * The optional treelet pass of "Fast Parallel Construction of
+ * High-Quality Bounding Volume Hierarchies" by Tero Karras and Timo Aila
+ * (Proc. High Performance Graphics, 2013) recovers much of the lost
+ * quality by finding the optimal topology of every treelet of up to
+ * seven leaves.
+ */
+class LBVHBuilder {
+public:
+	/**
+	 * \param bvh
+	 *    Reference to the underlying BVH
+	 *
+	 * \param optimize
+	 *    Restructure treelets after the hierarchy has been emitted
+	 */
+	LBVHBuilder(Accel &bvh, bool optimize);
+
+	/// Build the tree
+	void build();
+
+protected:
+	/// Triangle index together with the Morton code of its centroid
+	struct MortonPrimitive {
+		uint32_t code;
+		n_UINT prim;
+	};
+
+	/// Temporary node of the tree that is flattened at the end
+	struct Node {
+		BoundingBox3f bbox;
+		uint32_t left, right;  ///< Child node indices (INVALID_NODE for leaves)
+		n_UINT start, size;    ///< Range of sorted primitives (\c size holds the subtree size for inner nodes)
+		float cost;            ///< Unnormalized SAH cost of the subtree
+
+		bool isLeaf() const { return left == INVALID_NODE; }
+	};
+
+	static const uint32_t INVALID_NODE = (uint32_t) -1;
+
+	/// Sort the primitives by their Morton code (LSD radix sort)
+	void radixSort();
+
+	/**
+	 * \brief Recursively emit the subtree for the sorted range <tt>[start, end)</tt>
+	 *
+	 * The codes of the range are known to agree in all bits above \c bit.
+	 */
+	uint32_t emit(n_UINT start, n_UINT end, int bit);
+
+	/// Recursively restructure all treelets of a subtree (bottom-up)
+	void optimize(uint32_t node_idx);
+
+	/// Find the optimal topology of the treelet rooted at \c node_idx
+	void optimizeTreelet(uint32_t node_idx);
+
+	/// Append a subtree to the node and index arrays of the BVH
+	n_UINT flatten(uint32_t node_idx);
+
+private:
+	Accel &m_bvh;
+	bool m_optimize;
+	std::vector<MortonPrimitive> m_prims; ///< Primitives in Morton order
+	std::vector<Node> m_nodes;            ///< Temporary nodes
+	std::atomic<uint32_t> m_nodeCount;    ///< Number of allocated temporary nodes
+};
+
+NORI_NAMESPACE_END
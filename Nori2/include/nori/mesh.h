@@ -1,197 +1,286 @@
-/*
-    This file is part of Nori, a simple educational ray tracer
-
-    Copyright (c) 2015 by Wenzel Jakob
-
-    Nori is free software; you can redistribute it and/or modify
-    it under the terms of the GNU General Public License Version 3
-    as published by the Free Software Foundation.
-
-    Nori is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
-    GNU General Public License for more details.
-
-    You should have received a copy of the GNU General Public License
-    along with this program. If not, see <http://www.gnu.org/licenses/>.
-*/
-
-#pragma once
-
-#include <nori/object.h>
-#include <nori/frame.h>
-#include <nori/frame_anisotropic.h>
-#include <nori/bbox.h>
-#include <nori/dpdf.h>
-
-#ifndef n_UINT
-#define n_UINT uint32_t
-#endif
-
-NORI_NAMESPACE_BEGIN
-
-/**
- * \brief Intersection data structure
- *
- * This data structure records local information about a ray-triangle intersection.
- * This includes the position, traveled ray distance, uv coordinates, as well
- * as well as two local coordinate frames (one that corresponds to the true
- * geometry, and one that is used for shading computations).
- */
-struct Intersection {
-    /// Position of the surface intersection
-    Point3f p;
-    /// Unoccluded distance along the ray
-    float t;
-    /// UV coordinates, if any
-    Point2f uv;
-    /// Shading frame (based on the shading normal)
-    Frame_Anisotropic shFrame;
-    /// Geometric frame (based on the true geometry)
-    Frame_Anisotropic geoFrame;
-    /// Pointer to the associated mesh
-    const Mesh *mesh;
-
-    /// Create an uninitialized intersection record
-    Intersection() : mesh(nullptr) { }
-
-    /// Transform a direction vector into the local shading frame
-    Vector3f toLocal(const Vector3f &d) const {
-        return shFrame.toLocal(d);
-    }
-
-    /// Transform a direction vector from local to world coordinates
-    Vector3f toWorld(const Vector3f &d) const {
-        return shFrame.toWorld(d);
-    }
-
-    /// Return a human-readable summary of the intersection record
-    std::string toString() const;
-};
-
-/**
- * \brief Triangle mesh
- *
- * This class stores a triangle mesh object and provides numerous functions
- * for querying the individual triangles. Subclasses of \c Mesh implement
- * the specifics of how to create its contents (e.g. by loading from an
- * external file)
- */
-class Mesh : public NoriObject {
-public:
-    /// Release all memory
-    virtual ~Mesh();
-
-    /// Initialize internal data structures (called once by the XML parser)
-    virtual void activate();
-
-    /// Return the total number of triangles in this shape
-    n_UINT getTriangleCount() const { return (n_UINT) m_F.cols(); }
-
-    /// Return the total number of vertices in this shape
-    n_UINT getVertexCount() const { return (n_UINT) m_V.cols(); }
-
-    /**
-     * \brief Uniformly sample a position on the mesh with
-     * respect to surface area. Returns both position and normal
-     */
-    void samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, Point2f &uv) const;
-
-	/// Return the surface area of the given triangle
-	float pdf(const Point3f &p) const;
-
-    /// Return the surface area of the given triangle
-    float surfaceArea(n_UINT index) const;
-
-    //// Return an axis-aligned bounding box of the entire mesh
-    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
-
-    //// Return an axis-aligned bounding box containing the given triangle
-    BoundingBox3f getBoundingBox(n_UINT index) const;
-
-    //// Return the centroid of the given triangle
-    Point3f getCentroid(n_UINT index) const;
-
-    /** \brief Ray-triangle intersection test
-     *
-     * Uses the algorithm by Moeller and Trumbore discussed at
-     * <tt>http://www.acm.org/jgt/papers/MollerTrumbore97/code.html</tt>.
-     *
-     * Note that the test only applies to a single triangle in the mesh.
-     * An acceleration data structure like \ref BVH is needed to search
-     * for intersections against many triangles.
-     *
-     * \param index
-     *    Index of the triangle that should be intersected
-     * \param ray
-     *    The ray segment to be used for the intersection query
-     * \param t
-     *    Upon success, \a t contains the distance from the ray origin to the
-     *    intersection point,
-     * \param u
-     *   Upon success, \c u will contain the 'U' component of the intersection
-     *   in barycentric coordinates
-     * \param v
-     *   Upon success, \c v will contain the 'V' component of the intersection
-     *   in barycentric coordinates
-     * \return
-     *   \c true if an intersection has been detected
-     */
-    bool rayIntersect(n_UINT index, const Ray3f &ray, float &u, float &v, float &t) const;
-
-    /// Return a pointer to the vertex positions
-    const MatrixXf &getVertexPositions() const { return m_V; }
-
-    /// Return a pointer to the vertex normals (or \c nullptr if there are none)
-    const MatrixXf &getVertexNormals() const { return m_N; }
-
-    /// Return a pointer to the texture coordinates (or \c nullptr if there are none)
-    const MatrixXf &getVertexTexCoords() const { return m_UV; }
-
-    /// Return a pointer to the triangle vertex index list
-    const MatrixXu &getIndices() const { return m_F; }
-
-    /// Is this mesh an area emitter?
-    bool isEmitter() const { return m_emitter != nullptr; }
-
-    /// Return a pointer to an attached area emitter instance
-    Emitter *getEmitter() { return m_emitter; }
-
-    /// Return a pointer to an attached area emitter instance (const version)
-    const Emitter *getEmitter() const { return m_emitter; }
-
-    /// Return a pointer to the BSDF associated with this mesh
-    const BSDF *getBSDF() const { return m_bsdf; }
-
-    /// Register a child object (e.g. a BSDF) with the mesh
-    virtual void addChild(NoriObject *child, const std::string& name = "none");
-
-    /// Return the name of this mesh
-    const std::string &getName() const { return m_name; }
-
-    /// Return a human-readable summary of this instance
-    std::string toString() const;
-
-    /**
-     * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
-     * provided by this instance
-     * */
-    EClassType getClassType() const { return EMesh; }
-
-protected:
-    /// Create an empty mesh
-    Mesh();
-
-protected:
-    std::string m_name;                  ///< Identifying name
-    MatrixXf      m_V;                   ///< Vertex positions
-    MatrixXf      m_N;                   ///< Vertex normals
-    MatrixXf      m_UV;                  ///< Vertex texture coordinates
-    MatrixXu      m_F;                   ///< Faces
-    BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
-    Emitter      *m_emitter = nullptr;   ///< Associated emitter, if any
-    BoundingBox3f m_bbox;                ///< Bounding box of the mesh
-    DiscretePDF  m_pdf;                  ///< Discrete pdf for sampling triangles uniformly wrt their area. 
-};
-
-NORI_NAMESPACE_END
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/object.h>
+#include <nori/frame.h>
+#include <nori/frame_anisotropic.h>
+#include <nori/bbox.h>
+#include <nori/dpdf.h>
+
+#ifndef n_UINT
+#define n_UINT uint32_t
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Intersection data structure
+ *
+ * This data structure records local information about a ray-triangle intersection.
+ * This includes the position, traveled ray distance, uv coordinates, as well
+ * as well as two local coordinate frames (one that corresponds to the true
+ * geometry, and one that is used for shading computations).
+ *
+ * Ray tracing only fills in a compact hit record (\c t, \c mesh, \c f,
+ * \c bary). The remaining surface data is derived from it on demand by
+ * \ref computeSurfaceData().
+ */
+struct Intersection {
+    /// Position of the surface intersection
+    Point3f p;
+    /// Unoccluded distance along the ray
+    float t;
+    /// UV coordinates, if any
+    Point2f uv;
+    /// Shading frame (based on the shading normal)
+    Frame_Anisotropic shFrame;
+    /// Geometric frame (based on the true geometry)
+    Frame_Anisotropic geoFrame;
+    /// Pointer to the associated mesh
+    const Mesh *mesh;
+    /// Index of the intersected triangle within the mesh
+    n_UINT f;
+    /// Barycentric coordinates of the hit point within the triangle
+    Point2f bary;
+    /// Transformation of the mesh into world space (\c nullptr if not instanced)
+    const Matrix3x4f *instanceToWorld;
+
+    /// Create an uninitialized intersection record
+    Intersection() : mesh(nullptr), instanceToWorld(nullptr) { }
+
+    /**
+     * \brief Compute the position, UV coordinates and both frames
+     * from the hit record
+     */
+    void computeSurfaceData();
+
+    /// Transform a direction vector into the local shading frame
+    Vector3f toLocal(const Vector3f &d) const {
+        return shFrame.toLocal(d);
+    }
+
+    /// Transform a direction vector from local to world coordinates
+    Vector3f toWorld(const Vector3f &d) const {
+        return shFrame.toWorld(d);
+    }
+
+    /// Return a human-readable summary of the intersection record
+    std::string toString() const;
+};
+
+/**
+ * \brief Vertex attributes of one triangle
+ *
+ * This is also the record that \ref Mesh::pageOut() writes to the page
+ * file. Normals and texture coordinates are zero if the mesh has none.
+ */
+struct MeshTriangle {
+    float p[3][3];  ///< Vertex positions (vertex, axis)
+    float n[3][3];  ///< Vertex normals
+    float uv[3][2]; ///< Vertex texture coordinates
+
+    /// Return the position of a vertex
+    Point3f getPosition(int k) const { return Point3f(p[k][0], p[k][1], p[k][2]); }
+
+    /// Return the normal of a vertex
+    Normal3f getNormal(int k) const { return Normal3f(n[k][0], n[k][1], n[k][2]); }
+
+    /// Return the texture coordinates of a vertex
+    Point2f getTexCoords(int k) const { return Point2f(uv[k][0], uv[k][1]); }
+};
+
+/**
+ * \brief Triangle mesh
+ *
+ * This class stores a triangle mesh object and provides numerous functions
+ * for querying the individual triangles. Subclasses of \c Mesh implement
+ * the specifics of how to create its contents (e.g. by loading from an
+ * external file)
+ */
+class Mesh : public NoriObject {
+public:
+    /// Release all memory
+    virtual ~Mesh();
+
+    /// Initialize internal data structures (called once by the XML parser)
+    virtual void activate();
+
+    /// Return the total number of triangles in this shape
+    n_UINT getTriangleCount() const { return m_pager ? m_triangleCount : (n_UINT) m_F.cols(); }
+
+    /// Return the total number of vertices in this shape
+    n_UINT getVertexCount() const { return m_pager ? m_vertexCount : (n_UINT) m_V.cols(); }
+
+    /// Does the mesh have vertex normals?
+    bool hasVertexNormals() const { return m_pager ? m_hasNormals : m_N.size() > 0; }
+
+    /// Does the mesh have texture coordinates?
+    bool hasVertexTexCoords() const { return m_pager ? m_hasTexCoords : m_UV.size() > 0; }
+
+    /// Return the vertex attributes of the given triangle
+    void getTriangle(n_UINT index, MeshTriangle &triangle) const;
+
+    /**
+     * \brief Move the vertex attributes into a page file
+     *
+     * Appends the triangles to \c pager in pages of about \c pageSize
+     * bytes and releases the vertex and index buffers. The per-triangle
+     * queries of the mesh keep working and page the triangles back in as
+     * needed, while the buffer accessors (e.g. \ref getVertexPositions())
+     * return empty matrices. \c pager must outlive the mesh.
+     */
+    void pageOut(PageCache &pager, size_t pageSize);
+
+    /// Has the mesh been moved into a page file?
+    bool isPagedOut() const { return m_pager != nullptr; }
+
+    /**
+     * \brief Uniformly sample a position on the mesh with
+     * respect to surface area. Returns both position and normal
+     */
+    void samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, Point2f &uv) const;
+
+	/// Return the surface area of the given triangle
+	float pdf(const Point3f &p) const;
+
+    /// Return the surface area of the given triangle
+    float surfaceArea(n_UINT index) const;
+
+    //// Return an axis-aligned bounding box of the entire mesh
+    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+
+    //// Return an axis-aligned bounding box containing the given triangle
+    BoundingBox3f getBoundingBox(n_UINT index) const;
+
+    //// Return the centroid of the given triangle
+    Point3f getCentroid(n_UINT index) const;
+
+    /** \brief Ray-triangle intersection test
+     *
+     * Uses the algorithm by Moeller and Trumbore discussed at
+     * <tt>http://www.acm.org/jgt/papers/MollerTrumbore97/code.html</tt>.
+     *
+     * Note that the test only applies to a single triangle in the mesh.
+     * An acceleration data structure like \ref BVH is needed to search
+     * for intersections against many triangles.
+     *
+     * \param index
+     *    Index of the triangle that should be intersected
+     * \param ray
+     *    The ray segment to be used for the intersection query
+     * \param t
+     *    Upon success, \a t contains the distance from the ray origin to the
+     *    intersection point,
+     * \param u
+     *   Upon success, \c u will contain the 'U' component of the intersection
+     *   in barycentric coordinates
+     * \param v
+     *   Upon success, \c v will contain the 'V' component of the intersection
+     *   in barycentric coordinates
+     * \return
+     *   \c true if an intersection has been detected
+     */
+    bool rayIntersect(n_UINT index, const Ray3f &ray, float &u, float &v, float &t) const;
+
+    /// Return a pointer to the vertex positions (empty once paged out)
+    const MatrixXf &getVertexPositions() const { return m_V; }
+
+    /**
+     * \brief Replace the vertex positions (e.g. for the next frame of an
+     * animation)
+     *
+     * The number of vertices must stay the same. Updates the bounding box
+     * and the area distribution used for sampling. Call \ref Accel::refit()
+     * afterwards to update the BVH.
+     */
+    void setVertexPositions(const MatrixXf &V);
+
+    /// Return a pointer to the vertex normals (or \c nullptr if there are none)
+    const MatrixXf &getVertexNormals() const { return m_N; }
+
+    /// Return a pointer to the texture coordinates (or \c nullptr if there are none)
+    const MatrixXf &getVertexTexCoords() const { return m_UV; }
+
+    /// Return a pointer to the triangle vertex index list
+    const MatrixXu &getIndices() const { return m_F; }
+
+    /// Is this mesh an area emitter?
+    bool isEmitter() const { return m_emitter != nullptr; }
+
+    /// Return a pointer to an attached area emitter instance
+    Emitter *getEmitter() { return m_emitter; }
+
+    /// Return a pointer to an attached area emitter instance (const version)
+    const Emitter *getEmitter() const { return m_emitter; }
+
+    /// Return a pointer to the BSDF associated with this mesh
+    const BSDF *getBSDF() const { return m_bsdf; }
+
+    /**
+     * \brief Return the placements of this mesh in the scene
+     *
+     * When this list is empty, the mesh is part of the scene as is.
+     * Otherwise only the instances are.
+     */
+    const std::vector<MeshInstance *> &getInstances() const { return m_instances; }
+
+    /// Register a child object (e.g. a BSDF) with the mesh
+    virtual void addChild(NoriObject *child, const std::string& name = "none");
+
+    /// Return the name of this mesh
+    const std::string &getName() const { return m_name; }
+
+    /// Return a human-readable summary of this instance
+    std::string toString() const;
+
+    /**
+     * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
+     * provided by this instance
+     * */
+    EClassType getClassType() const { return EMesh; }
+
+protected:
+    /// Create an empty mesh
+    Mesh();
+
+    /// Return the vertex positions of the given triangle
+    void getPositions(n_UINT index, Point3f &p0, Point3f &p1, Point3f &p2) const;
+
+protected:
+    std::string m_name;                  ///< Identifying name
+    MatrixXf      m_V;                   ///< Vertex positions
+    MatrixXf      m_N;                   ///< Vertex normals
+    MatrixXf      m_UV;                  ///< Vertex texture coordinates
+    MatrixXu      m_F;                   ///< Faces
+    BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
+    Emitter      *m_emitter = nullptr;   ///< Associated emitter, if any
+    std::vector<MeshInstance *> m_instances; ///< Placements of the mesh, if instanced
+    BoundingBox3f m_bbox;                ///< Bounding box of the mesh
+    DiscretePDF  m_pdf;                  ///< Discrete pdf for sampling triangles uniformly wrt their area. 
+    const PageCache *m_pager = nullptr;  ///< Page file of the triangles, once paged out
+    size_t        m_firstPage = 0;       ///< Page of the first triangle in m_pager
+    size_t        m_pageTriangles = 0;   ///< Number of triangles per page
+    n_UINT        m_vertexCount = 0;     ///< Vertex count of a paged-out mesh
+    n_UINT        m_triangleCount = 0;   ///< Triangle count of a paged-out mesh
+    bool          m_hasNormals = false;  ///< Did the paged-out mesh have normals?
+    bool          m_hasTexCoords = false; ///< Did the paged-out mesh have texture coordinates?
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,67 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Read-only memory mapping of a file
+ *
+ * Used to load cache files and to hash input files without reading
+ * them through a stream first.
+ */
+class MemoryMappedFile {
+public:
+    /// Create an empty mapping
+    MemoryMappedFile() { }
+
+    /// Unmap the file
+    ~MemoryMappedFile();
+
+    /**
+     * \brief Map the given file into memory
+     *
+     * \return \c false if the file does not exist or cannot be mapped
+     */
+    bool map(const std::string &filename);
+
+    /// Unmap the file (if any)
+    void unmap();
+
+    /// Return a pointer to the mapped contents
+    const uint8_t *data() const { return m_data; }
+
+    /// Return the size of the mapped file in bytes
+    size_t size() const { return m_size; }
+
+private:
+    MemoryMappedFile(const MemoryMappedFile &) = delete;
+    MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+#if defined(PLATFORM_WINDOWS)
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#endif
+};
+
+NORI_NAMESPACE_END
@@ -43,6 +43,7 @@ public:
         ESampler,
         ETest,
         EReconstructionFilter,
+        EInstance,
         EClassTypeCount
     };
 
@@ -99,6 +100,7 @@ public:
             case EIntegrator: return "integrator";
             case ESampler:    return "sampler";
             case ETest:       return "test";
+            case EInstance:   return "instance";
             default:          return "<unknown>";
         }
     }
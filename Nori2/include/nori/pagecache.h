@@ -0,0 +1,141 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/// Work done by one or more \ref PageCache instances
+struct PageCacheStats {
+    uint64_t pages = 0;        ///< Number of pages in the file(s)
+    uint64_t fileSize = 0;     ///< Total size of the pages in bytes
+    uint64_t hits = 0;         ///< Requests served from memory
+    uint64_t misses = 0;       ///< Requests that had to read the page from disk
+    uint64_t evictions = 0;    ///< Pages dropped to stay within the budget
+    uint64_t bytesRead = 0;    ///< Bytes read from disk
+    uint64_t peakResident = 0; ///< Largest number of bytes held by the cache
+
+    PageCacheStats &operator+=(const PageCacheStats &other) {
+        pages += other.pages;
+        fileSize += other.fileSize;
+        hits += other.hits;
+        misses += other.misses;
+        evictions += other.evictions;
+        bytesRead += other.bytesRead;
+        peakResident += other.peakResident;
+        return *this;
+    }
+};
+
+/**
+ * \brief Variable-sized pages of data that live in a file on disk and are
+ * paged into memory on demand
+ *
+ * The pages are written once with \ref addPage() and afterwards requested
+ * by index. Whenever the cache holds more than its budget, pages are
+ * dropped in CLOCK order: a hand sweeps over the resident pages and
+ * evicts the first one that has not been requested since the hand last
+ * passed it, an approximation of least recently used order.
+ *
+ * All requests are thread-safe. A hit only loads the page pointer
+ * atomically and sets its reference bit, so it does not take the lock of
+ * the cache. A thread that misses reads the page from disk without
+ * holding the lock either, so that threads working on resident pages
+ * (e.g. other image blocks) keep making progress; only threads that need
+ * the same page wait for it to arrive. A page that is evicted while still
+ * in use stays alive until its last user releases it.
+ */
+class PageCache {
+public:
+    /// Reference that keeps a page in memory while it is being used
+    typedef std::shared_ptr<const std::vector<uint8_t>> Page;
+
+    /**
+     * \brief Create an empty page file
+     *
+     * \param filename
+     *    Scratch file for the pages. It is overwritten and removed
+     *    again when the cache is destroyed.
+     *
+     * \param budget
+     *    Number of bytes that the resident pages may occupy (at least
+     *    one page is always kept)
+     */
+    PageCache(const std::string &filename, size_t budget);
+
+    /// Close and remove the page file
+    ~PageCache();
+
+    /// Append a page to the file and return its index (not concurrently with \ref getPage())
+    size_t addPage(const void *data, size_t size);
+
+    /// Return a page, reading it from disk if it is not resident
+    Page getPage(size_t index) const;
+
+    /// Return the number of pages
+    size_t getPageCount() const { return m_pages.size(); }
+
+    /// Return the work done by the cache so far
+    PageCacheStats getStatistics() const;
+
+    /// Return a human-readable string summary
+    std::string toString() const;
+
+private:
+    PageCache(const PageCache &) = delete;
+    PageCache &operator=(const PageCache &) = delete;
+
+    /// Read a page from the page file
+    Page readPage(size_t index) const;
+
+    struct Entry {
+        uint64_t offset;                 ///< Position of the page in the file
+        size_t size;                     ///< Size of the page in bytes
+        Page data;                       ///< Contents, if resident (only accessed atomically)
+        bool loading = false;            ///< Is a thread reading the page right now?
+        std::atomic<bool> referenced;    ///< Requested since the clock hand last passed?
+
+        Entry() : referenced(false) { }
+        Entry(const Entry &e) : offset(e.offset), size(e.size), data(e.data),
+            loading(e.loading), referenced(e.referenced.load()) { }
+    };
+
+    std::string m_filename;
+    size_t m_budget;
+    mutable std::fstream m_file;
+    mutable std::mutex m_fileMutex;       ///< Serializes file access
+    mutable std::vector<Entry> m_pages;
+    mutable tbb::enumerable_thread_specific<uint64_t> m_hits; ///< Hits of each thread
+    mutable std::mutex m_mutex;           ///< Protects everything below (and the loading of pages)
+    mutable std::condition_variable m_loaded;
+    mutable std::vector<size_t> m_clock;  ///< Resident pages, in the order swept by the clock hand
+    mutable size_t m_hand = 0;            ///< Position of the clock hand in \ref m_clock
+    mutable size_t m_resident = 0;        ///< Bytes held by resident pages
+    mutable PageCacheStats m_stats;
+};
+
+NORI_NAMESPACE_END
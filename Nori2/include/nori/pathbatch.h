@@ -0,0 +1,108 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/integrator.h>
+#include <nori/mesh.h>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/// Work done by the bounce stage of one or more \ref PathBatch instances
+struct PathBatchStats {
+    uint64_t rays = 0;            ///< Number of secondary rays traced
+    double tracingTime = 0;       ///< Seconds spent tracing them in batch order
+    double unsortedTime = 0;      ///< Seconds spent tracing them in path order (if compared)
+
+    PathBatchStats &operator+=(const PathBatchStats &other) {
+        rays += other.rays;
+        tracingTime += other.tracingTime;
+        unsortedTime += other.unsortedTime;
+        return *this;
+    }
+};
+
+/**
+ * \brief Traces a batch of paths in lockstep, one bounce at a time
+ *
+ * Tracing each secondary ray as soon as it has been sampled makes
+ * consecutive queries jump all over the BVH. A batch instead collects the
+ * next ray of every live path, sorts the rays by direction octant and by
+ * the Morton code of their origin within the scene bounds, and traces
+ * them in this order, so that consecutive queries touch similar nodes.
+ * The hits are then shaded by \ref Integrator::shade(), which produces
+ * the rays of the next bounce.
+ */
+class PathBatch {
+public:
+    /**
+     * \param sortRays
+     *    Sort the rays of every bounce (except for the camera rays,
+     *    which are coherent to begin with)
+     *
+     * \param compareUnsorted
+     *    Additionally trace the rays of every bounce in path order and
+     *    record the time taken as a baseline (the results are discarded)
+     */
+    PathBatch(bool sortRays, bool compareUnsorted)
+        : m_sortRays(sortRays), m_compareUnsorted(compareUnsorted) { }
+
+    /// Remove all paths
+    void clear() { m_paths.clear(); }
+
+    /// Start a new path with the given camera ray
+    void add(const Ray3f &ray) { m_paths.push_back(PathState(ray)); }
+
+    /// Return the number of paths in the batch
+    size_t size() const { return m_paths.size(); }
+
+    /**
+     * \brief Trace all paths of the batch until they terminate
+     *
+     * \param aovs
+     *    AOVs to record for each path (see \ref Integrator::sample())
+     */
+    void trace(const Scene *scene, Sampler *sampler, uint32_t aovs = 0);
+
+    /// Return the radiance gathered along a path
+    const Color3f &getRadiance(size_t i) const { return m_paths[i].radiance; }
+
+    /// Return the radiance gathered along a path together with its AOVs
+    const RadianceSample &getSample(size_t i) const { return m_samples[i]; }
+
+    /// Return the work done by \ref trace() since the batch was created
+    const PathBatchStats &getStatistics() const { return m_stats; }
+
+protected:
+    /// Order \ref m_active by direction octant and origin
+    void sortActive(const BoundingBox3f &bbox);
+
+private:
+    bool m_sortRays;
+    bool m_compareUnsorted;
+    std::vector<PathState> m_paths;     ///< State of every path
+    std::vector<RadianceSample> m_samples; ///< Result of every path
+    std::vector<uint32_t> m_active;     ///< Paths that are still alive, in tracing order
+    std::vector<uint64_t> m_keys;       ///< Sort key (upper bits) and path index (lower bits)
+    std::vector<Intersection> m_hits;   ///< Hit record of each active path
+    std::vector<uint8_t> m_found;       ///< Did the ray of each active path hit anything?
+    PathBatchStats m_stats;
+};
+
+NORI_NAMESPACE_END
@@ -74,8 +74,12 @@ public:
      * a new image block. This can be used to deterministically
      * initialize the sampler so that repeated program runs
      * always create the same image.
+     *
+     * A progressive render visits every block once per pass; \c pass
+     * is the index of the current pass, so that the passes do not
+     * repeat each other's samples.
      */
-    virtual void prepare(const ImageBlock &block) = 0;
+    virtual void prepare(const ImageBlock &block, uint32_t pass) = 0;
 
     /**
      * \brief Prepare to generate new samples
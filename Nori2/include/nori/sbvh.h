@@ -0,0 +1,107 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/accel.h>
+#include <atomic>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief SAH BVH builder with spatial splits
+ *
+ * Besides partitioning the triangles of a node by their centroids, this
+ * builder also considers splitting space itself: triangles straddling the
+ * split plane are clipped against it and referenced by both children. This
+ * avoids the large, overlapping children that long or thin triangles
+ * otherwise produce, at the cost of a slower build and more indices.
+ *
+ * The methodology is that described in "Spatial Splits in Bounding Volume
+ * Hierarchies" by Martin Stich, Heiko Friedrich and Andreas Dietrich
+ * (Proc. High Performance Graphics, 2009). The result is written to the
+ * node and index arrays of the \ref Accel in the same compact depth-first
+ * layout that the binned builder produces.
+ */
+class SBVHBuilder {
+public:
+	/**
+	 * \param bvh
+	 *    Reference to the underlying BVH
+	 *
+	 * \param budget
+	 *    Number of additional triangle references that spatial splits
+	 *    may create, relative to the triangle count
+	 */
+	SBVHBuilder(Accel &bvh, float budget);
+
+	/// Build the tree
+	void build();
+
+protected:
+	/// Triangle reference with a (possibly clipped) bounding box
+	struct Reference {
+		n_UINT prim;
+		BoundingBox3f bbox;
+	};
+
+	/// Temporary node of the tree that is flattened at the end
+	struct Node {
+		BoundingBox3f bbox;
+		uint32_t axis = 0;
+		std::unique_ptr<Node> left, right;
+		std::vector<n_UINT> prims;
+	};
+
+	/// Best object or spatial split found for a node
+	struct Split {
+		float cost = std::numeric_limits<float>::infinity();
+		int axis = -1;
+		float pos = 0;
+		n_UINT leftCount = 0, rightCount = 0;
+		BoundingBox3f leftBounds, rightBounds;
+	};
+
+	/// Recursively build the subtree for a list of references
+	std::unique_ptr<Node> buildNode(std::vector<Reference> &refs,
+		const BoundingBox3f &bbox, int depth);
+
+	/// Find the best partitioning by triangle centroids (binned)
+	Split findObjectSplit(const std::vector<Reference> &refs,
+		const BoundingBox3f &bbox) const;
+
+	/// Find the best spatial split plane (binned, with clipped references)
+	Split findSpatialSplit(const std::vector<Reference> &refs,
+		const BoundingBox3f &bbox) const;
+
+	/// Clip a reference against the plane <tt>x[axis] == pos</tt>
+	void splitReference(const Reference &ref, int axis, float pos,
+		Reference &left, Reference &right) const;
+
+	/// Append a subtree to the node and index arrays of the BVH
+	n_UINT flatten(const Node *node);
+
+private:
+	Accel &m_bvh;
+	float m_rootArea;                ///< Surface area of the scene bounding box
+	size_t m_maxRefs;                ///< Upper limit on the number of references
+	std::atomic<size_t> m_refCount;  ///< Current number of references
+};
+
+NORI_NAMESPACE_END
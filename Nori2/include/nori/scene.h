@@ -26,6 +26,33 @@
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Options of the progressive renderer
+ *
+ * A progressive render goes over the whole image in passes of
+ * \c passSampleCount samples per pixel, and stops once the sampler's
+ * sample count is reached or one of the budgets below runs out. With
+ * adaptive sampling, the sampler's sample count is the average over
+ * the image, and each pass takes \c passSampleCount samples per pixel
+ * on average, placed where the error is highest.
+ */
+struct ProgressiveSettings {
+    bool enabled = false;          ///< Render in passes?
+    uint32_t passSampleCount = 1;  ///< Samples per pixel in each pass
+    float timeBudget = 0;          ///< Seconds the render may take (0: unlimited)
+    float noiseThreshold = 0;      ///< Stop once the estimated relative error is below this (0: never)
+    float checkpointInterval = 0;  ///< Seconds between intermediate images (0: none)
+    bool adaptive = false;         ///< Distribute the samples by pixel error (see \ref AdaptiveSampling)?
+    float adaptiveThreshold = 0.02f; ///< Relative error below which a pixel is converged
+    uint32_t adaptiveMinSampleCount = 4; ///< Samples of each pixel before its error is trusted
+};
+
+/// Options of the block scheduler (see \ref BlockGenerator)
+struct SchedulingSettings {
+    bool costOrder = true;    ///< Render the blocks that were most expensive in the previous pass first?
+    bool splitBlocks = true;  ///< Split blocks that would hold up the end of a pass?
+};
+
 /**
  * \brief Main scene data structure
  *
@@ -59,6 +86,15 @@ public:
     /// Return a pointer to the scene's sample generator
     Sampler *getSampler() { return m_sampler; }
 
+    /// Return the bit mask of AOVs to render next to the image (see \ref Film)
+    uint32_t getAOVs() const { return m_aovs; }
+
+    /// Return the options of the progressive renderer
+    const ProgressiveSettings &getProgressiveSettings() const { return m_progressive; }
+
+    /// Return the options of the block scheduler
+    const SchedulingSettings &getSchedulingSettings() const { return m_scheduling; }
+
     /// Return a reference to an array containing all meshes
     const std::vector<Mesh *> &getMeshes() const { return m_meshes; }
 
@@ -91,10 +127,19 @@ public:
      *    A detailed intersection record, which will be filled by the
      *    intersection query
      *
+     * \param surfaceData
+     *    Compute the position, UV coordinates and frames of the
+     *    intersection. Queries that only need the distance, mesh or
+     *    triangle index can skip this work.
+     *
      * \return \c true if an intersection was found
      */
-    bool rayIntersect(const Ray3f &ray, Intersection &its) const {
-        return m_accel->rayIntersect(ray, its, false);
+    bool rayIntersect(const Ray3f &ray, Intersection &its, bool surfaceData = true) const {
+        if (!m_accel->rayIntersect(ray, its, false))
+            return false;
+        if (surfaceData)
+            its.computeSurfaceData();
+        return true;
     }
 
     /**
@@ -113,8 +158,51 @@ public:
      * \return \c true if an intersection was found
      */
     bool rayIntersect(const Ray3f &ray) const {
-        Intersection its; /* Unused */
-        return m_accel->rayIntersect(ray, its, true);
+        return m_accel->rayOccluded(ray);
+    }
+
+    /**
+     * \brief Find the closest intersection of every active ray of a packet
+     *
+     * Fills the compact hit records of the packet; see \ref Accel for
+     * when packet traversal pays off.
+     */
+    template <int Size> void rayIntersect(RayPacket<Size> &packet) const {
+        m_accel->rayIntersect(packet);
+    }
+
+    /**
+     * \brief Check which of the active rays of a packet are blocked
+     *
+     * \return A bit mask of the occluded rays
+     */
+    template <int Size> uint32_t occluded(RayPacket<Size> &packet) const {
+        return m_accel->rayOccluded(packet);
+    }
+
+    /**
+     * \brief Check whether the segment between two points is blocked
+     *
+     * This is an any-hit query for shadow rays: it stops at the first
+     * triangle found strictly between \c p and \c q (up to the ray
+     * epsilon at both ends) and never builds an \ref Intersection.
+     *
+     * \return \c true if something lies between the two points
+     */
+    bool occluded(const Point3f &p, const Point3f &q) const {
+        Vector3f d = q - p;
+        float dist = d.norm();
+        return occluded(p, d / dist, dist);
+    }
+
+    /**
+     * \brief Check whether anything blocks the segment that starts at
+     * \c p and extends a distance \c dist along the unit direction \c d
+     *
+     * \c dist may be infinite, e.g. for environment emitters.
+     */
+    bool occluded(const Point3f &p, const Vector3f &d, float dist) const {
+        return m_accel->rayOccluded(Ray3f(p, d, Epsilon, dist - Epsilon));
     }
 
     /// \brief Return an axis-aligned box that bounds the scene
@@ -146,6 +234,9 @@ private:
     Sampler *m_sampler = nullptr;
     Camera *m_camera = nullptr;
     Accel *m_accel = nullptr;
+    uint32_t m_aovs = 0;
+    ProgressiveSettings m_progressive;
+    SchedulingSettings m_scheduling;
 
     DiscretePDF m_emitterPDF;
 };
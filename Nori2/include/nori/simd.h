@@ -0,0 +1,179 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <cstring>
+
+/* =======================================================================
+     Detection of the vector instruction sets used by the acceleration
+     data structure. SSE2 is part of every x86-64 target, so it is the
+     baseline there; AVX is only used when the compiler was explicitly
+     asked to target it (e.g. -mavx or /arch:AVX).
+ * ======================================================================= */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NORI_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define NORI_AVX 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* Number of lanes of the \ref SimdFloat type */
+#if defined(NORI_AVX)
+#define NORI_SIMD_WIDTH 8
+#else
+#define NORI_SIMD_WIDTH 4
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/// Return the number of set bits in a (lane) mask
+inline int popcount(uint32_t mask) {
+#if defined(_MSC_VER)
+    return (int) __popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+/// Return the index of the lowest set bit of a nonzero (lane) mask
+inline int lowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int) index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/**
+ * \brief Thin wrapper around a native SIMD register of NORI_SIMD_WIDTH floats
+ *
+ * Comparisons return a SimdFloat whose lanes are all-ones or all-zeros bit
+ * patterns, which can be combined with \c & and \c | and turned into
+ * an integer bit mask with \ref movemask(). On targets without SSE the
+ * operations are emulated lane by lane.
+ */
+struct SimdFloat {
+#if defined(NORI_AVX)
+    __m256 v;
+    SimdFloat() { }
+    SimdFloat(__m256 v) : v(v) { }
+    SimdFloat(float f) : v(_mm256_set1_ps(f)) { }
+    static SimdFloat load(const float *p) { return _mm256_loadu_ps(p); }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+#elif defined(NORI_SSE)
+    __m128 v;
+    SimdFloat() { }
+    SimdFloat(__m128 v) : v(v) { }
+    SimdFloat(float f) : v(_mm_set1_ps(f)) { }
+    static SimdFloat load(const float *p) { return _mm_loadu_ps(p); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+#else
+    float v[NORI_SIMD_WIDTH];
+    SimdFloat() { }
+    SimdFloat(float f) { for (int i = 0; i < NORI_SIMD_WIDTH; ++i) v[i] = f; }
+    static SimdFloat load(const float *p) { SimdFloat r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    void store(float *p) const { memcpy(p, v, sizeof(v)); }
+#endif
+};
+
+#if defined(NORI_AVX)
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a.v, b.v); }
+inline SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a.v, b.v); }
+inline SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a.v, b.v); }
+inline SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline SimdFloat operator<=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline SimdFloat operator==(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+inline SimdFloat operator!=(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ); }
+/// Lane-wise minimum; returns \c b in lanes where either operand is NaN
+inline SimdFloat min(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a.v, b.v); }
+/// Lane-wise maximum; returns \c b in lanes where either operand is NaN
+inline SimdFloat max(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a.v, b.v); }
+/// Select \c a where \c mask is set and \c b elsewhere
+inline SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline uint32_t movemask(SimdFloat mask) { return (uint32_t) _mm256_movemask_ps(mask.v); }
+#elif defined(NORI_SSE)
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.v, b.v); }
+inline SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm_and_ps(a.v, b.v); }
+inline SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm_or_ps(a.v, b.v); }
+inline SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a.v, b.v); }
+inline SimdFloat operator<=(SimdFloat a, SimdFloat b) { return _mm_cmple_ps(a.v, b.v); }
+inline SimdFloat operator>=(SimdFloat a, SimdFloat b) { return _mm_cmpge_ps(a.v, b.v); }
+inline SimdFloat operator==(SimdFloat a, SimdFloat b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline SimdFloat operator!=(SimdFloat a, SimdFloat b) { return _mm_cmpneq_ps(a.v, b.v); }
+/// Lane-wise minimum; returns \c b in lanes where either operand is NaN
+inline SimdFloat min(SimdFloat a, SimdFloat b) { return _mm_min_ps(a.v, b.v); }
+/// Lane-wise maximum; returns \c b in lanes where either operand is NaN
+inline SimdFloat max(SimdFloat a, SimdFloat b) { return _mm_max_ps(a.v, b.v); }
+/// Select \c a where \c mask is set and \c b elsewhere
+inline SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) {
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline uint32_t movemask(SimdFloat mask) { return (uint32_t) _mm_movemask_ps(mask.v); }
+#else
+namespace detail {
+    inline float maskFloat(bool b) { uint32_t i = b ? 0xFFFFFFFFu : 0u; float f; memcpy(&f, &i, 4); return f; }
+    inline uint32_t floatBits(float f) { uint32_t i; memcpy(&i, &f, 4); return i; }
+    inline float bitsFloat(uint32_t i) { float f; memcpy(&f, &i, 4); return f; }
+}
+#define NORI_SIMD_LANEWISE(expr) SimdFloat r; for (int i = 0; i < NORI_SIMD_WIDTH; ++i) r.v[i] = (expr); return r;
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(a.v[i] + b.v[i]) }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(a.v[i] - b.v[i]) }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(a.v[i] * b.v[i]) }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(a.v[i] / b.v[i]) }
+inline SimdFloat operator&(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::bitsFloat(detail::floatBits(a.v[i]) & detail::floatBits(b.v[i]))) }
+inline SimdFloat operator|(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::bitsFloat(detail::floatBits(a.v[i]) | detail::floatBits(b.v[i]))) }
+inline SimdFloat operator<(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::maskFloat(a.v[i] < b.v[i])) }
+inline SimdFloat operator<=(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::maskFloat(a.v[i] <= b.v[i])) }
+inline SimdFloat operator>=(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::maskFloat(a.v[i] >= b.v[i])) }
+inline SimdFloat operator==(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::maskFloat(a.v[i] == b.v[i])) }
+inline SimdFloat operator!=(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::maskFloat(!(a.v[i] == b.v[i]))) }
+/// Lane-wise minimum; returns \c b in lanes where either operand is NaN
+inline SimdFloat min(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+/// Lane-wise maximum; returns \c b in lanes where either operand is NaN
+inline SimdFloat max(SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+/// Select \c a where \c mask is set and \c b elsewhere
+inline SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) { NORI_SIMD_LANEWISE(detail::floatBits(mask.v[i]) ? a.v[i] : b.v[i]) }
+#undef NORI_SIMD_LANEWISE
+inline uint32_t movemask(SimdFloat mask) {
+    uint32_t result = 0;
+    for (int i = 0; i < NORI_SIMD_WIDTH; ++i)
+        result |= (detail::floatBits(mask.v[i]) >> 31) << i;
+    return result;
+}
+#endif
+
+NORI_NAMESPACE_END
@@ -1,510 +1,1929 @@
-/*
-    This file is part of Nori, a simple educational ray tracer
-
-    Copyright (c) 2015 by Wenzel Jakob
-
-    Nori is free software; you can redistribute it and/or modify
-    it under the terms of the GNU General Public License Version 3
-    as published by the Free Software Foundation.
-
-    Nori is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
-    GNU General Public License for more details.
-
-    You should have received a copy of the GNU General Public License
-    along with this program. If not, see <http://www.gnu.org/licenses/>.
-*/
-
-#include <nori/accel.h>
-#include <nori/timer.h>
-#include <tbb/tbb.h>
-#include <Eigen/Geometry>
-#include <atomic>
-
-NORI_NAMESPACE_BEGIN
-
-/* Bin data structure for counting triangles and computing their bounding box */
-struct Bins {
-	static const int BIN_COUNT = 16;
-	Bins() { memset(counts, 0, sizeof(n_UINT) * BIN_COUNT); }
-	n_UINT counts[BIN_COUNT];
-	BoundingBox3f bbox[BIN_COUNT];
-};
-
-/**
- * \brief Build task for parallel BVH construction
- *
- * This class uses the task scheduling system of Intel' Thread Building Blocks
- * to parallelize the divide and conquer BVH build at all levels.
- *
- * The used methodology is roughly that described in
- * "Fast and Parallel Construction of SAH-based Bounding Volume Hierarchies"
- * by Ingo Wald (Proc. IEEE/EG Symposium on Interactive Ray Tracing, 2007)
- */
-class BVHBuildTask : public tbb::task {
-private:
-	Accel &bvh;
-	n_UINT node_idx;
-	n_UINT *start, *end, *temp;
-
-public:
-	/// Build-related parameters
-	enum {
-		/// Switch to a serial build when less than 32 triangles are left
-		SERIAL_THRESHOLD = 32,
-
-		/// Process triangles in batches of 1K for the purpose of parallelization
-		GRAIN_SIZE = 1000,
-
-		/// Heuristic cost value for traversal operations
-		TRAVERSAL_COST = 1,
-
-		/// Heuristic cost value for intersection operations
-		INTERSECTION_COST = 1
-	};
-
-public:
-	/**
-	 * Create a new build task
-	 *
-	 * \param bvh
-	 *    Reference to the underlying BVH
-	 *
-	 * \param node_idx
-	 *    Index of the BVH node that should be built
-	 *
-	 * \param start
-	 *    Start pointer into a list of triangle indices to be processed
-	 *
-	 * \param end
-	 *    End pointer into a list of triangle indices to be processed
-	 *
-	 *  \param temp
-	 *    Pointer into a temporary memory region that can be used for
-	 *    construction purposes. The usable length is <tt>end-start</tt>
-	 *    unsigned integers.
-	 */
-	BVHBuildTask(Accel &bvh, n_UINT node_idx, n_UINT *start, n_UINT *end, n_UINT *temp)
-		: bvh(bvh), node_idx(node_idx), start(start), end(end), temp(temp) { }
-
-	task *execute() {
-		n_UINT size = (n_UINT)(end - start);
-		Accel::BVHNode &node = bvh.m_nodes[node_idx];
-
-		/* Switch to a serial build when less than SERIAL_THRESHOLD triangles are left */
-		if (size < SERIAL_THRESHOLD) {
-			execute_serially(bvh, node_idx, start, end, temp);
-			return nullptr;
-		}
-
-		/* Always split along the largest axis */
-		int axis = node.bbox.getLargestAxis();
-		float min = node.bbox.min[axis], max = node.bbox.max[axis],
-			inv_bin_size = Bins::BIN_COUNT / (max - min);
-
-		/* Accumulate all triangles into bins */
-		Bins bins = tbb::parallel_reduce(
-			tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
-			Bins(),
-			/* MAP: Bin a number of triangles and return the resulting 'Bins' data structure */
-			[&](const tbb::blocked_range<n_UINT> &range, Bins result) {
-			for (n_UINT i = range.begin(); i != range.end(); ++i) {
-				n_UINT f = start[i];
-				float centroid = bvh.getCentroid(f)[axis];
-
-				int index = std::min(std::max(
-					(int)((centroid - min) * inv_bin_size), 0),
-					(Bins::BIN_COUNT - 1));
-
-				result.counts[index]++;
-				result.bbox[index].expandBy(bvh.getBoundingBox(f));
-			}
-			return result;
-		},
-			/* REDUCE: Combine two 'Bins' data structures */
-			[](const Bins &b1, const Bins &b2) {
-			Bins result;
-			for (int i = 0; i < Bins::BIN_COUNT; ++i) {
-				result.counts[i] = b1.counts[i] + b2.counts[i];
-				result.bbox[i] = BoundingBox3f::merge(b1.bbox[i], b2.bbox[i]);
-			}
-			return result;
-		}
-		);
-
-		/* Choose the best split plane based on the binned data */
-		BoundingBox3f bbox_left[Bins::BIN_COUNT];
-		bbox_left[0] = bins.bbox[0];
-		for (int i = 1; i < Bins::BIN_COUNT; ++i) {
-			bins.counts[i] += bins.counts[i - 1];
-			bbox_left[i] = BoundingBox3f::merge(bbox_left[i - 1], bins.bbox[i]);
-		}
-
-		BoundingBox3f bbox_right = bins.bbox[Bins::BIN_COUNT - 1], best_bbox_right;
-		int64_t best_index = -1;
-		float best_cost = (float)INTERSECTION_COST * size;
-		float tri_factor = (float)INTERSECTION_COST / node.bbox.getSurfaceArea();
-
-		for (int i = Bins::BIN_COUNT - 2; i >= 0; --i) {
-			n_UINT prims_left = bins.counts[i], prims_right = (n_UINT)(end - start) - bins.counts[i];
-			float sah_cost = 2.0f * TRAVERSAL_COST +
-				tri_factor * (prims_left * bbox_left[i].getSurfaceArea() +
-					prims_right * bbox_right.getSurfaceArea());
-			if (sah_cost < best_cost) {
-				best_cost = sah_cost;
-				best_index = i;
-				best_bbox_right = bbox_right;
-			}
-			bbox_right = BoundingBox3f::merge(bbox_right, bins.bbox[i]);
-		}
-
-		if (best_index == -1) {
-			/* Could not find a good split plane -- retry with
-			   more careful serial code just to be sure.. */
-			execute_serially(bvh, node_idx, start, end, temp);
-			return nullptr;
-		}
-
-		n_UINT left_count = bins.counts[best_index];
-		int node_idx_left = node_idx + 1;
-		int node_idx_right = node_idx + 2 * left_count;
-
-		bvh.m_nodes[node_idx_left].bbox = bbox_left[best_index];
-		bvh.m_nodes[node_idx_right].bbox = best_bbox_right;
-		node.inner.rightChild = node_idx_right;
-		node.inner.axis = axis;
-		node.inner.flag = 0;
-
-		std::atomic<n_UINT> offset_left(0),
-			offset_right(bins.counts[best_index]);
-
-		tbb::parallel_for(
-			tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
-			[&](const tbb::blocked_range<n_UINT> &range) {
-			n_UINT count_left = 0, count_right = 0;
-			for (n_UINT i = range.begin(); i != range.end(); ++i) {
-				n_UINT f = start[i];
-				float centroid = bvh.getCentroid(f)[axis];
-				int index = (int)((centroid - min) * inv_bin_size);
-				(index <= best_index ? count_left : count_right)++;
-			}
-			n_UINT idx_l = offset_left.fetch_add(count_left);
-			n_UINT idx_r = offset_right.fetch_add(count_right);
-			for (n_UINT i = range.begin(); i != range.end(); ++i) {
-				n_UINT f = start[i];
-				float centroid = bvh.getCentroid(f)[axis];
-				int index = (int)((centroid - min) * inv_bin_size);
-				if (index <= best_index)
-					temp[idx_l++] = f;
-				else
-					temp[idx_r++] = f;
-			}
-		}
-		);
-		memcpy(start, temp, size * sizeof(n_UINT));
-		assert(offset_left == left_count && offset_right == size);
-
-		/* Create an empty parent task */
-		tbb::task& c = *new (allocate_continuation()) tbb::empty_task;
-		c.set_ref_count(2);
-
-		/* Post right subtree to scheduler */
-		BVHBuildTask &b = *new (c.allocate_child())
-			BVHBuildTask(bvh, node_idx_right, start + left_count,
-				end, temp + left_count);
-		spawn(b);
-
-		/* Directly start working on left subtree */
-		recycle_as_child_of(c);
-		node_idx = node_idx_left;
-		end = start + left_count;
-
-		return this;
-	}
-
-	/// Single-threaded build function
-	static void execute_serially(Accel &bvh, n_UINT node_idx, n_UINT *start, n_UINT *end, n_UINT *temp) {
-		Accel::BVHNode &node = bvh.m_nodes[node_idx];
-		n_UINT size = (n_UINT)(end - start);
-		float best_cost = (float)INTERSECTION_COST * size;
-		int64_t best_index = -1, best_axis = -1;
-		float *left_areas = (float *)temp;
-
-		/* Try splitting along every axis */
-		for (int axis = 0; axis < 3; ++axis) {
-			/* Sort all triangles based on their centroid positions projected on the axis */
-			std::sort(start, end, [&](n_UINT f1, n_UINT f2) {
-				return bvh.getCentroid(f1)[axis] < bvh.getCentroid(f2)[axis];
-			});
-
-			BoundingBox3f bbox;
-			for (n_UINT i = 0; i < size; ++i) {
-				n_UINT f = *(start + i);
-				bbox.expandBy(bvh.getBoundingBox(f));
-				left_areas[i] = (float)bbox.getSurfaceArea();
-			}
-			if (axis == 0)
-				node.bbox = bbox;
-
-			bbox.reset();
-
-			/* Choose the best split plane */
-			float tri_factor = INTERSECTION_COST / node.bbox.getSurfaceArea();
-			for (n_UINT i = size - 1; i >= 1; --i) {
-				n_UINT f = *(start + i);
-				bbox.expandBy(bvh.getBoundingBox(f));
-
-				float left_area = left_areas[i - 1];
-				float right_area = bbox.getSurfaceArea();
-				n_UINT prims_left = i;
-				n_UINT prims_right = size - i;
-
-				float sah_cost = 2.0f * TRAVERSAL_COST +
-					tri_factor * (prims_left * left_area +
-						prims_right * right_area);
-
-				if (sah_cost < best_cost) {
-					best_cost = sah_cost;
-					best_index = i;
-					best_axis = axis;
-				}
-			}
-		}
-
-		if (best_index == -1) {
-			/* Splitting does not reduce the cost, make a leaf */
-			node.leaf.flag = 1;
-			node.leaf.start = (n_UINT)(start - bvh.m_indices.data());
-			node.leaf.size = size;
-			return;
-		}
-
-		std::sort(start, end, [&](n_UINT f1, n_UINT f2) {
-			return bvh.getCentroid(f1)[best_axis] < bvh.getCentroid(f2)[best_axis];
-		});
-
-		n_UINT left_count = (n_UINT)best_index;
-		n_UINT node_idx_left = node_idx + 1;
-		n_UINT node_idx_right = node_idx + 2 * left_count;
-		node.inner.rightChild = node_idx_right;
-		node.inner.axis = best_axis;
-		node.inner.flag = 0;
-
-		execute_serially(bvh, node_idx_left, start, start + left_count, temp);
-		execute_serially(bvh, node_idx_right, start + left_count, end, temp + left_count);
-	}
-};
-
-void Accel::addMesh(Mesh *mesh) {
-	m_meshes.push_back(mesh);
-	m_meshOffset.push_back(m_meshOffset.back() + mesh->getTriangleCount());
-	m_bbox.expandBy(mesh->getBoundingBox());
-}
-
-void Accel::clear() {
-	for (auto mesh : m_meshes)
-		delete mesh;
-	m_meshes.clear();
-	m_meshOffset.clear();
-	m_meshOffset.push_back(0u);
-	m_nodes.clear();
-	m_indices.clear();
-	m_bbox.reset();
-	m_nodes.shrink_to_fit();
-	m_meshes.shrink_to_fit();
-	m_meshOffset.shrink_to_fit();
-	m_indices.shrink_to_fit();
-}
-
-void Accel::build() {
-	n_UINT size = getTriangleCount();
-	if (size == 0)
-		return;
-	cout << "Constructing a SAH BVH (" << m_meshes.size()
-		<< (m_meshes.size() == 1 ? " mesh, " : " meshes, ")
-		<< size << " triangles) .. ";
-	cout.flush();
-	Timer timer;
-
-	/* Conservative estimate for the total number of nodes */
-	m_nodes.resize(2 * size);
-	memset(m_nodes.data(), 0, sizeof(BVHNode) * m_nodes.size());
-	m_nodes[0].bbox = m_bbox;
-	m_indices.resize(size);
-
-	cout << "Size of each node is " << sizeof(BVHNode);
-
-	if ((sizeof(n_UINT) == 4) && (sizeof(BVHNode) != 32))
-		throw NoriException("BVH Node is not packed! Investigate compiler settings.");
-
-	for (n_UINT i = 0; i < size; ++i)
-		m_indices[i] = i;
-
-	n_UINT *indices = m_indices.data(), *temp = new n_UINT[size];
-	BVHBuildTask& task = *new(tbb::task::allocate_root())
-		BVHBuildTask(*this, 0u, indices, indices + size, temp);
-	tbb::task::spawn_root_and_wait(task);
-	delete[] temp;
-	std::pair<float, n_UINT> stats = statistics();
-
-	/* The node array was allocated conservatively and now contains
-	   many unused entries -- do a compactification pass. */
-	std::vector<BVHNode> compactified(stats.second);
-	std::vector<n_UINT> skipped_accum(m_nodes.size());
-
-	for (int64_t i = stats.second - 1, j = m_nodes.size(), skipped = 0; i >= 0; --i) {
-		while (m_nodes[--j].isUnused())
-			skipped++;
-		BVHNode &new_node = compactified[i];
-		new_node = m_nodes[j];
-		skipped_accum[j] = (n_UINT)skipped;
-
-		if (new_node.isInner()) {
-			new_node.inner.rightChild = (n_UINT)
-				(i + new_node.inner.rightChild - j -
-				(skipped - skipped_accum[new_node.inner.rightChild]));
-		}
-	}
-	cout << "done (took " << timer.elapsedString() << " and "
-		<< memString(sizeof(BVHNode) * m_nodes.size() + sizeof(n_UINT)*m_indices.size())
-		<< ", SAH cost = " << stats.first
-		<< ")." << endl;
-
-	m_nodes = std::move(compactified);
-}
-
-std::pair<float, n_UINT> Accel::statistics(n_UINT node_idx) const {
-	const BVHNode &node = m_nodes[node_idx];
-	if (node.isLeaf()) {
-		return std::make_pair((float)BVHBuildTask::INTERSECTION_COST * node.leaf.size, 1u);
-	}
-	else {
-		std::pair<float, n_UINT> stats_left = statistics(node_idx + 1u);
-		std::pair<float, n_UINT> stats_right = statistics(node.inner.rightChild);
-		float saLeft = m_nodes[node_idx + 1u].bbox.getSurfaceArea();
-		float saRight = m_nodes[node.inner.rightChild].bbox.getSurfaceArea();
-		float saCur = node.bbox.getSurfaceArea();
-		float sahCost =
-			2 * BVHBuildTask::TRAVERSAL_COST +
-			(saLeft * stats_left.first + saRight * stats_right.first) / saCur;
-		return std::make_pair(
-			sahCost,
-			stats_left.second + stats_right.second + 1u
-		);
-	}
-}
-
-bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) const {
-	n_UINT node_idx = 0, stack_idx = 0, stack[64];
-
-	its.t = std::numeric_limits<float>::infinity();
-
-	/* Use an adaptive ray epsilon */
-	Ray3f ray(_ray);
-	if (ray.mint == Epsilon)
-		ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
-
-	if (m_nodes.empty() || ray.maxt < ray.mint)
-		return false;
-
-	bool foundIntersection = false;
-	n_UINT f = 0;
-
-	while (true) {
-		const BVHNode &node = m_nodes[node_idx];
-
-		if (!node.bbox.rayIntersect(ray)) {
-			if (stack_idx == 0)
-				break;
-			node_idx = stack[--stack_idx];
-			continue;
-		}
-
-		if (node.isInner()) {
-			stack[stack_idx++] = node.inner.rightChild;
-			node_idx++;
-			assert(stack_idx < 64);
-		}
-		else {
-			for (n_UINT i = node.start(), end = node.end(); i < end; ++i) {
-				n_UINT idx = m_indices[i];
-				const Mesh *mesh = m_meshes[findMesh(idx)];
-
-				float u, v, t;
-				if (mesh->rayIntersect(idx, ray, u, v, t)) {
-					if (shadowRay)
-						return true;
-					foundIntersection = true;
-					ray.maxt = its.t = t;
-					its.uv = Point2f(u, v);
-					its.mesh = mesh;
-					f = idx;
-				}
-			}
-			if (stack_idx == 0)
-				break;
-			node_idx = stack[--stack_idx];
-			continue;
-		}
-	}
-
-	if (foundIntersection) {
-		/* Find the barycentric coordinates */
-		Vector3f bary;
-		bary << 1 - its.uv.sum(), its.uv;
-
-		/* References to all relevant mesh buffers */
-		const Mesh *mesh = its.mesh;
-		const MatrixXf &V = mesh->getVertexPositions();
-		const MatrixXf &N = mesh->getVertexNormals();
-		const MatrixXf &UV = mesh->getVertexTexCoords();
-		const MatrixXu &F = mesh->getIndices();
-
-		/* Vertex indices of the triangle */
-		n_UINT idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
-
-		Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
-
-		/* Compute the intersection positon accurately
-		   using barycentric coordinates */
-		its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
-
-		/* Compute proper texture coordinates if provided by the mesh */
-		if (UV.size() > 0)
-			its.uv = bary.x() * UV.col(idx0) +
-			bary.y() * UV.col(idx1) +
-			bary.z() * UV.col(idx2);
-
-		/* Compute the geometry frame */
-		its.geoFrame = Frame_Anisotropic((p1 - p0).cross(p2 - p0).normalized());
-
-		if (N.size() > 0) {
-			/* Compute the shading frame. Note that for simplicity,
-			   the current implementation doesn't attempt to provide
-			   tangents that are continuous across the surface. That
-			   means that this code will need to be modified to be able
-			   use anisotropic BRDFs, which need tangent continuity */
-			
-			Vector3f normal = (p1 - p0).cross(p2 - p0).normalized();
-
-			Vector3f ref = Vector3f(1, 0, 0);
-			Vector3f s = normal.cross(ref).normalized();
-			Vector3f t = normal.cross(s);
-
-			/*its.shFrame = Frame_Anisotropic(
-				(bary.x() * N.col(idx0) +
-					bary.y() * N.col(idx1) +
-					bary.z() * N.col(idx2)).normalized());*/
-			its.shFrame = Frame_Anisotropic(s, t, normal);
-		}
-		else {
-			its.shFrame = its.geoFrame;
-		}
-	}
-
-	return foundIntersection;
-}
-
-NORI_NAMESPACE_END
-
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <nori/sbvh.h>
+#include <nori/lbvh.h>
+#include <nori/timer.h>
+#include <nori/simd.h>
+#include <tbb/tbb.h>
+#include <Eigen/Geometry>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/* Bin data structure for counting triangles and computing their bounding box */
+struct Bins {
+	static const int BIN_COUNT = 16;
+	Bins() { memset(counts, 0, sizeof(n_UINT) * BIN_COUNT); }
+	n_UINT counts[BIN_COUNT];
+	BoundingBox3f bbox[BIN_COUNT];
+};
+
+/* Bins of all three axes, filled in a single pass over the triangles */
+struct AxisBins {
+	Bins axis[3];
+};
+
+/**
+ * \brief Build task for parallel BVH construction
+ *
+ * This class uses Intel's Thread Building Blocks to parallelize the divide
+ * and conquer BVH build at all levels: the binning and partitioning of large
+ * nodes run as parallel loops over the triangles, and the two subtrees of
+ * every node are built concurrently with \c tbb::parallel_invoke.
+ *
+ * The used methodology is roughly that described in
+ * "Fast and Parallel Construction of SAH-based Bounding Volume Hierarchies"
+ * by Ingo Wald (Proc. IEEE/EG Symposium on Interactive Ray Tracing, 2007)
+ */
+class BVHBuildTask {
+private:
+	Accel &bvh;
+	n_UINT node_idx;
+	n_UINT *start, *end, *temp;
+
+public:
+	/// Build-related parameters
+	enum {
+		/// Switch to a serial build when less than 32 triangles are left
+		SERIAL_THRESHOLD = 32,
+
+		/// Process triangles in batches of 1K for the purpose of parallelization
+		GRAIN_SIZE = 1000
+	};
+
+public:
+	/**
+	 * Create a new build task
+	 *
+	 * \param bvh
+	 *    Reference to the underlying BVH
+	 *
+	 * \param node_idx
+	 *    Index of the BVH node that should be built
+	 *
+	 * \param start
+	 *    Start pointer into a list of triangle indices to be processed
+	 *
+	 * \param end
+	 *    End pointer into a list of triangle indices to be processed
+	 *
+	 *  \param temp
+	 *    Pointer into a temporary memory region that can be used for
+	 *    construction purposes. The usable length is <tt>end-start</tt>
+	 *    unsigned integers.
+	 */
+	BVHBuildTask(Accel &bvh, n_UINT node_idx, n_UINT *start, n_UINT *end, n_UINT *temp)
+		: bvh(bvh), node_idx(node_idx), start(start), end(end), temp(temp) { }
+
+	void execute() {
+		n_UINT size = (n_UINT)(end - start);
+		Accel::BVHNode &node = bvh.m_nodes[node_idx];
+
+		/* Switch to a serial build when less than SERIAL_THRESHOLD triangles are left */
+		if (size < SERIAL_THRESHOLD) {
+			execute_serially(bvh, node_idx, start, end, temp);
+			return;
+		}
+
+		/* Bin the triangles along all axes with a nonzero extent */
+		Vector3f extents = node.bbox.getExtents();
+		Vector3f inv_bin_size = Vector3f::Zero();
+		for (int axis = 0; axis < 3; ++axis)
+			if (extents[axis] > 0)
+				inv_bin_size[axis] = Bins::BIN_COUNT / extents[axis];
+
+		/* Accumulate all triangles into bins */
+		AxisBins bins = tbb::parallel_reduce(
+			tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
+			AxisBins(),
+			/* MAP: Bin a number of triangles and return the resulting 'AxisBins' data structure */
+			[&](const tbb::blocked_range<n_UINT> &range, AxisBins result) {
+			for (n_UINT i = range.begin(); i != range.end(); ++i) {
+				n_UINT f = start[i];
+				Point3f centroid = bvh.getCentroid(f);
+				BoundingBox3f bbox = bvh.getBoundingBox(f);
+
+				for (int axis = 0; axis < 3; ++axis) {
+					if (inv_bin_size[axis] == 0)
+						continue;
+					int index = std::min(std::max(
+						(int)((centroid[axis] - node.bbox.min[axis]) * inv_bin_size[axis]), 0),
+						(Bins::BIN_COUNT - 1));
+
+					result.axis[axis].counts[index]++;
+					result.axis[axis].bbox[index].expandBy(bbox);
+				}
+			}
+			return result;
+		},
+			/* REDUCE: Combine two 'AxisBins' data structures */
+			[](const AxisBins &b1, const AxisBins &b2) {
+			AxisBins result;
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int i = 0; i < Bins::BIN_COUNT; ++i) {
+					result.axis[axis].counts[i] = b1.axis[axis].counts[i] + b2.axis[axis].counts[i];
+					result.axis[axis].bbox[i] = BoundingBox3f::merge(
+						b1.axis[axis].bbox[i], b2.axis[axis].bbox[i]);
+				}
+			}
+			return result;
+		}
+		);
+
+		/* Choose the best split plane based on the binned data */
+		int64_t best_index = -1;
+		int best_axis = -1;
+		float best_cost = (float)Accel::INTERSECTION_COST * Accel::packetCount(size);
+		float tri_factor = (float)Accel::INTERSECTION_COST / node.bbox.getSurfaceArea();
+		BoundingBox3f best_bbox_left, best_bbox_right;
+		n_UINT left_count = 0;
+
+		for (int axis = 0; axis < 3; ++axis) {
+			if (inv_bin_size[axis] == 0)
+				continue;
+
+			Bins &axisBins = bins.axis[axis];
+			BoundingBox3f bbox_left[Bins::BIN_COUNT];
+			bbox_left[0] = axisBins.bbox[0];
+			for (int i = 1; i < Bins::BIN_COUNT; ++i) {
+				axisBins.counts[i] += axisBins.counts[i - 1];
+				bbox_left[i] = BoundingBox3f::merge(bbox_left[i - 1], axisBins.bbox[i]);
+			}
+
+			BoundingBox3f bbox_right = axisBins.bbox[Bins::BIN_COUNT - 1];
+			for (int i = Bins::BIN_COUNT - 2; i >= 0; --i) {
+				n_UINT prims_left = axisBins.counts[i], prims_right = size - axisBins.counts[i];
+				float sah_cost = 2.0f * Accel::TRAVERSAL_COST +
+					tri_factor * (Accel::packetCount(prims_left) * bbox_left[i].getSurfaceArea() +
+						Accel::packetCount(prims_right) * bbox_right.getSurfaceArea());
+				if (sah_cost < best_cost) {
+					best_cost = sah_cost;
+					best_index = i;
+					best_axis = axis;
+					best_bbox_left = bbox_left[i];
+					best_bbox_right = bbox_right;
+					left_count = prims_left;
+				}
+				bbox_right = BoundingBox3f::merge(bbox_right, axisBins.bbox[i]);
+			}
+		}
+
+		if (best_index == -1) {
+			/* Could not find a good split plane -- retry with
+			   more careful serial code just to be sure.. */
+			execute_serially(bvh, node_idx, start, end, temp);
+			return;
+		}
+
+		n_UINT node_idx_left = node_idx + 1;
+		n_UINT node_idx_right = node_idx + 2 * left_count;
+
+		bvh.m_nodes[node_idx_left].bbox = best_bbox_left;
+		bvh.m_nodes[node_idx_right].bbox = best_bbox_right;
+		node.inner.rightChild = node_idx_right;
+		node.inner.axis = best_axis;
+		node.inner.flag = 0;
+
+		float min = node.bbox.min[best_axis], inv = inv_bin_size[best_axis];
+		std::atomic<n_UINT> offset_left(0),
+			offset_right(left_count);
+
+		tbb::parallel_for(
+			tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
+			[&](const tbb::blocked_range<n_UINT> &range) {
+			n_UINT count_left = 0, count_right = 0;
+			for (n_UINT i = range.begin(); i != range.end(); ++i) {
+				n_UINT f = start[i];
+				float centroid = bvh.getCentroid(f)[best_axis];
+				int index = (int)((centroid - min) * inv);
+				(index <= best_index ? count_left : count_right)++;
+			}
+			n_UINT idx_l = offset_left.fetch_add(count_left);
+			n_UINT idx_r = offset_right.fetch_add(count_right);
+			for (n_UINT i = range.begin(); i != range.end(); ++i) {
+				n_UINT f = start[i];
+				float centroid = bvh.getCentroid(f)[best_axis];
+				int index = (int)((centroid - min) * inv);
+				if (index <= best_index)
+					temp[idx_l++] = f;
+				else
+					temp[idx_r++] = f;
+			}
+		}
+		);
+		memcpy(start, temp, size * sizeof(n_UINT));
+		assert(offset_left == left_count && offset_right == size);
+
+		/* Build the two subtrees in parallel */
+		tbb::parallel_invoke(
+			[&] { BVHBuildTask(bvh, node_idx_left, start, start + left_count, temp).execute(); },
+			[&] { BVHBuildTask(bvh, node_idx_right, start + left_count, end, temp + left_count).execute(); }
+		);
+	}
+
+	/// Single-threaded build function
+	static void execute_serially(Accel &bvh, n_UINT node_idx, n_UINT *start, n_UINT *end, n_UINT *temp) {
+		Accel::BVHNode &node = bvh.m_nodes[node_idx];
+		n_UINT size = (n_UINT)(end - start);
+		float best_cost = (float)Accel::INTERSECTION_COST * Accel::packetCount(size);
+		int64_t best_index = -1, best_axis = -1;
+		float *left_areas = (float *)temp;
+
+		/* Try splitting along every axis */
+		for (int axis = 0; axis < 3; ++axis) {
+			/* Sort all triangles based on their centroid positions projected on the axis */
+			std::sort(start, end, [&](n_UINT f1, n_UINT f2) {
+				return bvh.getCentroid(f1)[axis] < bvh.getCentroid(f2)[axis];
+			});
+
+			BoundingBox3f bbox;
+			for (n_UINT i = 0; i < size; ++i) {
+				n_UINT f = *(start + i);
+				bbox.expandBy(bvh.getBoundingBox(f));
+				left_areas[i] = (float)bbox.getSurfaceArea();
+			}
+			if (axis == 0)
+				node.bbox = bbox;
+
+			bbox.reset();
+
+			/* Choose the best split plane */
+			float tri_factor = (float)Accel::INTERSECTION_COST / node.bbox.getSurfaceArea();
+			for (n_UINT i = size - 1; i >= 1; --i) {
+				n_UINT f = *(start + i);
+				bbox.expandBy(bvh.getBoundingBox(f));
+
+				float left_area = left_areas[i - 1];
+				float right_area = bbox.getSurfaceArea();
+				n_UINT prims_left = i;
+				n_UINT prims_right = size - i;
+
+				/* Leaves are intersected one packet at a time, so partially
+				   filled packets cost as much as full ones */
+				float sah_cost = 2.0f * Accel::TRAVERSAL_COST +
+					tri_factor * (Accel::packetCount(prims_left) * left_area +
+						Accel::packetCount(prims_right) * right_area);
+
+				if (sah_cost < best_cost) {
+					best_cost = sah_cost;
+					best_index = i;
+					best_axis = axis;
+				}
+			}
+		}
+
+		if (best_index == -1) {
+			/* Splitting does not reduce the cost, make a leaf */
+			node.leaf.flag = 1;
+			node.leaf.start = (n_UINT)(start - bvh.m_indices.data());
+			node.leaf.size = size;
+			return;
+		}
+
+		std::sort(start, end, [&](n_UINT f1, n_UINT f2) {
+			return bvh.getCentroid(f1)[best_axis] < bvh.getCentroid(f2)[best_axis];
+		});
+
+		n_UINT left_count = (n_UINT)best_index;
+		n_UINT node_idx_left = node_idx + 1;
+		n_UINT node_idx_right = node_idx + 2 * left_count;
+		node.inner.rightChild = node_idx_right;
+		node.inner.axis = best_axis;
+		node.inner.flag = 0;
+
+		execute_serially(bvh, node_idx_left, start, start + left_count, temp);
+		execute_serially(bvh, node_idx_right, start + left_count, end, temp + left_count);
+	}
+};
+
+void Accel::addMesh(Mesh *mesh) {
+	m_meshes.push_back(mesh);
+	m_meshOffset.push_back(m_meshOffset.back() + mesh->getTriangleCount());
+	m_bbox.expandBy(mesh->getBoundingBox());
+}
+
+void Accel::addInstance(Mesh *mesh, const Transform &toWorld) {
+	auto it = m_blasIndex.find(mesh);
+	if (it == m_blasIndex.end()) {
+		Accel *accel = new Accel();
+		accel->addMesh(mesh);
+		m_blas.emplace_back(accel);
+		it = m_blasIndex.insert(std::make_pair(mesh, accel)).first;
+	}
+
+	Instance instance;
+	instance.accel = it->second;
+	instance.toWorld = toWorld.getMatrix().topRows<3>();
+	instance.toLocal = toWorld.getInverseMatrix().topRows<3>();
+	m_instances.push_back(instance);
+}
+
+void Accel::clear() {
+	for (auto mesh : m_meshes)
+		delete mesh;
+	m_meshes.clear();
+	m_meshOffset.clear();
+	m_meshOffset.push_back(0u);
+	m_nodes.clear();
+	m_indices.clear();
+	m_packets.clear();
+	m_pager.reset();
+	m_pageStart.clear();
+	m_nodes4.clear();
+	m_nodes8.clear();
+	m_qnodes4.clear();
+	m_qnodes8.clear();
+	m_compressionSavings = 0;
+	m_buildCosts.clear();
+	m_treeStats = BVHStatistics();
+	m_instances.clear();
+	m_topNodes.clear();
+	m_blasIndex.clear();
+	m_blas.clear();
+	m_bbox.reset();
+	m_nodes.shrink_to_fit();
+	m_packets.shrink_to_fit();
+	m_nodes4.shrink_to_fit();
+	m_nodes8.shrink_to_fit();
+	m_qnodes4.shrink_to_fit();
+	m_qnodes8.shrink_to_fit();
+	m_meshes.shrink_to_fit();
+	m_meshOffset.shrink_to_fit();
+	m_indices.shrink_to_fit();
+}
+
+void Accel::setWidth(int width) {
+	if (width != 2 && width != 4 && width != 8)
+		throw NoriException("Accel: unsupported BVH width %i (must be 2, 4 or 8)", width);
+	m_width = width;
+}
+
+void Accel::setBuilder(EBuilder builder, float budget) {
+	if (budget < 0)
+		throw NoriException("Accel: the spatial split budget must be nonnegative");
+	m_builder = builder;
+	m_splitBudget = budget;
+}
+
+void Accel::setRebuildThreshold(float threshold) {
+	if (threshold < 0)
+		throw NoriException("Accel: the rebuild threshold must be nonnegative");
+	m_rebuildThreshold = threshold;
+}
+
+void Accel::buildBinned() {
+	n_UINT size = getTriangleCount();
+	m_indices.resize(size);
+
+	cout << "Size of each node is " << sizeof(BVHNode);
+
+	if ((sizeof(n_UINT) == 4) && (sizeof(BVHNode) != 32))
+		throw NoriException("BVH Node is not packed! Investigate compiler settings.");
+
+	for (n_UINT i = 0; i < size; ++i)
+		m_indices[i] = i;
+
+	buildBinned(m_bbox);
+}
+
+void Accel::buildBinned(const BoundingBox3f &bbox) {
+	n_UINT size = (n_UINT) m_indices.size();
+
+	/* Conservative estimate for the total number of nodes */
+	m_nodes.resize(2 * size);
+	memset(m_nodes.data(), 0, sizeof(BVHNode) * m_nodes.size());
+	m_nodes[0].bbox = bbox;
+
+	n_UINT *indices = m_indices.data(), *temp = new n_UINT[size];
+	BVHBuildTask(*this, 0u, indices, indices + size, temp).execute();
+	delete[] temp;
+	std::pair<float, n_UINT> stats = statistics();
+
+	/* The node array was allocated conservatively and now contains
+	   many unused entries -- do a compactification pass. */
+	std::vector<BVHNode> compactified(stats.second);
+	std::vector<n_UINT> skipped_accum(m_nodes.size());
+
+	for (int64_t i = stats.second - 1, j = m_nodes.size(), skipped = 0; i >= 0; --i) {
+		while (m_nodes[--j].isUnused())
+			skipped++;
+		BVHNode &new_node = compactified[i];
+		new_node = m_nodes[j];
+		skipped_accum[j] = (n_UINT)skipped;
+
+		if (new_node.isInner()) {
+			new_node.inner.rightChild = (n_UINT)
+				(i + new_node.inner.rightChild - j -
+				(skipped - skipped_accum[new_node.inner.rightChild]));
+		}
+	}
+
+	m_nodes = std::move(compactified);
+}
+
+void Accel::build() {
+	if (m_compression && m_width == 2)
+		throw NoriException("Accel: node compression requires a BVH width of 4 or 8");
+	if (m_layout != EDepthFirst && m_width == 2)
+		throw NoriException("Accel: node layouts other than depth-first require a BVH width of 4 or 8");
+	buildTree();
+	if (!m_nodes.empty()) {
+		if (keepsBinaryNodes()) {
+			computeCosts(m_buildCosts);
+			if (m_builder == ESpatialSplits) {
+				/* Refitting grows the clipped boxes of split references to
+				   full triangle bounds, so the quality monitor of refit()
+				   compares against the cost of the refitted tree */
+				std::vector<BVHNode> nodes(m_nodes);
+				refitNodes();
+				computeCosts(m_buildCosts);
+				m_nodes.swap(nodes);
+			}
+		}
+		size_t before = nodeMemory();
+		if (m_compression) {
+			cout << "Quantizing the " << m_width << "-wide BVH nodes .. ";
+			cout.flush();
+			Timer timer;
+			compressNodes();
+			cout << "done (took " << timer.elapsedString() << ", " << memString(m_width == 4
+				? m_qnodes4.size() * sizeof(QuantizedBVHNode<4>)
+				: m_qnodes8.size() * sizeof(QuantizedBVHNode<8>)) << ")." << endl;
+		}
+		if (!keepsBinaryNodes())
+			releaseBinaryNodes();
+		m_compressionSavings = before - nodeMemory();
+		if (m_compressionSavings > 0)
+			cout << "The BVH nodes take up " << memString(nodeMemory()) << " (saved "
+				<< memString(m_compressionSavings) << ")." << endl;
+		if (!m_pageFile.empty() && !m_refitSupport)
+			pageOutMeshes();
+	}
+	if (!m_instances.empty())
+		buildInstances();
+}
+
+void Accel::buildTree(bool useCache) {
+	n_UINT size = getTriangleCount();
+	if (size == 0)
+		return;
+
+	uint64_t key = 0;
+	if (useCache && !m_cacheFile.empty()) {
+		Timer timer;
+		key = cacheKey();
+		if (loadCache(key)) {
+			cout << "Loaded the BVH from \"" << m_cacheFile << "\" (took "
+				<< timer.elapsedString() << ", " << m_nodes.size() << " nodes, "
+				<< m_packets.size() << " packets)." << endl;
+			if (!m_pageFile.empty())
+				pageOutPackets();
+			return;
+		}
+	}
+
+	cout << "Constructing a " << (m_builder == ESpatialSplits ? "spatial split SAH BVH (" :
+		(m_builder == ELinear ? "linear BVH (" : "SAH BVH (")) << m_meshes.size()
+		<< (m_meshes.size() == 1 ? " mesh, " : " meshes, ")
+		<< size << " triangles) .. ";
+	cout.flush();
+	Timer timer;
+
+	if (m_builder == ESpatialSplits)
+		SBVHBuilder(*this, m_splitBudget).build();
+	else if (m_builder == ELinear)
+		LBVHBuilder(*this, m_treeletOptimization).build();
+	else
+		buildBinned();
+
+	std::pair<float, n_UINT> stats = statistics();
+	cout << "done (took " << timer.elapsedString() << " and "
+		<< memString(sizeof(BVHNode) * m_nodes.size() + sizeof(n_UINT)*m_indices.size())
+		<< ", SAH cost = " << stats.first;
+	if (m_indices.size() != size)
+		cout << ", " << m_indices.size() << " references";
+	cout << ")." << endl;
+
+	n_UINT refs = (n_UINT) m_indices.size();
+	packLeaves();
+	if (m_pageFile.empty()) {
+		buildTrianglePackets();
+		cout << "Packed " << refs << " triangles into " << m_packets.size()
+			<< " packets of " << PACKET_SIZE << " ("
+			<< memString(sizeof(TrianglePacket) * m_packets.size()) << ")." << endl;
+	} else {
+		pageOutPackets();
+	}
+
+	if (m_width > 2) {
+		cout << "Collapsing into a " << m_width << "-wide BVH .. ";
+		cout.flush();
+		timer.reset();
+		collapseNodes();
+		size_t wideSize = m_width == 4 ? m_nodes4.size() * sizeof(WideBVHNode<4>)
+			: m_nodes8.size() * sizeof(WideBVHNode<8>);
+		cout << "done (took " << timer.elapsedString() << ", "
+			<< (m_width == 4 ? m_nodes4.size() : m_nodes8.size()) << " nodes, "
+			<< memString(wideSize) << ")." << endl;
+	}
+
+	if (useCache && !m_cacheFile.empty())
+		saveCache(key);
+}
+
+void Accel::collapseNodes() {
+	m_nodes4.clear();
+	m_nodes8.clear();
+	if (m_width == 4)
+		collapse(m_nodes4, 0u);
+	else if (m_width == 8)
+		collapse(m_nodes8, 0u);
+	reorderNodes();
+}
+
+void Accel::buildInstances() {
+	/* The bottom-level BVHs use the same settings as this one */
+	for (size_t i = 0; i < m_blas.size(); ++i) {
+		auto &blas = m_blas[i];
+		blas->m_width = m_width;
+		blas->m_builder = m_builder;
+		blas->m_splitBudget = m_splitBudget;
+		blas->m_treeletOptimization = m_treeletOptimization;
+		blas->m_compression = m_compression;
+		blas->m_layout = m_layout;
+		blas->m_rebuildThreshold = m_rebuildThreshold;
+		blas->m_refitSupport = m_refitSupport;
+		if (!m_pageFile.empty())
+			blas->setPaging(m_pageFile + "." + std::to_string(i), m_pageBudget);
+		blas->build();
+		m_compressionSavings += blas->m_compressionSavings;
+	}
+
+	cout << "Constructing a top-level BVH (" << m_instances.size()
+		<< (m_instances.size() == 1 ? " instance of " : " instances of ")
+		<< m_blas.size() << (m_blas.size() == 1 ? " mesh) .. " : " meshes) .. ");
+	cout.flush();
+	Timer timer;
+
+	size_t placed = 0, stored = 0;
+	for (const Instance &instance : m_instances)
+		placed += instance.accel->getTriangleCount();
+	for (auto &blas : m_blas)
+		stored += blas->getTriangleCount();
+
+	/* The meshes registered with addMesh() become an untransformed instance */
+	if (hasNodes()) {
+		Instance instance;
+		instance.accel = this;
+		instance.toWorld.setIdentity();
+		instance.toLocal.setIdentity();
+		m_instances.push_back(instance);
+	}
+
+	updateInstances();
+
+	cout << "done (took " << timer.elapsedString() << ", " << placed
+		<< " placed triangles stored as " << stored << ")." << endl;
+}
+
+void Accel::updateInstances() {
+	m_bbox.reset();
+	for (Instance &instance : m_instances) {
+		if (instance.accel == this) {
+			instance.bbox = getRootBounds();
+		} else {
+			const BoundingBox3f &bbox = instance.accel->getBoundingBox();
+			instance.bbox.reset();
+			for (int i = 0; i < 8; ++i)
+				instance.bbox.expandBy(instance.pointToWorld(bbox.getCorner(i)));
+		}
+		m_bbox.expandBy(instance.bbox);
+	}
+
+	m_topNodes.clear();
+	m_topNodes.reserve(2 * m_instances.size());
+	buildTopLevel(0, (n_UINT) m_instances.size(), 0);
+}
+
+n_UINT Accel::buildTopLevel(n_UINT start, n_UINT end, int depth) {
+	n_UINT node_idx = (n_UINT) m_topNodes.size();
+	m_topNodes.emplace_back();
+
+	BVHNode node;
+	memset(&node, 0, sizeof(BVHNode));
+	node.bbox.reset();
+	for (n_UINT i = start; i < end; ++i)
+		node.bbox.expandBy(m_instances[i].bbox);
+
+	n_UINT size = end - start;
+	if (size == 1) {
+		node.leaf.flag = 1;
+		node.leaf.size = 1;
+		node.leaf.start = start;
+		m_topNodes[node_idx] = node;
+		return node_idx;
+	}
+
+	auto begin = m_instances.begin() + start;
+	auto sortAxis = [&](int axis) {
+		std::sort(begin, begin + size, [axis](const Instance &i1, const Instance &i2) {
+			return i1.bbox.getCenter()[axis] < i2.bbox.getCenter()[axis];
+		});
+	};
+
+	/* Instance counts are small, so a full SAH sweep along all axes is
+	   affordable. Deep trees fall back to median splits to bound the
+	   traversal stack. */
+	int best_axis = node.bbox.getLargestAxis();
+	n_UINT best_split = size / 2;
+	if (depth < 32) {
+		float best_cost = std::numeric_limits<float>::infinity();
+		std::vector<float> right_areas(size);
+		for (int axis = 0; axis < 3; ++axis) {
+			sortAxis(axis);
+			BoundingBox3f bbox;
+			for (n_UINT i = size - 1; i > 0; --i) {
+				bbox.expandBy(begin[i].bbox);
+				right_areas[i] = bbox.getSurfaceArea();
+			}
+			bbox.reset();
+			for (n_UINT i = 0; i < size - 1; ++i) {
+				bbox.expandBy(begin[i].bbox);
+				float cost = (i + 1) * bbox.getSurfaceArea() + (size - i - 1) * right_areas[i + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = i + 1;
+				}
+			}
+		}
+	}
+	sortAxis(best_axis);
+
+	node.inner.flag = 0;
+	node.inner.axis = (uint32_t) best_axis;
+	m_topNodes[node_idx] = node;
+	buildTopLevel(start, start + best_split, depth + 1);
+	n_UINT right_idx = buildTopLevel(start + best_split, end, depth + 1);
+	m_topNodes[node_idx].inner.rightChild = right_idx;
+	return node_idx;
+}
+
+const n_UINT Accel::INVALID_INDEX;
+
+void Accel::packLeaves() {
+	std::vector<n_UINT> packed;
+	packed.reserve(m_indices.size() + m_indices.size() / 2);
+
+	for (BVHNode &node : m_nodes) {
+		if (!node.isLeaf())
+			continue;
+		n_UINT start = (n_UINT) packed.size();
+		packed.insert(packed.end(), m_indices.begin() + node.start(),
+			m_indices.begin() + node.end());
+		packed.resize(packetCount((n_UINT) packed.size()) * PACKET_SIZE,
+			INVALID_INDEX);
+		node.leaf.start = start;
+	}
+
+	m_indices = std::move(packed);
+}
+
+void Accel::buildTrianglePackets() {
+	n_UINT count = (n_UINT) (m_indices.size() / PACKET_SIZE);
+	m_packets.resize(count);
+	buildTrianglePackets(0u, count, m_packets.data());
+}
+
+void Accel::buildTrianglePackets(n_UINT first, n_UINT last, TrianglePacket *packets) const {
+	tbb::parallel_for(
+		tbb::blocked_range<n_UINT>(first, last, BVHBuildTask::GRAIN_SIZE / PACKET_SIZE),
+		[&](const tbb::blocked_range<n_UINT> &range) {
+		for (n_UINT i = range.begin(); i != range.end(); ++i) {
+			TrianglePacket &packet = packets[i - first];
+			for (int lane = 0; lane < PACKET_SIZE; ++lane) {
+				n_UINT idx = m_indices[i * PACKET_SIZE + lane];
+				if (idx == INVALID_INDEX) {
+					for (int k = 0; k < 3; ++k)
+						for (int j = 0; j < 3; ++j)
+							packet.v[k][j][lane] = std::numeric_limits<float>::quiet_NaN();
+					packet.meshId[lane] = 0;
+					packet.primId[lane] = INVALID_INDEX;
+					continue;
+				}
+
+				n_UINT meshIdx = findMesh(idx);
+				const MatrixXf &V = m_meshes[meshIdx]->getVertexPositions();
+				const MatrixXu &F = m_meshes[meshIdx]->getIndices();
+				for (int k = 0; k < 3; ++k)
+					for (int j = 0; j < 3; ++j)
+						packet.v[k][j][lane] = V(j, F(k, idx));
+				packet.meshId[lane] = meshIdx;
+				packet.primId[lane] = idx;
+			}
+		}
+	}
+	);
+}
+
+void Accel::pageOutPackets() {
+	n_UINT count = (n_UINT) (m_indices.size() / PACKET_SIZE);
+	cout << "Writing " << count << " triangle packets to \"" << m_pageFile << "\" .. ";
+	cout.flush();
+	Timer timer;
+
+	/* Close (and remove) the previous page file before it is recreated */
+	m_pager.reset();
+	m_pager.reset(new PageCache(m_pageFile, m_pageBudget));
+	m_pageStart.clear();
+
+	/* Each page holds the packets of a run of consecutive leaves */
+	std::vector<std::pair<n_UINT, n_UINT>> leaves;
+	for (const BVHNode &node : m_nodes)
+		if (node.isLeaf())
+			leaves.push_back(std::make_pair(node.start() / PACKET_SIZE,
+				node.start() / PACKET_SIZE + packetCount(node.leaf.size)));
+	std::sort(leaves.begin(), leaves.end());
+
+	const size_t maxPackets = std::max(PAGE_SIZE / sizeof(TrianglePacket), (size_t) 1);
+	n_UINT pageStart = 0;
+	for (const auto &leaf : leaves) {
+		n_UINT first = leaf.first, last = leaf.second;
+		if (last - pageStart > maxPackets && first > pageStart) {
+			m_pageStart.push_back(pageStart);
+			pageStart = first;
+		}
+	}
+	if (count > pageStart)
+		m_pageStart.push_back(pageStart);
+
+	/* Packets loaded from the BVH cache are written as they are. Otherwise
+	   each page is built right before it is written, so that only one
+	   page of packets is ever held in memory. */
+	std::vector<TrianglePacket> buffer;
+	for (size_t i = 0; i < m_pageStart.size(); ++i) {
+		n_UINT first = m_pageStart[i],
+			last = i + 1 < m_pageStart.size() ? m_pageStart[i + 1] : count;
+		if (!m_packets.empty()) {
+			m_pager->addPage(&m_packets[first], sizeof(TrianglePacket) * (last - first));
+			continue;
+		}
+		buffer.resize(last - first);
+		buildTrianglePackets(first, last, buffer.data());
+		m_pager->addPage(buffer.data(), sizeof(TrianglePacket) * buffer.size());
+	}
+
+	size_t bytes = sizeof(TrianglePacket) * count;
+	m_packets.clear();
+	m_packets.shrink_to_fit();
+	cout << "done (took " << timer.elapsedString() << ", " << m_pageStart.size()
+		<< " pages, " << memString(bytes) << ", budget " << memString(m_pageBudget)
+		<< ")." << endl;
+}
+
+void Accel::pageOutMeshes() {
+	cout << "Writing the geometry of " << m_meshes.size()
+		<< (m_meshes.size() == 1 ? " mesh" : " meshes") << " to \"" << m_pageFile << "\" .. ";
+	cout.flush();
+	Timer timer;
+
+	size_t bytes = 0, pages = m_pager->getPageCount();
+	for (Mesh *mesh : m_meshes) {
+		bytes += sizeof(float) * (mesh->getVertexPositions().size() +
+			mesh->getVertexNormals().size() + mesh->getVertexTexCoords().size()) +
+			sizeof(uint32_t) * mesh->getIndices().size();
+		mesh->pageOut(*m_pager, PAGE_SIZE);
+	}
+
+	cout << "done (took " << timer.elapsedString() << ", "
+		<< m_pager->getPageCount() - pages << " pages, released "
+		<< memString(bytes) << ")." << endl;
+}
+
+PageCacheStats Accel::getPagingStatistics() const {
+	PageCacheStats stats;
+	if (m_pager)
+		stats = m_pager->getStatistics();
+	for (const auto &blas : m_blas)
+		stats += blas->getPagingStatistics();
+	return stats;
+}
+
+template <int Width> n_UINT Accel::collapse(
+		std::vector<WideBVHNode<Width>> &nodes, n_UINT node_idx) const {
+	/* Gather up to 'Width' children by repeatedly opening
+	   the inner child with the largest surface area */
+	n_UINT children[Width];
+	int childCount = 0;
+
+	if (m_nodes[node_idx].isLeaf()) {
+		/* Only happens when the root itself is a leaf */
+		children[childCount++] = node_idx;
+	} else {
+		children[childCount++] = node_idx + 1;
+		children[childCount++] = m_nodes[node_idx].inner.rightChild;
+	}
+
+	while (childCount < Width) {
+		int best = -1;
+		float bestArea = -1.f;
+		for (int i = 0; i < childCount; ++i) {
+			const BVHNode &child = m_nodes[children[i]];
+			if (child.isInner() && child.bbox.getSurfaceArea() > bestArea) {
+				bestArea = child.bbox.getSurfaceArea();
+				best = i;
+			}
+		}
+		if (best == -1)
+			break;
+		n_UINT opened = children[best];
+		children[best] = opened + 1;
+		children[childCount++] = m_nodes[opened].inner.rightChild;
+	}
+
+	n_UINT wide_idx = (n_UINT) nodes.size();
+	nodes.emplace_back();
+	for (int i = 0; i < Width; ++i) {
+		WideBVHNode<Width> &wide = nodes[wide_idx];
+		for (int j = 0; j < 3; ++j) {
+			wide.bounds[j][i] = std::numeric_limits<float>::infinity();
+			wide.bounds[j + 3][i] = -std::numeric_limits<float>::infinity();
+		}
+		wide.child[i] = 0;
+		wide.count[i] = 0;
+	}
+
+	for (int i = 0; i < childCount; ++i) {
+		const BVHNode &child = m_nodes[children[i]];
+		if (child.isLeaf() && child.leaf.size == 0)
+			continue;
+
+		n_UINT index = child.isLeaf() ? child.start()
+			: collapse(nodes, children[i]);
+
+		/* 'nodes' may have been reallocated by the recursion */
+		WideBVHNode<Width> &wide = nodes[wide_idx];
+		for (int j = 0; j < 3; ++j) {
+			wide.bounds[j][i] = child.bbox.min[j];
+			wide.bounds[j + 3][i] = child.bbox.max[j];
+		}
+		wide.child[i] = index;
+		wide.count[i] = child.isLeaf() ? (uint32_t) child.leaf.size : 0u;
+	}
+
+	return wide_idx;
+}
+
+/// Decode a quantized plane (exact product, then a single rounding)
+static inline float dequantize(float origin, float scale, int q) {
+	return origin + (float) q * scale;
+}
+
+template <int Width> BoundingBox3f Accel::QuantizedBVHNode<Width>::getChildBounds(int i) const {
+	BoundingBox3f bbox;
+	for (int j = 0; j < 3; ++j) {
+		bbox.min[j] = dequantize(origin[j], scale[j], bounds[j][i]);
+		bbox.max[j] = dequantize(origin[j], scale[j], bounds[j + 3][i]);
+	}
+	return bbox;
+}
+
+template <int Width> void Accel::quantize(
+		const std::vector<WideBVHNode<Width>> &nodes,
+		std::vector<QuantizedBVHNode<Width>> &result) {
+	result.resize(nodes.size());
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0u, nodes.size()),
+		[&](const tbb::blocked_range<size_t> &range) {
+		for (size_t idx = range.begin(); idx != range.end(); ++idx) {
+			const WideBVHNode<Width> &node = nodes[idx];
+			QuantizedBVHNode<Width> &qnode = result[idx];
+			memset(&qnode, 0, sizeof(QuantizedBVHNode<Width>));
+
+			/* Unused slots hold an inverted box */
+			BoundingBox3f bbox;
+			for (int i = 0; i < Width; ++i) {
+				if (node.bounds[0][i] > node.bounds[3][i])
+					continue;
+				qnode.valid |= 1u << i;
+				bbox.expandBy(Point3f(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]));
+				bbox.expandBy(Point3f(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]));
+			}
+			if (qnode.valid == 0)
+				continue;
+
+			for (int j = 0; j < 3; ++j) {
+				/* Smallest power of two that spans the box in 255 steps. The
+				   lower bound keeps the products clear of denormals. */
+				float origin = bbox.min[j], extent = bbox.max[j] - bbox.min[j];
+				int exponent;
+				std::frexp(extent / 255.f, &exponent);
+				float scale = std::ldexp(1.f, std::max(exponent, -100));
+				while (dequantize(origin, scale, 255) < bbox.max[j])
+					scale *= 2;
+				qnode.origin[j] = origin;
+				qnode.scale[j] = scale;
+
+				for (int i = 0; i < Width; ++i) {
+					if (!(qnode.valid & (1u << i)))
+						continue;
+
+					/* Round the planes outwards, correcting for the
+					   rounding of the decoded values */
+					float lo = node.bounds[j][i], hi = node.bounds[j + 3][i];
+					int qlo = clamp((int) std::floor((lo - origin) / scale), 0, 255);
+					int qhi = clamp((int) std::ceil((hi - origin) / scale), 0, 255);
+					while (qlo > 0 && dequantize(origin, scale, qlo) > lo)
+						--qlo;
+					while (qhi < 255 && dequantize(origin, scale, qhi) < hi)
+						++qhi;
+					qnode.bounds[j][i] = (uint8_t) qlo;
+					qnode.bounds[j + 3][i] = (uint8_t) qhi;
+				}
+			}
+
+			for (int i = 0; i < Width; ++i) {
+				qnode.child[i] = node.child[i];
+				qnode.count[i] = node.count[i];
+			}
+		}
+	}
+	);
+}
+
+void Accel::compressNodes() {
+	if (m_width == 4) {
+		quantize(m_nodes4, m_qnodes4);
+		m_nodes4.clear();
+		m_nodes4.shrink_to_fit();
+	} else {
+		quantize(m_nodes8, m_qnodes8);
+		m_nodes8.clear();
+		m_nodes8.shrink_to_fit();
+	}
+}
+
+void Accel::releaseBinaryNodes() {
+	m_treeStats = BVHStatistics();
+	m_treeStats.sahCost = statistics().first;
+	collectTreeStatistics(m_treeStats);
+
+	m_nodes.clear();
+	m_nodes.shrink_to_fit();
+	m_buildCosts.clear();
+	m_buildCosts.shrink_to_fit();
+
+	/* The leaf references are only needed to rebuild the triangle packets */
+	m_indices.clear();
+	m_indices.shrink_to_fit();
+}
+
+size_t Accel::nodeMemory() const {
+	return sizeof(BVHNode) * m_nodes.size() + sizeof(float) * m_buildCosts.size() +
+		sizeof(WideBVHNode<4>) * m_nodes4.size() + sizeof(WideBVHNode<8>) * m_nodes8.size() +
+		sizeof(QuantizedBVHNode<4>) * m_qnodes4.size() +
+		sizeof(QuantizedBVHNode<8>) * m_qnodes8.size();
+}
+
+/// Union of the child bounds of the root of a wide BVH
+template <typename Node> static BoundingBox3f rootBounds(const std::vector<Node> &nodes) {
+	BoundingBox3f bbox;
+	uint32_t mask = nodes[0].getChildMask();
+	for (int i = 0; mask != 0; ++i, mask >>= 1)
+		if (mask & 1)
+			bbox.expandBy(nodes[0].getChildBounds(i));
+	return bbox;
+}
+
+BoundingBox3f Accel::getRootBounds() const {
+	if (!m_nodes.empty())
+		return m_nodes[0].bbox;
+	else if (!m_qnodes4.empty())
+		return rootBounds(m_qnodes4);
+	else if (!m_qnodes8.empty())
+		return rootBounds(m_qnodes8);
+	else if (!m_nodes4.empty())
+		return rootBounds(m_nodes4);
+	else if (!m_nodes8.empty())
+		return rootBounds(m_nodes8);
+	return BoundingBox3f();
+}
+
+std::pair<float, n_UINT> Accel::statistics(n_UINT node_idx) const {
+	const BVHNode &node = m_nodes[node_idx];
+	if (node.isLeaf()) {
+		return std::make_pair((float)INTERSECTION_COST *
+			packetCount(node.leaf.size), 1u);
+	}
+	else {
+		std::pair<float, n_UINT> stats_left = statistics(node_idx + 1u);
+		std::pair<float, n_UINT> stats_right = statistics(node.inner.rightChild);
+		float saLeft = m_nodes[node_idx + 1u].bbox.getSurfaceArea();
+		float saRight = m_nodes[node.inner.rightChild].bbox.getSurfaceArea();
+		float saCur = node.bbox.getSurfaceArea();
+		float sahCost =
+			2 * TRAVERSAL_COST +
+			(saLeft * stats_left.first + saRight * stats_right.first) / saCur;
+		return std::make_pair(
+			sahCost,
+			stats_left.second + stats_right.second + 1u
+		);
+	}
+}
+
+void Accel::computeCosts(std::vector<float> &costs) const {
+	costs.resize(m_nodes.size());
+
+	/* Children follow their parent in the node array,
+	   so a reverse sweep computes the costs bottom-up */
+	for (size_t i = m_nodes.size(); i-- > 0; ) {
+		const BVHNode &node = m_nodes[i];
+		if (node.isLeaf()) {
+			costs[i] = (float) INTERSECTION_COST * packetCount(node.leaf.size);
+			continue;
+		}
+		const BVHNode &left = m_nodes[i + 1], &right = m_nodes[node.inner.rightChild];
+		costs[i] = 2 * TRAVERSAL_COST +
+			(left.bbox.getSurfaceArea() * costs[i + 1] +
+			 right.bbox.getSurfaceArea() * costs[node.inner.rightChild]) /
+			node.bbox.getSurfaceArea();
+	}
+}
+
+struct Accel::RayData : public RaySlabData {
+	/* Rows of the near and far planes in the bounds of wide nodes */
+	int nearRow[3], farRow[3];
+
+	/* Shear constants of the watertight triangle test ("Watertight
+	   Ray/Triangle Intersection" by Woop et al., JCGT 2013) */
+	int kx, ky, kz;
+	float Sx, Sy, Sz;
+
+	RayData() { }
+
+	RayData(const Ray3f &ray) : RaySlabData(ray) {
+		for (int i = 0; i < 3; ++i) {
+			/* The near plane along a negative direction is the max. plane */
+			nearRow[i] = sign[i] ? i + 3 : i;
+			farRow[i] = sign[i] ? i : i + 3;
+		}
+
+		/* Make the dominant direction component the z axis, and swap
+		   x and y if needed to preserve the triangle winding */
+		ray.d.cwiseAbs().maxCoeff(&kz);
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		if (ray.d[kz] < 0)
+			std::swap(kx, ky);
+
+		Sx = ray.d[kx] / ray.d[kz];
+		Sy = ray.d[ky] / ray.d[kz];
+		Sz = 1.0f / ray.d[kz];
+	}
+};
+
+bool Accel::intersectLeaf(n_UINT start, n_UINT end, Ray3f &ray,
+		const RayData &r, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const {
+	bool foundIntersection = false;
+	const SimdFloat ox(r.o[r.kx]), oy(r.o[r.ky]), oz(r.o[r.kz]),
+		Sx(r.Sx), Sy(r.Sy), Sz(r.Sz), zero(0.0f);
+
+	if (stats)
+		stats->triangleTests += end - start;
+
+	/* Pin the page that holds the leaf while it is being intersected */
+	const TrianglePacket *packets = m_packets.data();
+	n_UINT first = start / PACKET_SIZE, offset = 0;
+	PageCache::Page page;
+	if (m_pager && end > start) {
+		size_t index = std::upper_bound(m_pageStart.begin(), m_pageStart.end(), first)
+			- m_pageStart.begin() - 1;
+		page = m_pager->getPage(index);
+		packets = (const TrianglePacket *) page->data();
+		offset = m_pageStart[index];
+	}
+
+	for (n_UINT p = first, pend = packetCount(end); p < pend; ++p) {
+		const TrianglePacket &packet = packets[p - offset];
+
+		/* Translate the vertices to the ray origin, then shear and
+		   scale them so that the ray points along +z */
+		SimdFloat Az = SimdFloat::load(packet.v[0][r.kz]) - oz;
+		SimdFloat Bz = SimdFloat::load(packet.v[1][r.kz]) - oz;
+		SimdFloat Cz = SimdFloat::load(packet.v[2][r.kz]) - oz;
+		SimdFloat Ax = SimdFloat::load(packet.v[0][r.kx]) - ox - Sx * Az;
+		SimdFloat Ay = SimdFloat::load(packet.v[0][r.ky]) - oy - Sy * Az;
+		SimdFloat Bx = SimdFloat::load(packet.v[1][r.kx]) - ox - Sx * Bz;
+		SimdFloat By = SimdFloat::load(packet.v[1][r.ky]) - oy - Sy * Bz;
+		SimdFloat Cx = SimdFloat::load(packet.v[2][r.kx]) - ox - Sx * Cz;
+		SimdFloat Cy = SimdFloat::load(packet.v[2][r.ky]) - oy - Sy * Cz;
+
+		/* Scaled barycentric coordinates (2D edge functions) */
+		SimdFloat U = Cx * By - Cy * Bx;
+		SimdFloat V = Ax * Cy - Ay * Cx;
+		SimdFloat W = Bx * Ay - By * Ax;
+
+		/* An edge function that is exactly zero may be a rounding
+		   artifact -- recompute those lanes in double precision */
+		uint32_t recompute = movemask((U == zero) | (V == zero) | (W == zero));
+		if (recompute) {
+			float ax[PACKET_SIZE], ay[PACKET_SIZE], bx[PACKET_SIZE], by[PACKET_SIZE],
+				cx[PACKET_SIZE], cy[PACKET_SIZE], u[PACKET_SIZE], v[PACKET_SIZE], w[PACKET_SIZE];
+			Ax.store(ax); Ay.store(ay); Bx.store(bx); By.store(by); Cx.store(cx); Cy.store(cy);
+			U.store(u); V.store(v); W.store(w);
+			while (recompute) {
+				int i = lowestBit(recompute);
+				recompute &= recompute - 1;
+				u[i] = (float) ((double) cx[i] * (double) by[i] - (double) cy[i] * (double) bx[i]);
+				v[i] = (float) ((double) ax[i] * (double) cy[i] - (double) ay[i] * (double) cx[i]);
+				w[i] = (float) ((double) bx[i] * (double) ay[i] - (double) by[i] * (double) ax[i]);
+			}
+			U = SimdFloat::load(u);
+			V = SimdFloat::load(v);
+			W = SimdFloat::load(w);
+		}
+
+		/* The ray passes through the triangle if all edge functions
+		   agree in sign. NaN lanes (padding) fail both comparisons. */
+		SimdFloat det = U + V + W;
+		SimdFloat valid = (((U >= zero) & (V >= zero) & (W >= zero)) |
+			((U <= zero) & (V <= zero) & (W <= zero))) & (det != zero);
+
+		SimdFloat t = (U * (Sz * Az) + V * (Sz * Bz) + W * (Sz * Cz)) / det;
+		valid = valid & (t >= SimdFloat(ray.mint)) & (t <= SimdFloat(ray.maxt));
+
+		uint32_t mask = movemask(valid);
+		if (!mask)
+			continue;
+		if (shadowRay)
+			return true;
+
+		/* Pick the closest of the lanes that were hit */
+		float tLane[PACKET_SIZE];
+		t.store(tLane);
+		int best = lowestBit(mask);
+		for (mask &= mask - 1; mask; mask &= mask - 1) {
+			int i = lowestBit(mask);
+			if (tLane[i] < tLane[best])
+				best = i;
+		}
+
+		float vLane[PACKET_SIZE], wLane[PACKET_SIZE], detLane[PACKET_SIZE];
+		V.store(vLane);
+		W.store(wLane);
+		det.store(detLane);
+
+		foundIntersection = true;
+		ray.maxt = tLane[best];
+		hit.mesh = m_meshes[packet.meshId[best]];
+		hit.f = packet.primId[best];
+		hit.u = vLane[best] / detLane[best];
+		hit.v = wLane[best] / detLane[best];
+	}
+
+	return foundIntersection;
+}
+
+/* Ray-box test clipped to [mint, maxt] that also returns the entry distance */
+static inline bool intersectBox(const BoundingBox3f &bbox, const RaySlabData &r,
+		const Ray3f &ray, float &tNear) {
+	float tFar;
+	return bbox.rayIntersect(r, ray.mint, ray.maxt, tNear, tFar);
+}
+
+bool Accel::traverseBinary(Ray3f &ray, const RayData &rayData, Hit &hit,
+		bool shadowRay, TraversalStats *stats) const {
+	struct StackItem {
+		n_UINT node_idx;
+		float tNear;
+	} stack[64];
+	n_UINT node_idx = 0, stack_idx = 0;
+	bool foundIntersection = false;
+	float tNear;
+
+	if (stats)
+		stats->boxTests++;
+	if (!intersectBox(m_nodes[0].bbox, rayData, ray, tNear))
+		return false;
+
+	while (true) {
+		const BVHNode &node = m_nodes[node_idx];
+		if (stats)
+			stats->nodesVisited++;
+
+		if (node.isInner()) {
+			/* The left child holds the triangles with smaller centroids
+			   along the split axis -- it is in front unless the ray
+			   points into the negative direction */
+			bool leftFirst = ray.d[node.inner.axis] >= 0;
+			n_UINT near_idx = leftFirst ? node_idx + 1 : node.inner.rightChild;
+			n_UINT far_idx = leftFirst ? node.inner.rightChild : node_idx + 1;
+
+			float tNearChild, tFarChild;
+			bool hitNear = intersectBox(m_nodes[near_idx].bbox, rayData, ray, tNearChild);
+			bool hitFar = intersectBox(m_nodes[far_idx].bbox, rayData, ray, tFarChild);
+			if (stats)
+				stats->boxTests += 2;
+
+			if (hitNear) {
+				if (hitFar) {
+					stack[stack_idx].node_idx = far_idx;
+					stack[stack_idx++].tNear = tFarChild;
+					assert(stack_idx < 64);
+					if (stats)
+						stats->stackDepth = std::max(stats->stackDepth, (uint32_t) stack_idx);
+				}
+				node_idx = near_idx;
+				continue;
+			} else if (hitFar) {
+				node_idx = far_idx;
+				continue;
+			}
+		}
+		else {
+			if (intersectLeaf(node.start(), node.end(), ray, rayData, hit,
+					shadowRay, stats)) {
+				if (shadowRay)
+					return true;
+				foundIntersection = true;
+			}
+		}
+
+		/* Pop the next deferred node that still begins before the closest hit */
+		while (true) {
+			if (stack_idx == 0)
+				return foundIntersection;
+			--stack_idx;
+			if (stack[stack_idx].tNear <= ray.maxt)
+				break;
+			if (stats)
+				stats->nodesCulled++;
+		}
+		node_idx = stack[stack_idx].node_idx;
+	}
+}
+
+bool Accel::traverseInstances(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const {
+	struct StackItem {
+		n_UINT node_idx;
+		float tNear;
+	} stack[64];
+	n_UINT node_idx = 0, stack_idx = 0;
+	bool foundIntersection = false;
+	float tNear;
+	RaySlabData slab(ray);
+
+	if (stats)
+		stats->boxTests++;
+	if (!intersectBox(m_topNodes[0].bbox, slab, ray, tNear))
+		return false;
+
+	while (true) {
+		const BVHNode &node = m_topNodes[node_idx];
+		if (stats)
+			stats->nodesVisited++;
+
+		if (node.isInner()) {
+			bool leftFirst = ray.d[node.inner.axis] >= 0;
+			n_UINT near_idx = leftFirst ? node_idx + 1 : node.inner.rightChild;
+			n_UINT far_idx = leftFirst ? node.inner.rightChild : node_idx + 1;
+
+			float tNearChild, tFarChild;
+			bool hitNear = intersectBox(m_topNodes[near_idx].bbox, slab, ray, tNearChild);
+			bool hitFar = intersectBox(m_topNodes[far_idx].bbox, slab, ray, tFarChild);
+			if (stats)
+				stats->boxTests += 2;
+
+			if (hitNear) {
+				if (hitFar) {
+					stack[stack_idx].node_idx = far_idx;
+					stack[stack_idx++].tNear = tFarChild;
+					assert(stack_idx < 64);
+					if (stats)
+						stats->stackDepth = std::max(stats->stackDepth, (uint32_t) stack_idx);
+				}
+				node_idx = near_idx;
+				continue;
+			} else if (hitFar) {
+				node_idx = far_idx;
+				continue;
+			}
+		} else {
+			for (n_UINT i = node.start(); i < node.end(); ++i) {
+				const Instance &instance = m_instances[i];
+				bool found;
+				if (instance.accel == this) {
+					found = traverseTree(ray, hit, shadowRay, stats);
+					if (found)
+						hit.instance = nullptr;
+				} else {
+					/* The direction is not normalized, so that distances
+					   along the ray are the same in both spaces */
+					Ray3f local(
+						Point3f(instance.toLocal.leftCols<3>() * ray.o + instance.toLocal.col(3)),
+						Vector3f(instance.toLocal.leftCols<3>() * ray.d),
+						ray.mint, ray.maxt);
+					found = instance.accel->traverseTree(local, hit, shadowRay, stats);
+					if (found) {
+						ray.maxt = local.maxt;
+						hit.instance = &instance;
+					}
+				}
+
+				if (found) {
+					if (shadowRay)
+						return true;
+					foundIntersection = true;
+				}
+			}
+		}
+
+		/* Pop the next deferred node that still begins before the closest hit */
+		while (true) {
+			if (stack_idx == 0)
+				return foundIntersection;
+			--stack_idx;
+			if (stack[stack_idx].tNear <= ray.maxt)
+				break;
+			if (stats)
+				stats->nodesCulled++;
+		}
+		node_idx = stack[stack_idx].node_idx;
+	}
+}
+
+/* A NaN slab (a zero direction component with the origin on a plane)
+   never culls a child */
+template <int Width> inline uint32_t Accel::intersectChildren(
+		const float (&bounds)[6][Width], const RayData &r,
+		float mint, float maxt, float *tNear) {
+	uint32_t mask = 0;
+#if defined(NORI_SSE)
+	const __m128 ox = _mm_set1_ps(r.o[0]), rx = _mm_set1_ps(r.dRcp[0]),
+		oy = _mm_set1_ps(r.o[1]), ry = _mm_set1_ps(r.dRcp[1]),
+		oz = _mm_set1_ps(r.o[2]), rz = _mm_set1_ps(r.dRcp[2]),
+		tmin = _mm_set1_ps(mint), tmax = _mm_set1_ps(maxt);
+
+	for (int k = 0; k < Width; k += 4) {
+		__m128 nx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds[r.nearRow[0]][k]), ox), rx);
+		__m128 ny = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds[r.nearRow[1]][k]), oy), ry);
+		__m128 nz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds[r.nearRow[2]][k]), oz), rz);
+		__m128 fx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds[r.farRow[0]][k]), ox), rx);
+		__m128 fy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds[r.farRow[1]][k]), oy), ry);
+		__m128 fz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds[r.farRow[2]][k]), oz), rz);
+
+		/* _mm_max_ps/_mm_min_ps return the second operand if either one is NaN */
+		__m128 tn = _mm_max_ps(nx, _mm_max_ps(ny, _mm_max_ps(nz, tmin)));
+		__m128 tf = _mm_min_ps(fx, _mm_min_ps(fy, _mm_min_ps(fz, tmax)));
+
+		_mm_storeu_ps(tNear + k, tn);
+		mask |= (uint32_t) _mm_movemask_ps(_mm_cmple_ps(tn, tf)) << k;
+	}
+#else
+	for (int k = 0; k < Width; ++k) {
+		float tn = mint, tf = maxt;
+		for (int i = 0; i < 3; ++i) {
+			float n = (bounds[r.nearRow[i]][k] - r.o[i]) * r.dRcp[i];
+			float f = (bounds[r.farRow[i]][k] - r.o[i]) * r.dRcp[i];
+			tn = n > tn ? n : tn;
+			tf = f < tf ? f : tf;
+		}
+		tNear[k] = tn;
+		if (tn <= tf)
+			mask |= 1u << k;
+	}
+#endif
+	return mask;
+}
+
+#if defined(NORI_AVX)
+template <> inline uint32_t Accel::intersectChildren<8>(
+		const float (&bounds)[6][8], const RayData &r,
+		float mint, float maxt, float *tNear) {
+	__m256 nx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.nearRow[0]]), _mm256_set1_ps(r.o[0])), _mm256_set1_ps(r.dRcp[0]));
+	__m256 ny = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.nearRow[1]]), _mm256_set1_ps(r.o[1])), _mm256_set1_ps(r.dRcp[1]));
+	__m256 nz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.nearRow[2]]), _mm256_set1_ps(r.o[2])), _mm256_set1_ps(r.dRcp[2]));
+	__m256 fx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.farRow[0]]), _mm256_set1_ps(r.o[0])), _mm256_set1_ps(r.dRcp[0]));
+	__m256 fy = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.farRow[1]]), _mm256_set1_ps(r.o[1])), _mm256_set1_ps(r.dRcp[1]));
+	__m256 fz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.farRow[2]]), _mm256_set1_ps(r.o[2])), _mm256_set1_ps(r.dRcp[2]));
+
+	__m256 tn = _mm256_max_ps(nx, _mm256_max_ps(ny, _mm256_max_ps(nz, _mm256_set1_ps(mint))));
+	__m256 tf = _mm256_min_ps(fx, _mm256_min_ps(fy, _mm256_min_ps(fz, _mm256_set1_ps(maxt))));
+
+	_mm256_storeu_ps(tNear, tn);
+	return (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+}
+#endif
+
+template <int Width> inline uint32_t Accel::intersectChildren(
+		const QuantizedBVHNode<Width> &node, const RayData &rayData,
+		float mint, float maxt, float *tNear) {
+	float bounds[6][Width];
+	for (int j = 0; j < 6; ++j) {
+		float origin = node.origin[j % 3], scale = node.scale[j % 3];
+#if defined(NORI_SSE)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 o = _mm_set1_ps(origin), s = _mm_set1_ps(scale);
+		for (int k = 0; k < Width; k += 4) {
+			/* Zero-extend four codes to 32 bit and decode them */
+			int32_t codes;
+			memcpy(&codes, &node.bounds[j][k], sizeof(int32_t));
+			__m128i q = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(codes), zero), zero);
+			_mm_storeu_ps(&bounds[j][k], _mm_add_ps(o, _mm_mul_ps(_mm_cvtepi32_ps(q), s)));
+		}
+#else
+		for (int i = 0; i < Width; ++i)
+			bounds[j][i] = dequantize(origin, scale, node.bounds[j][i]);
+#endif
+	}
+	return intersectChildren<Width>(bounds, rayData, mint, maxt, tNear) & node.valid;
+}
+
+template <typename Node> bool Accel::traverseWide(
+		const std::vector<Node> &nodes, Ray3f &ray,
+		const RayData &rayData, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const {
+	enum { Width = Node::ChildCount };
+
+	/* Deferred children (inner nodes or leaves) along with their entry
+	   distance. Every level pushes at most Width entries. */
+	struct StackItem {
+		n_UINT child;
+		uint32_t count;
+		float tNear;
+	} stack[64 * Width];
+	n_UINT stack_idx = 0;
+	bool foundIntersection = false;
+
+	stack[stack_idx].child = 0;
+	stack[stack_idx].count = 0;
+	stack[stack_idx++].tNear = ray.mint;
+
+	while (stack_idx > 0) {
+		const StackItem item = stack[--stack_idx];
+		if (item.tNear > ray.maxt) {
+			if (stats)
+				stats->nodesCulled++;
+			continue;
+		}
+
+		if (item.count > 0) {
+			if (intersectLeaf(item.child, item.child + item.count,
+					ray, rayData, hit, shadowRay, stats)) {
+				if (shadowRay)
+					return true;
+				foundIntersection = true;
+			}
+			continue;
+		}
+
+		const Node &node = nodes[item.child];
+		if (stats) {
+			stats->nodesVisited++;
+			stats->boxTests += Width;
+		}
+
+		float tNear[Width];
+		uint32_t mask = intersectChildren(node, rayData,
+			ray.mint, ray.maxt, tNear);
+
+		/* Push the children that were hit so that the nearest one is
+		   on top of the stack (insertion sort by decreasing distance) */
+		n_UINT first = stack_idx;
+		while (mask) {
+			int i = lowestBit(mask);
+			mask &= mask - 1;
+
+			n_UINT j = stack_idx++;
+			while (j > first && stack[j - 1].tNear < tNear[i]) {
+				stack[j] = stack[j - 1];
+				--j;
+			}
+			stack[j].child = node.child[i];
+			stack[j].count = node.count[i];
+			stack[j].tNear = tNear[i];
+		}
+		assert(stack_idx <= 64 * Width);
+		if (stats)
+			stats->stackDepth = std::max(stats->stackDepth, (uint32_t) stack_idx);
+	}
+
+	return foundIntersection;
+}
+
+bool Accel::traverse(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const {
+#if defined(NORI_TRAVERSAL_STATS)
+	/* Count the work of every query, not just of those that ask for it */
+	TraversalStats query;
+	bool found = traverseQuery(ray, hit, shadowRay, &query);
+	recordQuery(query);
+	if (stats)
+		*stats += query;
+	return found;
+#else
+	return traverseQuery(ray, hit, shadowRay, stats);
+#endif
+}
+
+bool Accel::traverseQuery(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const {
+	/* Use an adaptive ray epsilon */
+	if (ray.mint == Epsilon)
+		ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+
+	if (ray.maxt < ray.mint)
+		return false;
+
+	if (!m_topNodes.empty())
+		return traverseInstances(ray, hit, shadowRay, stats);
+	return traverseTree(ray, hit, shadowRay, stats);
+}
+
+bool Accel::traverseTree(Ray3f &ray, Hit &hit, bool shadowRay,
+		TraversalStats *stats) const {
+	if (!hasNodes())
+		return false;
+
+	RayData rayData(ray);
+	switch (m_width) {
+		case 4: return m_compression
+			? traverseWide(m_qnodes4, ray, rayData, hit, shadowRay, stats)
+			: traverseWide(m_nodes4, ray, rayData, hit, shadowRay, stats);
+		case 8: return m_compression
+			? traverseWide(m_qnodes8, ray, rayData, hit, shadowRay, stats)
+			: traverseWide(m_nodes8, ray, rayData, hit, shadowRay, stats);
+		default: return traverseBinary(ray, rayData, hit, shadowRay, stats);
+	}
+}
+
+bool Accel::rayOccluded(const Ray3f &_ray, TraversalStats *stats) const {
+	Ray3f ray(_ray);
+	Hit hit; /* Unused */
+	return traverse(ray, hit, true, stats);
+}
+
+bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay,
+		TraversalStats *stats) const {
+	if (shadowRay)
+		return rayOccluded(_ray, stats);
+
+	its.t = std::numeric_limits<float>::infinity();
+
+	Ray3f ray(_ray);
+	Hit hit;
+	bool foundIntersection = traverse(ray, hit, false, stats);
+
+	if (foundIntersection) {
+		its.t = ray.maxt;
+		its.mesh = hit.mesh;
+		its.f = hit.f;
+		its.bary = Point2f(hit.u, hit.v);
+		its.instanceToWorld = hit.instance ? &hit.instance->toWorld : nullptr;
+	}
+
+	return foundIntersection;
+}
+
+/// Store the closest hit of ray \c i in the hit record of a packet
+template <int Size> static inline void storeHit(RayPacket<Size> &packet, int i,
+		const Mesh *mesh, n_UINT f, float u, float v, const Matrix3x4f *instanceToWorld) {
+	packet.mesh[i] = mesh;
+	packet.f[i] = f;
+	packet.u[i] = u;
+	packet.v[i] = v;
+	packet.instanceToWorld[i] = instanceToWorld;
+}
+
+/**
+ * \brief Slab test of a bounding box against the rays of a packet in \c mask
+ *
+ * Returns the rays whose segment overlaps the box and writes their entry
+ * distances to \c tNear. Like \ref Accel::intersectChildren(), a NaN slab
+ * never culls the box.
+ */
+template <int Size> static inline uint32_t intersectBox(const BoundingBox3f &bbox,
+		const RayPacket<Size> &p, uint32_t mask, float *tNear) {
+	const uint32_t laneMask = (1u << NORI_SIMD_WIDTH) - 1;
+	uint32_t result = 0;
+	for (int k = 0; k < Size; k += NORI_SIMD_WIDTH) {
+		if (((mask >> k) & laneMask) == 0)
+			continue;
+		SimdFloat tn = SimdFloat::load(&p.mint[k]), tf = SimdFloat::load(&p.maxt[k]);
+		for (int axis = 0; axis < 3; ++axis) {
+			SimdFloat o = SimdFloat::load(&p.o[axis][k]);
+			SimdFloat r = SimdFloat::load(&p.dRcp[axis][k]);
+			SimdFloat t0 = (SimdFloat(bbox.min[axis]) - o) * r;
+			SimdFloat t1 = (SimdFloat(bbox.max[axis]) - o) * r;
+			/* The near plane along a negative direction is the max. plane */
+			SimdFloat negative = r < SimdFloat(0.0f);
+			tn = max(select(negative, t1, t0), tn);
+			tf = min(select(negative, t0, t1), tf);
+		}
+		tn.store(tNear + k);
+		result |= movemask(tn <= tf) << k;
+	}
+	return result & mask;
+}
+
+template <int Size> uint32_t Accel::traversePacket(RayPacket<Size> &p,
+		bool shadowRay, TraversalStats *stats) const {
+	static_assert(Size % NORI_SIMD_WIDTH == 0 && Size <= 32,
+		"Unsupported ray packet size");
+	uint32_t mask = 0;
+
+	/* Scalar copies of the rays for the leaf tests */
+	Ray3f rays[Size];
+	RayData rayData[Size];
+	Hit hits[Size];
+	for (uint32_t m = p.active; m; m &= m - 1) {
+		int i = lowestBit(m);
+		rays[i] = p.getRay(i);
+
+		/* Use an adaptive ray epsilon */
+		Ray3f &ray = rays[i];
+		if (ray.mint == Epsilon)
+			ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+		p.mint[i] = ray.mint;
+		if (ray.maxt < ray.mint)
+			continue;
+
+		rayData[i] = RayData(ray);
+		mask |= 1u << i;
+	}
+
+	if (mask == 0 || !hasNodes())
+		return 0;
+
+	uint32_t hitMask;
+	switch (m_width) {
+		case 4: hitMask = m_compression
+			? traversePacketWide(m_qnodes4, p, rays, rayData, hits, mask, shadowRay, stats)
+			: traversePacketWide(m_nodes4, p, rays, rayData, hits, mask, shadowRay, stats);
+			break;
+		case 8: hitMask = m_compression
+			? traversePacketWide(m_qnodes8, p, rays, rayData, hits, mask, shadowRay, stats)
+			: traversePacketWide(m_nodes8, p, rays, rayData, hits, mask, shadowRay, stats);
+			break;
+		default: hitMask = traversePacketBinary(p, rays, rayData, hits, mask, shadowRay, stats);
+	}
+
+	if (!shadowRay) {
+		for (uint32_t m = hitMask; m; m &= m - 1) {
+			int i = lowestBit(m);
+			storeHit(p, i, hits[i].mesh, hits[i].f, hits[i].u, hits[i].v, nullptr);
+		}
+	}
+	return hitMask;
+}
+
+/**
+ * \brief Drop the rays of \c mask whose closest hit lies in front of the
+ * given entry distances
+ */
+template <int Size> static inline uint32_t cullPacket(const RayPacket<Size> &p,
+		uint32_t mask, const float *tNear) {
+	for (int k = 0; k < Size; k += NORI_SIMD_WIDTH)
+		mask &= ~(movemask(SimdFloat::load(&p.maxt[k]) <
+			SimdFloat::load(&tNear[k])) << k);
+	return mask;
+}
+
+template <int Size> uint32_t Accel::traversePacketBinary(RayPacket<Size> &p,
+		Ray3f *rays, const RayData *rayData, Hit *hits, uint32_t mask,
+		bool shadowRay, TraversalStats *stats) const {
+	struct StackItem {
+		n_UINT node_idx;
+		uint32_t mask;
+		float tNear[Size];
+	} stack[64];
+	n_UINT node_idx = 0, stack_idx = 0;
+	uint32_t hitMask = 0;
+	float tNear[Size];
+
+	if (stats)
+		stats->boxTests += popcount(mask);
+	mask = intersectBox(m_nodes[0].bbox, p, mask, tNear);
+	if (mask == 0)
+		return 0;
+
+	/* Rays that miss the root cannot be occluded */
+	const uint32_t traced = mask;
+
+	while (true) {
+		const BVHNode &node = m_nodes[node_idx];
+		if (stats)
+			stats->nodesVisited++;
+
+		if (node.isInner()) {
+			/* Order the children by the direction of the first active ray,
+			   which for a coherent packet is also right for the others */
+			bool leftFirst = p.d[node.inner.axis][lowestBit(mask)] >= 0;
+			n_UINT near_idx = leftFirst ? node_idx + 1 : node.inner.rightChild;
+			n_UINT far_idx = leftFirst ? node.inner.rightChild : node_idx + 1;
+
+			StackItem &item = stack[stack_idx];
+			uint32_t nearMask = intersectBox(m_nodes[near_idx].bbox, p, mask, tNear);
+			uint32_t farMask = intersectBox(m_nodes[far_idx].bbox, p, mask, item.tNear);
+			if (stats)
+				stats->boxTests += 2 * popcount(mask);
+
+			if (nearMask) {
+				if (farMask) {
+					item.node_idx = far_idx;
+					item.mask = farMask;
+					++stack_idx;
+					assert(stack_idx < 64);
+					if (stats)
+						stats->stackDepth = std::max(stats->stackDepth, (uint32_t) stack_idx);
+				}
+				node_idx = near_idx;
+				mask = nearMask;
+				continue;
+			} else if (farMask) {
+				node_idx = far_idx;
+				mask = farMask;
+				continue;
+			}
+		}
+		else {
+			/* Shadow rays that are already occluded skip the leaf */
+			for (uint32_t m = shadowRay ? mask & ~hitMask : mask; m; m &= m - 1) {
+				int i = lowestBit(m);
+				if (intersectLeaf(node.start(), node.end(), rays[i], rayData[i],
+						hits[i], shadowRay, stats)) {
+					hitMask |= 1u << i;
+					p.maxt[i] = rays[i].maxt;
+				}
+			}
+			if (shadowRay && hitMask == traced)
+				return hitMask;
+		}
+
+		/* Pop the next deferred node that some ray still needs to visit,
+		   dropping the rays whose closest hit lies in front of it (and,
+		   for shadow rays, those that are already occluded) */
+		mask = 0;
+		while (mask == 0 && stack_idx > 0) {
+			const StackItem &item = stack[--stack_idx];
+			mask = cullPacket(p, shadowRay ? item.mask & ~hitMask : item.mask, item.tNear);
+			if (mask == 0 && stats)
+				stats->nodesCulled++;
+		}
+		if (mask == 0)
+			break;
+		node_idx = stack[stack_idx].node_idx;
+	}
+
+	return hitMask;
+}
+
+template <typename Node, int Size> uint32_t Accel::traversePacketWide(
+		const std::vector<Node> &nodes, RayPacket<Size> &p,
+		Ray3f *rays, const RayData *rayData, Hit *hits, uint32_t mask,
+		bool shadowRay, TraversalStats *stats) const {
+	enum { Width = Node::ChildCount };
+
+	/* Deferred children (inner nodes or leaves) along with the rays that
+	   overlap them and their entry distances. Every level pushes at most
+	   Width entries. */
+	struct StackItem {
+		n_UINT child;
+		uint32_t count;
+		uint32_t mask;
+		float tNear[Size];
+	} stack[64 * Width];
+	n_UINT stack_idx = 0, child = 0;
+	uint32_t count = 0, hitMask = 0, traced = 0;
+
+	while (true) {
+		if (count > 0) {
+			/* Shadow rays that are already occluded skip the leaf */
+			for (uint32_t m = shadowRay ? mask & ~hitMask : mask; m; m &= m - 1) {
+				int i = lowestBit(m);
+				if (intersectLeaf(child, child + count, rays[i], rayData[i],
+						hits[i], shadowRay, stats)) {
+					hitMask |= 1u << i;
+					p.maxt[i] = rays[i].maxt;
+				}
+			}
+			if (shadowRay && hitMask == traced)
+				return hitMask;
+		} else {
+			const Node &node = nodes[child];
+			if (stats) {
+				stats->nodesVisited++;
+				stats->boxTests += Width * popcount(mask);
+			}
+
+			/* Push the children that some ray overlaps so that the
+			   nearest one (for the first of its rays) is on top */
+			n_UINT first = stack_idx;
+			for (uint32_t used = node.getChildMask(); used; used &= used - 1) {
+				int i = lowestBit(used);
+				StackItem &item = stack[stack_idx];
+				item.mask = intersectBox(node.getChildBounds(i), p, mask, item.tNear);
+				if (item.mask == 0)
+					continue;
+				item.child = node.child[i];
+				item.count = node.count[i];
+
+				n_UINT j = stack_idx++;
+				float key = item.tNear[lowestBit(item.mask)];
+				while (j > first && stack[j - 1].tNear[lowestBit(stack[j - 1].mask)] < key) {
+					std::swap(stack[j], stack[j - 1]);
+					--j;
+				}
+			}
+			assert(stack_idx <= 64 * Width);
+			if (stats)
+				stats->stackDepth = std::max(stats->stackDepth, (uint32_t) stack_idx);
+
+			/* Rays that miss all children of the root cannot be occluded */
+			if (child == 0)
+				for (n_UINT j = first; j < stack_idx; ++j)
+					traced |= stack[j].mask;
+		}
+
+		/* Pop the next deferred child that some ray still needs to visit */
+		mask = 0;
+		while (mask == 0 && stack_idx > 0) {
+			const StackItem &item = stack[--stack_idx];
+			mask = cullPacket(p, shadowRay ? item.mask & ~hitMask : item.mask, item.tNear);
+			if (mask == 0 && stats)
+				stats->nodesCulled++;
+		}
+		if (mask == 0)
+			break;
+		child = stack[stack_idx].child;
+		count = stack[stack_idx].count;
+	}
+
+	return hitMask;
+}
+
+template <int Size> void Accel::rayIntersect(RayPacket<Size> &packet,
+		TraversalStats *stats) const {
+	for (int i = 0; i < Size; ++i)
+		packet.mesh[i] = nullptr;
+
+	if (m_topNodes.empty()) {
+		traversePacket(packet, false, stats);
+		return;
+	}
+
+	/* The rays of a packet diverge once they are transformed into the
+	   spaces of different instances, so they are traced one by one */
+	for (uint32_t m = packet.active; m; m &= m - 1) {
+		int i = lowestBit(m);
+		Ray3f ray = packet.getRay(i);
+		Hit hit;
+		if (traverse(ray, hit, false, stats)) {
+			packet.maxt[i] = ray.maxt;
+			storeHit(packet, i, hit.mesh, hit.f, hit.u, hit.v,
+				hit.instance ? &hit.instance->toWorld : nullptr);
+		}
+	}
+}
+
+template <int Size> uint32_t Accel::rayOccluded(RayPacket<Size> &packet,
+		TraversalStats *stats) const {
+	if (m_topNodes.empty())
+		return traversePacket(packet, true, stats);
+
+	uint32_t occluded = 0;
+	for (uint32_t m = packet.active; m; m &= m - 1) {
+		int i = lowestBit(m);
+		Ray3f ray = packet.getRay(i);
+		Hit hit; /* Unused */
+		if (traverse(ray, hit, true, stats))
+			occluded |= 1u << i;
+	}
+	return occluded;
+}
+
+template void Accel::rayIntersect(RayPacket<8> &, TraversalStats *) const;
+template void Accel::rayIntersect(RayPacket<16> &, TraversalStats *) const;
+template uint32_t Accel::rayOccluded(RayPacket<8> &, TraversalStats *) const;
+template uint32_t Accel::rayOccluded(RayPacket<16> &, TraversalStats *) const;
+
+NORI_NAMESPACE_END
@@ -0,0 +1,137 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/adaptive.h>
+#include <algorithm>
+#include <limits>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * A pixel only counts as converged once every pixel within this radius
+ * is below the threshold. Pixels whose few samples happened to agree
+ * (e.g. all missed the light) are then still refined if their
+ * neighbours are noisy.
+ */
+static const int NEIGHBORHOOD_RADIUS = 1;
+
+AdaptiveSampling::AdaptiveSampling(const Vector2i &size, float threshold,
+                                   uint32_t minSampleCount, uint32_t maxPassSampleCount)
+    : m_size(size), m_threshold(threshold), m_minSampleCount(minSampleCount),
+      m_maxPassSampleCount(std::max(maxPassSampleCount, 1u)) {
+    size_t pixels = (size_t) size.x() * size.y();
+    m_counts.resize(pixels);
+    m_errors.resize(pixels);
+    m_weights.resize(pixels);
+    m_residual.resize(pixels);
+}
+
+uint64_t AdaptiveSampling::plan(const Film &film, uint64_t budget) {
+    if (!film.hasStatistics())
+        throw NoriException("AdaptiveSampling::plan(): the film does not keep pixel statistics!");
+
+    /* Relative error of each pixel (infinite while it has too few samples) */
+    const float unmeasured = std::numeric_limits<float>::infinity();
+    double errorSum = 0;
+    size_t measured = 0;
+    for (int y = 0; y < m_size.y(); ++y) {
+        for (int x = 0; x < m_size.x(); ++x) {
+            const PixelStatistics &stats = film.getStatistics(Point2i(x, y));
+            float error = unmeasured;
+            if (stats.count >= m_minSampleCount) {
+                error = stats.getRelativeError();
+                errorSum += error * error;
+                measured++;
+            }
+            m_errors[(size_t) y * m_size.x() + x] = error;
+        }
+    }
+    m_error = measured > 0 ? (float) std::sqrt(errorSum / measured) : unmeasured;
+
+    /* Top up the pixels with too few samples, and weight the others by
+       the largest error in their neighbourhood */
+    uint64_t planned = 0;
+    double weightSum = 0;
+    m_converged = 0;
+    for (int y = 0; y < m_size.y(); ++y) {
+        for (int x = 0; x < m_size.x(); ++x) {
+            size_t idx = (size_t) y * m_size.x() + x;
+            const PixelStatistics &stats = film.getStatistics(Point2i(x, y));
+            m_counts[idx] = 0;
+            m_weights[idx] = 0;
+
+            if (stats.count < m_minSampleCount) {
+                m_counts[idx] = std::min(m_minSampleCount - stats.count, m_maxPassSampleCount);
+                planned += m_counts[idx];
+                continue;
+            }
+
+            float error = 0;
+            for (int ny = std::max(y - NEIGHBORHOOD_RADIUS, 0); ny <= std::min(y + NEIGHBORHOOD_RADIUS, m_size.y() - 1); ++ny)
+                for (int nx = std::max(x - NEIGHBORHOOD_RADIUS, 0); nx <= std::min(x + NEIGHBORHOOD_RADIUS, m_size.x() - 1); ++nx)
+                    error = std::max(error, m_errors[(size_t) ny * m_size.x() + nx]);
+
+            if (error < m_threshold) {
+                m_converged++;
+                m_residual[idx] = 0;
+            } else {
+                /* Neighbours that lack samples are topped up in this pass */
+                m_weights[idx] = std::isinf(error) ? m_errors[idx] : error;
+                weightSum += m_weights[idx];
+            }
+        }
+    }
+
+    if (planned >= budget || weightSum == 0)
+        return planned;
+
+    /* Distribute the rest of the budget, carrying fractions over */
+    double scale = (budget - planned) / weightSum;
+    for (size_t idx = 0; idx < m_counts.size(); ++idx) {
+        if (m_weights[idx] == 0)
+            continue;
+        float share = (float) (m_weights[idx] * scale) + m_residual[idx];
+        uint32_t count = std::min((uint32_t) share, m_maxPassSampleCount);
+        m_residual[idx] = count < m_maxPassSampleCount ? share - count : 0.0f;
+        m_counts[idx] = count;
+        planned += count;
+    }
+    return planned;
+}
+
+uint32_t AdaptiveSampling::getMaxSampleCount(const Point2i &offset, const Vector2i &size) const {
+    uint32_t result = 0;
+    for (int y = offset.y(); y < offset.y() + size.y(); ++y)
+        for (int x = offset.x(); x < offset.x() + size.x(); ++x)
+            result = std::max(result, m_counts[y * m_size.x() + x]);
+    return result;
+}
+
+std::string AdaptiveSampling::toString() const {
+    return tfm::format(
+        "AdaptiveSampling[\n"
+        "  threshold = %f,\n"
+        "  minSampleCount = %i,\n"
+        "  maxPassSampleCount = %i,\n"
+        "  converged = %i of %i pixels\n"
+        "]",
+        m_threshold, m_minSampleCount, m_maxPassSampleCount,
+        m_converged, m_counts.size());
+}
+
+NORI_NAMESPACE_END
@@ -20,6 +20,8 @@
 #include <nori/bitmap.h>
 #include <nori/rfilter.h>
 #include <nori/bbox.h>
+#include <algorithm>
+#include <limits>
 #include <tbb/tbb.h>
 #include "nori/bitmap.h"
 
@@ -50,6 +52,7 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
 
     /* Allocate space for pixels and border regions */
     resize(size.y() + 2*m_borderSize, size.x() + 2*m_borderSize);
+    m_rowLocks.reset(new std::mutex[rows()]);
 }
 
 ImageBlock::~ImageBlock() {
@@ -75,13 +78,7 @@ void ImageBlock::fromBitmap(const Bitmap &bitmap) {
             coeffRef(y, x) << bitmap.coeff(y, x), 1;
 }
 
-void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
-    if (!value.isValid()) {
-        /* If this happens, go fix your code instead of removing this warning ;) */
-        cerr << "Integrator: computed an invalid radiance value: " << value.toString() << endl;
-        return;
-    }
-
+ImageBlock::Footprint ImageBlock::getFootprint(const Point2f &_pos) {
     /* Convert to pixel coordinates within the image block */
     Point2f pos(
         _pos.x() - 0.5f - (m_offset.x() - m_borderSize),
@@ -101,9 +98,28 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
     for (int y=bbox.min.y(), idx = 0; y<=bbox.max.y(); ++y)
         m_weightsY[idx++] = m_filter[(int) (std::abs(y-pos.y()) * m_lookupFactor)];
 
+    Footprint footprint;
+    footprint.bbox = bbox;
+    footprint.weightsX = m_weightsX;
+    footprint.weightsY = m_weightsY;
+    return footprint;
+}
+
+void ImageBlock::put(const Point2f &pos, const Color3f &value) {
+    if (!value.isValid()) {
+        /* If this happens, go fix your code instead of removing this warning ;) */
+        cerr << "Integrator: computed an invalid radiance value: " << value.toString() << endl;
+        return;
+    }
+
+    put(getFootprint(pos), value);
+}
+
+void ImageBlock::put(const Footprint &footprint, const Color3f &value) {
+    const BoundingBox2i &bbox = footprint.bbox;
     for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr) 
         for (int x=bbox.min.x(), xr=0; x<=bbox.max.x(); ++x, ++xr) 
-            coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
+            coeffRef(y, x) += Color4f(value) * footprint.weightsX[xr] * footprint.weightsY[yr];
 }
     
 void ImageBlock::put(ImageBlock &b) {
@@ -111,64 +127,154 @@ void ImageBlock::put(ImageBlock &b) {
         Vector2i::Constant(m_borderSize - b.getBorderSize());
     Vector2i size   = b.getSize()   + Vector2i(2*b.getBorderSize());
 
-    tbb::mutex::scoped_lock lock(m_mutex);
-
-    block(offset.y(), offset.x(), size.y(), size.x()) 
-        += b.topLeftCorner(size.y(), size.x());
+    /* Neighbouring blocks reach up to twice the border size into b, so
+       only the pixels in [overlap, size - overlap) belong to b alone */
+    int overlap = 2 * b.getBorderSize();
+    int coreBegin = overlap, coreEnd = size.x() - overlap;
+    if (coreEnd <= coreBegin)
+        coreBegin = coreEnd = size.x();
+
+    for (int y = 0; y < size.y(); ++y) {
+        auto src = b.row(y);
+        auto dst = row(offset.y() + y).segment(offset.x(), size.x());
+        bool shared = y < overlap || y >= size.y() - overlap;
+        {
+            std::lock_guard<std::mutex> lock(m_rowLocks[offset.y() + y]);
+            if (shared) {
+                dst += src.head(size.x());
+            } else {
+                dst.head(coreBegin) += src.head(coreBegin);
+                dst.segment(coreEnd, size.x() - coreEnd) += src.segment(coreEnd, size.x() - coreEnd);
+            }
+        }
+        if (!shared)
+            dst.segment(coreBegin, coreEnd - coreBegin) += src.segment(coreBegin, coreEnd - coreBegin);
+    }
 }
 
-
-
-
-
 std::string ImageBlock::toString() const {
     return tfm::format("ImageBlock[offset=%s, size=%s]]",
         m_offset.toString(), m_size.toString());
 }
 
+/**
+ * Largest part of the average work of a thread that a single block may
+ * take. With the most expensive blocks handed out first, a pass ends at
+ * most about this much later than with a perfect split of the work.
+ */
+static const double MAX_BLOCK_SHARE = 0.125;
+
+/// Blocks are not split into parts smaller than this
+static const int MIN_SPLIT_SIZE = 8;
+
 BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
+        : m_size(size), m_blockSize(blockSize), m_next(0) {
     m_numBlocks = Vector2i(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
-    m_direction = ERight;
-    m_block = Point2i(m_numBlocks / 2);
-    m_stepsLeft = 1;
-    m_numSteps = 1;
+    int blockCount = m_numBlocks.x() * m_numBlocks.y();
+
+    /* Walk over the grid in a spiral that starts at the center */
+    Point2i block(m_numBlocks / 2);
+    int direction = ERight, numSteps = 1, stepsLeft = 1;
+    m_spiral.reserve(blockCount);
+    while ((int) m_spiral.size() < blockCount) {
+        if ((block.array() >= 0).all() && (block.array() < m_numBlocks.array()).all())
+            m_spiral.push_back(block);
+
+        switch (direction) {
+            case ERight: ++block.x(); break;
+            case EDown:  ++block.y(); break;
+            case ELeft:  --block.x(); break;
+            case EUp:    --block.y(); break;
+        }
+
+        if (--stepsLeft == 0) {
+            direction = (direction + 1) % 4;
+            if (direction == ELeft || direction == ERight) 
+                ++numSteps;
+            stepsLeft = numSteps;
+        }
+    }
+
+    m_costs.reset(new std::atomic<uint64_t>[blockCount]);
+    for (int i = 0; i < blockCount; ++i)
+        m_costs[i] = 0;
+    reset();
 }
 
-bool BlockGenerator::next(ImageBlock &block) {
-    tbb::mutex::scoped_lock lock(m_mutex);
+void BlockGenerator::reset(int threadCount) {
+    /* Collect and clear the costs of the previous pass */
+    std::vector<double> costs(m_spiral.size());
+    double totalCost = 0;
+    for (size_t i = 0; i < m_spiral.size(); ++i) {
+        const Point2i &cell = m_spiral[i];
+        costs[i] = (double) m_costs[cell.y() * m_numBlocks.x() + cell.x()].exchange(0);
+        totalCost += costs[i];
+    }
 
-    if (m_blocksLeft == 0)
-        return false;
+    double maxCost = std::numeric_limits<double>::infinity();
+    if (threadCount > 1 && totalCost > 0)
+        maxCost = MAX_BLOCK_SHARE * totalCost / threadCount;
+
+    m_blocks.clear();
+    m_splitCount = 0;
+    for (size_t i = 0; i < m_spiral.size(); ++i) {
+        Point2i offset = m_spiral[i] * m_blockSize;
+        size_t count = m_blocks.size();
+        addBlock(offset, (m_size - offset).cwiseMin(Vector2i::Constant(m_blockSize)), costs[i], maxCost);
+        if (m_blocks.size() > count + 1)
+            ++m_splitCount;
+    }
 
-    Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
-    block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
+    /* Most expensive blocks first. Without costs (e.g. in the first
+       pass), the blocks keep their spiral order */
+    std::stable_sort(m_blocks.begin(), m_blocks.end(),
+        [](const Block &a, const Block &b) { return a.cost > b.cost; });
+    m_next = 0;
+}
 
-    if (--m_blocksLeft == 0)
-        return true;
+void BlockGenerator::addBlock(const Point2i &offset, const Vector2i &size, double cost, double maxCost) {
+    /* Halve the block along each axis that leaves two large enough parts */
+    bool splitX = size.x() >= 2 * MIN_SPLIT_SIZE,
+         splitY = size.y() >= 2 * MIN_SPLIT_SIZE;
+    if (cost <= maxCost || (!splitX && !splitY)) {
+        Block block;
+        block.offset = offset;
+        block.size = size;
+        block.cost = cost;
+        m_blocks.push_back(block);
+        return;
+    }
 
-    do {
-        switch (m_direction) {
-            case ERight: ++m_block.x(); break;
-            case EDown:  ++m_block.y(); break;
-            case ELeft:  --m_block.x(); break;
-            case EUp:    --m_block.y(); break;
+    Vector2i first(splitX ? size.x() / 2 : size.x(),
+                   splitY ? size.y() / 2 : size.y());
+    int nx = splitX ? 2 : 1, ny = splitY ? 2 : 1;
+    for (int y = 0; y < ny; ++y) {
+        for (int x = 0; x < nx; ++x) {
+            Point2i partOffset(offset.x() + x * first.x(), offset.y() + y * first.y());
+            Vector2i partSize(x == 0 ? first.x() : size.x() - first.x(),
+                              y == 0 ? first.y() : size.y() - first.y());
+            addBlock(partOffset, partSize, cost / (nx * ny), maxCost);
         }
+    }
+}
 
-        if (--m_stepsLeft == 0) {
-            m_direction = (m_direction + 1) % 4;
-            if (m_direction == ELeft || m_direction == ERight) 
-                ++m_numSteps;
-            m_stepsLeft = m_numSteps;
-        }
-    } while ((m_block.array() < 0).any() ||
-             (m_block.array() >= m_numBlocks.array()).any());
+bool BlockGenerator::next(ImageBlock &block) {
+    int index = m_next.fetch_add(1, std::memory_order_relaxed);
+    if (index >= (int) m_blocks.size())
+        return false;
 
+    const Block &b = m_blocks[index];
+    block.setOffset(b.offset);
+    block.setSize(b.size);
     return true;
 }
 
+void BlockGenerator::addCost(const ImageBlock &block, uint64_t cost) {
+    /* Parts of a split block add up in the grid cell they came from */
+    Point2i cell = block.getOffset() / m_blockSize;
+    m_costs[cell.y() * m_numBlocks.x() + cell.x()].fetch_add(cost, std::memory_order_relaxed);
+}
+
 NORI_NAMESPACE_END
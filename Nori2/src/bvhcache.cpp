@@ -0,0 +1,147 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <nori/mmap.h>
+#include <nori/timer.h>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/* Bump whenever the layout of the cached data changes */
+static const uint32_t BVH_CACHE_VERSION = 1;
+
+/**
+ * \brief Header of a BVH cache file
+ *
+ * It is followed by the node, index, triangle packet and wide node arrays
+ * of \ref Accel in this order, with the lengths given in \c counts.
+ */
+struct BVHCacheHeader {
+	char magic[4];      ///< "NBVH"
+	uint32_t version;   ///< BVH_CACHE_VERSION
+	uint64_t key;       ///< Hash of the geometry and the build settings
+	uint64_t counts[5]; ///< Number of nodes, indices, packets, 4-wide and 8-wide nodes
+};
+
+uint64_t Accel::cacheKey() const {
+	/* Build settings, and the sizes of all cached records to rule out
+	   files written by a build with another packet width */
+	uint64_t settings[] = {
+		BVH_CACHE_VERSION, (uint64_t) m_width, (uint64_t) m_builder,
+		(uint64_t) m_treeletOptimization, (uint64_t) m_layout, PACKET_SIZE, sizeof(BVHNode),
+		sizeof(TrianglePacket), sizeof(WideBVHNode<4>), sizeof(WideBVHNode<8>)
+	};
+	uint64_t key = hashBytes(settings, sizeof(settings));
+	key = hashBytes(&m_splitBudget, sizeof(float), key);
+
+	for (const Mesh *mesh : m_meshes) {
+		const MatrixXf &V = mesh->getVertexPositions();
+		const MatrixXu &F = mesh->getIndices();
+		uint64_t sizes[] = { (uint64_t) V.cols(), (uint64_t) F.cols() };
+		key = hashBytes(sizes, sizeof(sizes), key);
+		key = hashBytes(V.data(), sizeof(float) * V.size(), key);
+		key = hashBytes(F.data(), sizeof(uint32_t) * F.size(), key);
+	}
+	return key;
+}
+
+/// Copy an array that follows the header of a cache file into a vector
+template <typename T> static const uint8_t *readArray(const uint8_t *ptr,
+		uint64_t count, std::vector<T> &result) {
+	result.resize((size_t) count);
+	if (count > 0)
+		memcpy(result.data(), ptr, sizeof(T) * (size_t) count);
+	return ptr + sizeof(T) * count;
+}
+
+bool Accel::loadCache(uint64_t key) {
+	MemoryMappedFile file;
+	if (!file.map(m_cacheFile) || file.size() < sizeof(BVHCacheHeader))
+		return false;
+
+	BVHCacheHeader header;
+	memcpy(&header, file.data(), sizeof(BVHCacheHeader));
+	if (memcmp(header.magic, "NBVH", 4) != 0 ||
+		header.version != BVH_CACHE_VERSION || header.key != key)
+		return false;
+
+	const size_t sizes[5] = {
+		sizeof(BVHNode), sizeof(n_UINT), sizeof(TrianglePacket),
+		sizeof(WideBVHNode<4>), sizeof(WideBVHNode<8>)
+	};
+	uint64_t expected = sizeof(BVHCacheHeader);
+	for (int i = 0; i < 5; ++i)
+		expected += header.counts[i] * sizes[i];
+	if (expected != file.size() || header.counts[0] == 0)
+		return false;
+
+	/* The traversal code works on vectors, so the mapped arrays are
+	   copied once instead of being referenced in place */
+	const uint8_t *ptr = file.data() + sizeof(BVHCacheHeader);
+	ptr = readArray(ptr, header.counts[0], m_nodes);
+	ptr = readArray(ptr, header.counts[1], m_indices);
+	ptr = readArray(ptr, header.counts[2], m_packets);
+	ptr = readArray(ptr, header.counts[3], m_nodes4);
+	readArray(ptr, header.counts[4], m_nodes8);
+	return true;
+}
+
+/// Append an array to a cache file
+template <typename T> static void writeArray(std::ofstream &os,
+		const std::vector<T> &array) {
+	os.write((const char *) array.data(), sizeof(T) * array.size());
+}
+
+void Accel::saveCache(uint64_t key) const {
+	std::ofstream os(m_cacheFile, std::ios::binary | std::ios::trunc);
+	if (os.fail()) {
+		cerr << "Warning: unable to write the BVH cache \"" << m_cacheFile << "\"" << endl;
+		return;
+	}
+
+	BVHCacheHeader header;
+	memcpy(header.magic, "NBVH", 4);
+	header.version = BVH_CACHE_VERSION;
+	header.key = key;
+	header.counts[0] = m_nodes.size();
+	header.counts[1] = m_indices.size();
+	header.counts[2] = m_indices.size() / PACKET_SIZE;
+	header.counts[3] = m_nodes4.size();
+	header.counts[4] = m_nodes8.size();
+
+	os.write((const char *) &header, sizeof(BVHCacheHeader));
+	writeArray(os, m_nodes);
+	writeArray(os, m_indices);
+	if (m_pager) {
+		/* The packets were streamed into the page file; read them back */
+		for (size_t i = 0; i < m_pageStart.size(); ++i) {
+			PageCache::Page page = m_pager->getPage(i);
+			os.write((const char *) page->data(), (std::streamsize) page->size());
+		}
+	} else {
+		writeArray(os, m_packets);
+	}
+	writeArray(os, m_nodes4);
+	writeArray(os, m_nodes8);
+
+	if (os.fail())
+		cerr << "Warning: unable to write the BVH cache \"" << m_cacheFile << "\"" << endl;
+}
+
+NORI_NAMESPACE_END
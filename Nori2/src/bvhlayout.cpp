@@ -0,0 +1,180 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <algorithm>
+#include <limits>
+#include <queue>
+
+NORI_NAMESPACE_BEGIN
+
+/// Size of the clusters of the treelet layout in bytes
+static const size_t TREELET_PAGE_SIZE = 4096;
+
+/// Does the given child slot of a wide node refer to another wide node?
+template <typename Node> static bool isInnerChild(const Node &node, int i) {
+	/* Unused slots hold an inverted box */
+	return node.count[i] == 0 && node.bounds[0][i] <= node.bounds[3][i];
+}
+
+/// Surface area of the box in a child slot of a wide node
+template <typename Node> static float childArea(const Node &node, int i) {
+	float dx = node.bounds[3][i] - node.bounds[0][i],
+	      dy = node.bounds[4][i] - node.bounds[1][i],
+	      dz = node.bounds[5][i] - node.bounds[2][i];
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+/// Breadth-first order of the nodes
+template <typename Node> static void orderBreadthFirst(
+		const std::vector<Node> &nodes, std::vector<n_UINT> &order) {
+	order.push_back(0u);
+	for (size_t i = 0; i < order.size(); ++i) {
+		const Node &node = nodes[order[i]];
+		for (int j = 0; j < Node::ChildCount; ++j)
+			if (isInnerChild(node, j))
+				order.push_back(node.child[j]);
+	}
+}
+
+/**
+ * Page-sized clusters: each cluster grows from its root by repeatedly
+ * adding the pending child with the largest surface area, i.e. the one
+ * that a random ray entering the cluster is most likely to visit. The
+ * children that are left over when the cluster is full become the roots
+ * of further clusters.
+ */
+template <typename Node> static void orderTreelets(
+		const std::vector<Node> &nodes, std::vector<n_UINT> &order) {
+	typedef std::pair<float, n_UINT> Candidate;
+	const size_t clusterSize = std::max(TREELET_PAGE_SIZE / sizeof(Node), (size_t) 1);
+
+	std::vector<n_UINT> roots(1, 0u);
+	std::vector<Candidate> remaining;
+	while (!roots.empty()) {
+		std::priority_queue<Candidate> candidates;
+		candidates.push(Candidate(std::numeric_limits<float>::infinity(), roots.back()));
+		roots.pop_back();
+
+		for (size_t size = 0; size < clusterSize && !candidates.empty(); ++size) {
+			n_UINT node_idx = candidates.top().second;
+			candidates.pop();
+			order.push_back(node_idx);
+
+			const Node &node = nodes[node_idx];
+			for (int j = 0; j < Node::ChildCount; ++j)
+				if (isInnerChild(node, j))
+					candidates.push(Candidate(childArea(node, j), node.child[j]));
+		}
+
+		/* Continue with the largest left-over subtree */
+		remaining.clear();
+		for (; !candidates.empty(); candidates.pop())
+			remaining.push_back(candidates.top());
+		for (auto it = remaining.rbegin(); it != remaining.rend(); ++it)
+			roots.push_back(it->second);
+	}
+}
+
+/**
+ * Recursive van Emde Boas order: the top \c levels / 2 levels of the
+ * subtree at \c node_idx are laid out first, followed by each of the
+ * subtrees that hang below them. Nodes \c levels below \c node_idx are
+ * appended to \c frontier instead.
+ */
+template <typename Node> static void orderVanEmdeBoas(
+		const std::vector<Node> &nodes, n_UINT node_idx, uint32_t levels,
+		std::vector<n_UINT> &order, std::vector<n_UINT> &frontier) {
+	if (levels == 1) {
+		order.push_back(node_idx);
+		const Node &node = nodes[node_idx];
+		for (int j = 0; j < Node::ChildCount; ++j)
+			if (isInnerChild(node, j))
+				frontier.push_back(node.child[j]);
+		return;
+	}
+
+	uint32_t topLevels = levels / 2;
+	std::vector<n_UINT> middle;
+	orderVanEmdeBoas(nodes, node_idx, topLevels, order, middle);
+	for (n_UINT child : middle)
+		orderVanEmdeBoas(nodes, child, levels - topLevels, order, frontier);
+}
+
+template <typename Node> static void orderVanEmdeBoas(
+		const std::vector<Node> &nodes, std::vector<n_UINT> &order) {
+	/* Children are stored after their parent in the depth-first
+	   layout, so a backward pass finds the height of every subtree */
+	std::vector<uint32_t> height(nodes.size(), 1u);
+	for (size_t i = nodes.size(); i-- > 0; ) {
+		const Node &node = nodes[i];
+		for (int j = 0; j < Node::ChildCount; ++j)
+			if (isInnerChild(node, j))
+				height[i] = std::max(height[i], height[node.child[j]] + 1);
+	}
+
+	std::vector<n_UINT> frontier;
+	orderVanEmdeBoas(nodes, 0u, height[0], order, frontier);
+}
+
+/// Move the nodes into the given order and update the child indices
+template <typename Node> static void applyLayout(
+		std::vector<Node> &nodes, const std::vector<n_UINT> &order) {
+	if (order.size() != nodes.size())
+		throw NoriException("Accel::reorderNodes(): the layout does not contain every node!");
+
+	std::vector<n_UINT> remap(nodes.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		remap[order[i]] = (n_UINT) i;
+
+	std::vector<Node> result(nodes.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		Node &node = result[i];
+		node = nodes[order[i]];
+		for (int j = 0; j < Node::ChildCount; ++j)
+			if (isInnerChild(node, j))
+				node.child[j] = remap[node.child[j]];
+	}
+	nodes.swap(result);
+}
+
+template <typename Node> static void reorder(
+		std::vector<Node> &nodes, Accel::ENodeLayout layout) {
+	if (nodes.empty() || layout == Accel::EDepthFirst)
+		return;
+
+	std::vector<n_UINT> order;
+	order.reserve(nodes.size());
+	if (layout == Accel::EBreadthFirst)
+		orderBreadthFirst(nodes, order);
+	else if (layout == Accel::ETreelets)
+		orderTreelets(nodes, order);
+	else
+		orderVanEmdeBoas(nodes, order);
+	applyLayout(nodes, order);
+}
+
+void Accel::reorderNodes() {
+	/* The root stays at index 0 in every layout */
+	if (m_width == 4)
+		reorder(m_nodes4, m_layout);
+	else if (m_width == 8)
+		reorder(m_nodes8, m_layout);
+}
+
+NORI_NAMESPACE_END
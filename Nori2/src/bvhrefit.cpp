@@ -0,0 +1,256 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <nori/timer.h>
+#include <tbb/tbb.h>
+
+NORI_NAMESPACE_BEGIN
+
+void Accel::refit() {
+	Timer timer;
+
+	for (auto &blas : m_blas)
+		blas->refit();
+
+	for (const Mesh *mesh : m_meshes)
+		if (mesh->isPagedOut())
+			throw NoriException("Accel::refit(): the mesh \"%s\" has been paged out "
+				"(enable refit support to keep it in memory)", mesh->getName());
+
+	m_compressionSavings = 0;
+	if (m_nodes.empty() && hasNodes()) {
+		/* The binary nodes of the wide BVH were released after the build */
+		cout << "The BVH was built without refit support, rebuilding it." << endl;
+		m_bbox.reset();
+		for (const Mesh *mesh : m_meshes)
+			m_bbox.expandBy(mesh->getBoundingBox());
+		m_indices.clear();
+		m_packets.clear();
+		buildTree(false);
+		size_t before = nodeMemory();
+		if (m_compression)
+			compressNodes();
+		releaseBinaryNodes();
+		m_compressionSavings = before - nodeMemory();
+	} else if (!m_nodes.empty()) {
+		refitNodes();
+		m_bbox = m_nodes[0].bbox;
+
+		std::vector<float> costs;
+		computeCosts(costs);
+		float refitCost = costs[0];
+
+		/* Quality monitor: find the topmost subtrees whose SAH cost
+		   has grown by more than the threshold since they were built */
+		std::vector<n_UINT> roots;
+		bool fullRebuild = false;
+		if (m_rebuildThreshold > 0) {
+			float factor = 1 + m_rebuildThreshold;
+			if (costs[0] > factor * m_buildCosts[0]) {
+				fullRebuild = true;
+			} else {
+				/* Visit left children first to list the roots in depth-first order */
+				std::vector<n_UINT> stack(1, 0u);
+				while (!stack.empty()) {
+					n_UINT node_idx = stack.back();
+					stack.pop_back();
+					const BVHNode &node = m_nodes[node_idx];
+					if (node.isLeaf())
+						continue;
+					if (costs[node_idx] > factor * m_buildCosts[node_idx]) {
+						roots.push_back(node_idx);
+						continue;
+					}
+					stack.push_back(node.inner.rightChild);
+					stack.push_back(node_idx + 1);
+				}
+			}
+		}
+
+		if (fullRebuild) {
+			cout << "Refitted BVH has degraded (SAH cost = " << refitCost
+				<< ", was " << m_buildCosts[0] << "), rebuilding it." << endl;
+			m_nodes.clear();
+			m_indices.clear();
+			m_packets.clear();
+			buildTree(false);
+			computeCosts(m_buildCosts);
+		} else {
+			if (!roots.empty())
+				rebuildSubtrees(roots);
+			if (m_pageFile.empty())
+				buildTrianglePackets();
+			else
+				pageOutPackets();
+			collapseNodes();
+		}
+		size_t before = nodeMemory();
+		if (m_compression)
+			compressNodes();
+		m_compressionSavings = before - nodeMemory();
+
+		if (!fullRebuild) {
+			cout << "Refitted the BVH (took " << timer.elapsedString()
+				<< ", SAH cost = " << refitCost;
+			if (!roots.empty())
+				cout << ", rebuilt " << roots.size()
+					<< (roots.size() == 1 ? " subtree" : " subtrees");
+			cout << ")." << endl;
+		}
+	}
+
+	for (auto &blas : m_blas)
+		m_compressionSavings += blas->m_compressionSavings;
+	if (!m_topNodes.empty())
+		updateInstances();
+}
+
+void Accel::refitNodes() {
+	n_UINT count = (n_UINT) m_nodes.size();
+
+	/* Leaves first .. */
+	tbb::parallel_for(tbb::blocked_range<n_UINT>(0u, count, 1000u),
+		[&](const tbb::blocked_range<n_UINT> &range) {
+		for (n_UINT i = range.begin(); i != range.end(); ++i) {
+			BVHNode &node = m_nodes[i];
+			if (!node.isLeaf())
+				continue;
+			node.bbox.reset();
+			for (n_UINT j = node.start(); j < node.end(); ++j)
+				node.bbox.expandBy(getBoundingBox(m_indices[j]));
+		}
+	}
+	);
+
+	/* .. then the inner nodes. Children follow their parent
+	   in the node array, so a reverse sweep works bottom-up. */
+	for (n_UINT i = count; i-- > 0; ) {
+		BVHNode &node = m_nodes[i];
+		if (node.isInner())
+			node.bbox = BoundingBox3f::merge(m_nodes[i + 1].bbox,
+				m_nodes[node.inner.rightChild].bbox);
+	}
+}
+
+void Accel::rebuildSubtrees(const std::vector<n_UINT> &roots) {
+	struct Subtree {
+		n_UINT root, end;              ///< Range of the replaced nodes
+		std::vector<BVHNode> nodes;    ///< Rebuilt nodes
+		std::vector<n_UINT> indices;   ///< Packed indices of the rebuilt leaves
+	};
+	std::vector<Subtree> subtrees(roots.size());
+
+	for (size_t k = 0; k < roots.size(); ++k) {
+		Subtree &subtree = subtrees[k];
+		subtree.root = roots[k];
+
+		/* A subtree occupies a contiguous range of nodes that ends
+		   with its rightmost leaf */
+		n_UINT last = subtree.root;
+		while (m_nodes[last].isInner())
+			last = m_nodes[last].inner.rightChild;
+		subtree.end = last + 1;
+
+		/* Gather the triangles, dropping duplicate references
+		   created by spatial splits */
+		std::vector<n_UINT> prims;
+		for (n_UINT i = subtree.root; i < subtree.end; ++i) {
+			const BVHNode &node = m_nodes[i];
+			if (node.isLeaf())
+				prims.insert(prims.end(), m_indices.begin() + node.start(),
+					m_indices.begin() + node.end());
+		}
+		std::sort(prims.begin(), prims.end());
+		prims.erase(std::unique(prims.begin(), prims.end()), prims.end());
+
+		/* Run the binned builder on scratch arrays */
+		BoundingBox3f bbox = m_nodes[subtree.root].bbox;
+		m_nodes.swap(subtree.nodes);
+		m_indices.swap(prims);
+		buildBinned(bbox);
+		packLeaves();
+		m_nodes.swap(subtree.nodes);
+		m_indices.swap(prims);
+		subtree.indices = std::move(prims);
+	}
+
+	/* Re-emit the tree in depth-first order with the rebuilt subtrees
+	   substituted. Right children of copied inner nodes are remapped
+	   once all new positions are known. */
+	std::vector<BVHNode> nodes;
+	std::vector<n_UINT> indices;
+	std::vector<float> buildCosts;
+	std::vector<n_UINT> remap(m_nodes.size(), INVALID_INDEX);
+	std::vector<std::pair<n_UINT, n_UINT>> links; ///< New node index, old right child
+	nodes.reserve(m_nodes.size());
+	indices.reserve(m_indices.size());
+	buildCosts.reserve(m_nodes.size());
+
+	size_t k = 0;
+	for (n_UINT i = 0; i < (n_UINT) m_nodes.size(); ) {
+		remap[i] = (n_UINT) nodes.size();
+
+		if (k < subtrees.size() && subtrees[k].root == i) {
+			const Subtree &subtree = subtrees[k++];
+			n_UINT nodeOffset = (n_UINT) nodes.size(), indexOffset = (n_UINT) indices.size();
+			for (BVHNode node : subtree.nodes) {
+				if (node.isLeaf())
+					node.leaf.start += indexOffset;
+				else
+					node.inner.rightChild += nodeOffset;
+				nodes.push_back(node);
+				/* Filled in below */
+				buildCosts.push_back(std::numeric_limits<float>::quiet_NaN());
+			}
+			indices.insert(indices.end(), subtree.indices.begin(), subtree.indices.end());
+			i = subtree.end;
+			continue;
+		}
+
+		BVHNode node = m_nodes[i];
+		if (node.isLeaf()) {
+			n_UINT start = (n_UINT) indices.size();
+			indices.insert(indices.end(), m_indices.begin() + node.start(),
+				m_indices.begin() + node.start() + packetCount(node.leaf.size) * PACKET_SIZE);
+			node.leaf.start = start;
+		} else {
+			links.push_back(std::make_pair((n_UINT) nodes.size(), node.inner.rightChild));
+		}
+		nodes.push_back(node);
+		buildCosts.push_back(m_buildCosts[i]);
+		++i;
+	}
+
+	for (const auto &link : links)
+		nodes[link.first].inner.rightChild = remap[link.second];
+
+	m_nodes = std::move(nodes);
+	m_indices = std::move(indices);
+
+	/* The rebuilt nodes are the new reference for the quality monitor */
+	std::vector<float> costs;
+	computeCosts(costs);
+	for (size_t i = 0; i < costs.size(); ++i) {
+		if (std::isnan(buildCosts[i]))
+			buildCosts[i] = costs[i];
+	}
+	m_buildCosts = std::move(buildCosts);
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,202 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <tbb/enumerable_thread_specific.h>
+
+NORI_NAMESPACE_BEGIN
+
+#if defined(NORI_TRAVERSAL_STATS)
+/// Traversal work recorded by each thread
+static tbb::enumerable_thread_specific<TraversalSummary> traversalSummaries;
+#endif
+
+void TraversalSummary::add(const TraversalStats &query) {
+	rays++;
+	nodesVisited += query.nodesVisited;
+	nodesCulled += query.nodesCulled;
+	boxTests += query.boxTests;
+	triangleTests += query.triangleTests;
+	stackDepth += query.stackDepth;
+	maxNodesVisited = std::max(maxNodesVisited, query.nodesVisited);
+	maxTriangleTests = std::max(maxTriangleTests, query.triangleTests);
+	maxStackDepth = std::max(maxStackDepth, query.stackDepth);
+}
+
+void TraversalSummary::merge(const TraversalSummary &other) {
+	rays += other.rays;
+	nodesVisited += other.nodesVisited;
+	nodesCulled += other.nodesCulled;
+	boxTests += other.boxTests;
+	triangleTests += other.triangleTests;
+	stackDepth += other.stackDepth;
+	maxNodesVisited = std::max(maxNodesVisited, other.maxNodesVisited);
+	maxTriangleTests = std::max(maxTriangleTests, other.maxTriangleTests);
+	maxStackDepth = std::max(maxStackDepth, other.maxStackDepth);
+}
+
+std::string TraversalSummary::toJSON() const {
+	double n = (double) std::max(rays, (uint64_t) 1);
+	return tfm::format(
+		"{\n"
+		"  \"rays\": %d,\n"
+		"  \"nodesVisited\": { \"total\": %d, \"mean\": %.3f, \"max\": %d },\n"
+		"  \"nodesCulled\": { \"total\": %d, \"mean\": %.3f },\n"
+		"  \"boxTests\": { \"total\": %d, \"mean\": %.3f },\n"
+		"  \"triangleTests\": { \"total\": %d, \"mean\": %.3f, \"max\": %d },\n"
+		"  \"stackDepth\": { \"mean\": %.3f, \"max\": %d }\n"
+		"}",
+		rays,
+		nodesVisited, nodesVisited / n, maxNodesVisited,
+		nodesCulled, nodesCulled / n,
+		boxTests, boxTests / n,
+		triangleTests, triangleTests / n, maxTriangleTests,
+		stackDepth / n, maxStackDepth);
+}
+
+/// Format a histogram as a JSON array
+static std::string jsonArray(const std::vector<uint32_t> &values) {
+	std::string result = "[";
+	for (size_t i = 0; i < values.size(); ++i)
+		result += (i > 0 ? ", " : "") + std::to_string(values[i]);
+	return result + "]";
+}
+
+std::string BVHStatistics::toJSON() const {
+	return tfm::format(
+		"{\n"
+		"  \"innerNodes\": %d,\n"
+		"  \"leaves\": %d,\n"
+		"  \"sahCost\": %.4f,\n"
+		"  \"leafSizes\": %s,\n"
+		"  \"leafDepths\": %s,\n"
+		"  \"emptySpace\": %.4f,\n"
+		"  \"memory\": %d\n"
+		"}",
+		innerNodes, leaves, sahCost, jsonArray(leafSizes),
+		jsonArray(leafDepths), emptySpace, memory);
+}
+
+/// Increment a histogram bin, growing the histogram as needed
+static void increment(std::vector<uint32_t> &histogram, size_t bin) {
+	if (histogram.size() <= bin)
+		histogram.resize(bin + 1, 0);
+	histogram[bin]++;
+}
+
+/// Number of bytes used by the elements of a vector
+template <typename T> static size_t bytes(const std::vector<T> &v) {
+	return sizeof(T) * v.size();
+}
+
+/// Add the bins of one histogram to another
+static void accumulate(std::vector<uint32_t> &histogram, const std::vector<uint32_t> &other) {
+	if (histogram.size() < other.size())
+		histogram.resize(other.size(), 0);
+	for (size_t i = 0; i < other.size(); ++i)
+		histogram[i] += other[i];
+}
+
+void Accel::collectStatistics(BVHStatistics &stats) const {
+	stats.memory += bytes(m_nodes) + bytes(m_indices) + bytes(m_packets) +
+		bytes(m_nodes4) + bytes(m_nodes8) + bytes(m_qnodes4) + bytes(m_qnodes8) +
+		bytes(m_topNodes) + bytes(m_instances) + bytes(m_buildCosts);
+	if (!m_nodes.empty()) {
+		collectTreeStatistics(stats);
+	} else if (hasNodes()) {
+		/* The binary nodes were released after the build */
+		stats.innerNodes += m_treeStats.innerNodes;
+		stats.leaves += m_treeStats.leaves;
+		accumulate(stats.leafSizes, m_treeStats.leafSizes);
+		accumulate(stats.leafDepths, m_treeStats.leafDepths);
+		stats.emptySpace += m_treeStats.emptySpace;
+	}
+}
+
+void Accel::collectTreeStatistics(BVHStatistics &stats) const {
+	/* Depth-first walk with the depth of each pending node */
+	std::vector<std::pair<n_UINT, uint32_t>> stack;
+	stack.push_back(std::make_pair(0u, 0u));
+	while (!stack.empty()) {
+		n_UINT node_idx = stack.back().first;
+		uint32_t depth = stack.back().second;
+		stack.pop_back();
+
+		const BVHNode &node = m_nodes[node_idx];
+		if (node.isLeaf()) {
+			stats.leaves++;
+			increment(stats.leafSizes, node.leaf.size);
+			increment(stats.leafDepths, depth);
+			continue;
+		}
+
+		/* Fraction of the node that is left empty by its children (flat
+		   nodes and overlapping children count as fully covered) */
+		const BVHNode &left = m_nodes[node_idx + 1], &right = m_nodes[node.inner.rightChild];
+		float volume = node.bbox.getVolume();
+		if (volume > 0)
+			stats.emptySpace += std::max(0.0f, 1.0f -
+				(left.bbox.getVolume() + right.bbox.getVolume()) / volume);
+		stats.innerNodes++;
+
+		stack.push_back(std::make_pair(node.inner.rightChild, depth + 1));
+		stack.push_back(std::make_pair(node_idx + 1, depth + 1));
+	}
+}
+
+BVHStatistics Accel::getStatistics() const {
+	BVHStatistics stats;
+	if (!m_nodes.empty())
+		stats.sahCost = statistics().first;
+	else if (hasNodes())
+		stats.sahCost = m_treeStats.sahCost;
+
+	collectStatistics(stats);
+	for (const auto &blas : m_blas)
+		blas->collectStatistics(stats);
+
+	/* collectStatistics() sums up the empty space of all inner nodes */
+	if (stats.innerNodes > 0)
+		stats.emptySpace /= stats.innerNodes;
+	return stats;
+}
+
+void Accel::recordQuery(const TraversalStats &query) {
+#if defined(NORI_TRAVERSAL_STATS)
+	traversalSummaries.local().add(query);
+#else
+	(void) query;
+#endif
+}
+
+TraversalSummary Accel::getTraversalSummary() {
+	TraversalSummary result;
+#if defined(NORI_TRAVERSAL_STATS)
+	for (const TraversalSummary &summary : traversalSummaries)
+		result.merge(summary);
+#endif
+	return result;
+}
+
+void Accel::resetTraversalSummary() {
+#if defined(NORI_TRAVERSAL_STATS)
+	traversalSummaries.clear();
+#endif
+}
+
+NORI_NAMESPACE_END
@@ -170,6 +170,15 @@ std::string memString(size_t size, bool precise) {
     return os.str();
 }
 
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash) {
+    const uint8_t *ptr = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= ptr[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
 filesystem::resolver *getFileResolver() {
     static filesystem::resolver *resolver = new filesystem::resolver();
     return resolver;
@@ -13,18 +13,26 @@ public:
         Intersection its;
         
         // Verifica si el rayo intersecta con algún objeto en la escena
-        if (!scene->rayIntersect(ray, its)) {
+        if (!scene->rayIntersect(ray, its, false))
+            return Li(scene, sampler, ray, nullptr);
+        return Li(scene, sampler, ray, &its);
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, Intersection *its) const override {
+        if (!its) {
             // Si no hay intersección, retorna negro (sin profundidad)
             return Color3f(0.0f);
         }
 
         // Calcula la distancia desde el origen de la cámara hasta el punto de intersección
-        float depth = its.t;
+        float depth = its->t;
 
         // Para visualización, usaremos 1/d para que los objetos más cercanos sean más brillantes
         return Color3f(1.0f / depth);
     }
 
+    bool usesPrimaryHits() const override { return true; }
+
     std::string toString() const override {
         return "DepthIntegrator[]";
     }
@@ -65,8 +65,7 @@ public:
         /**
          * Verificar que el camino hacia la luz esté libre
          */
-        Ray3f shadowRay(its.p, lRec.wi, Epsilon, lRec.dist - Epsilon);
-        if (!scene->rayIntersect(shadowRay)) {
+        if (!scene->occluded(its.p, lRec.wi, lRec.dist)) {
             /**
              * Calcular BRDF, odescribe como la luz refleja una superficie opaca
              */
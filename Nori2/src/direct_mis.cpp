@@ -55,9 +55,7 @@ public:
                 return Le_em; 
             }
 
-            Ray3f shadowRay(its.p, lRec.wi);
-            Intersection its_light;
-            if (!scene->rayIntersect(shadowRay, its_light) || its_light.t >= (lRec.dist - Epsilon)) {
+            if (!scene->occluded(its.p, lRec.wi, lRec.dist)) {
                 // Compute the BSDF value
                 const BSDF *bsdf = its.mesh->getBSDF();
                 BSDFQueryRecord bsdfRec(its.toLocal(-ray.d), its.toLocal(lRec.wi), its.uv, ESolidAngle);
@@ -90,7 +88,8 @@ public:
             // Cast a shadow ray in the direction of the material sample
             Ray3f shadowRay(its.p, woWorld);
             Intersection lightIts;
-            if (scene->rayIntersect(shadowRay, lightIts) && lightIts.mesh->isEmitter()) {
+            bool hit = scene->rayIntersect(shadowRay, lightIts);
+            if (hit && lightIts.mesh->isEmitter()) {
                 const Emitter *lightEmitter = lightIts.mesh->getEmitter();
                 EmitterQueryRecord lRec(lightEmitter, its.p, lightIts.p, its.shFrame.n, lightIts.uv);
                 Color3f Le = lightEmitter->eval(lRec);
@@ -102,7 +101,7 @@ public:
                 float w_mat = pdf_mat / (pdf_mat + pdf_em);
                 Le_mat = w_mat * (Le * bsdfSample * cosTheta) / pdf_mat;
             }
-            else if (!scene->rayIntersect(shadowRay, lightIts) ){
+            else if (!hit) {
                 Le_mat = bsdfSample * scene->getBackground(shadowRay) ;
             }
         }
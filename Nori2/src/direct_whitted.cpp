@@ -39,8 +39,7 @@ public:
             // and compute the intersection
             
             // Crea un rayo de sombra y comprueba si la luz está bloqueada
-            Ray3f shadowRay(its.p, emitterRecord.wi, Epsilon, emitterRecord.dist - Epsilon);
-            if (scene->rayIntersect(shadowRay)) {
+            if (scene->occluded(its.p, emitterRecord.wi, emitterRecord.dist)) {
                 continue; // Si hay una intersección, el punto está en sombra
             }
             // Finally, we evaluate the BSDF. For that, we need to build
@@ -0,0 +1,163 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/film.h>
+#include <nori/bitmap.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+static const char *aovNames[EAOVCount] = { "direct", "indirect", "normal", "depth", "samples" };
+
+Film::Film(const Vector2i &size, const ReconstructionFilter *filter, uint32_t aovs, bool statistics)
+        : m_image(size, filter), m_aovMask(aovs), m_stride(size.x()) {
+    for (int i = 0; i < EAOVCount; ++i)
+        if ((aovs & (1u << i)) && i != EAOVSampleCount)
+            m_aovs[i].reset(new ImageBlock(size, filter));
+    if (statistics || (aovs & (1u << EAOVSampleCount)))
+        m_statistics.resize((size_t) size.x() * size.y());
+}
+
+void Film::setOffset(const Point2i &offset) {
+    m_image.setOffset(offset);
+    for (auto &aov : m_aovs)
+        if (aov)
+            aov->setOffset(offset);
+}
+
+void Film::setSize(const Vector2i &size) {
+    m_image.setSize(size);
+    for (auto &aov : m_aovs)
+        if (aov)
+            aov->setSize(size);
+}
+
+void Film::clear() {
+    m_image.clear();
+    for (auto &aov : m_aovs)
+        if (aov)
+            aov->clear();
+    std::fill(m_statistics.begin(), m_statistics.end(), PixelStatistics());
+}
+
+void Film::put(const Point2f &pos, const RadianceSample &sample) {
+    if (!sample.radiance.isValid()) {
+        /* If this happens, go fix your code instead of removing this warning ;) */
+        cerr << "Integrator: computed an invalid radiance value: " << sample.radiance.toString() << endl;
+        return;
+    }
+
+    /* All blocks share the offset and filter, so the weights are computed once */
+    ImageBlock::Footprint footprint = m_image.getFootprint(pos);
+    m_image.put(footprint, sample.radiance);
+    if (m_aovs[EAOVDirect])
+        m_aovs[EAOVDirect]->put(footprint, sample.direct);
+    if (m_aovs[EAOVIndirect])
+        m_aovs[EAOVIndirect]->put(footprint, sample.indirect);
+    if (m_aovs[EAOVNormal])
+        m_aovs[EAOVNormal]->put(footprint, Color3f(sample.normal.x(), sample.normal.y(), sample.normal.z()));
+    if (m_aovs[EAOVDepth])
+        m_aovs[EAOVDepth]->put(footprint, Color3f(sample.depth));
+
+    if (!m_statistics.empty()) {
+        Point2i pixel((int) std::floor(pos.x()) - getOffset().x(),
+                      (int) std::floor(pos.y()) - getOffset().y());
+        if (pixel.x() >= 0 && pixel.y() >= 0 && pixel.x() < getSize().x() && pixel.y() < getSize().y())
+            m_statistics[pixel.y() * m_stride + pixel.x()].put(sample.radiance.getLuminance());
+    }
+}
+
+void Film::put(Film &film) {
+    if (film.m_aovMask != m_aovMask || film.hasStatistics() != hasStatistics())
+        throw NoriException("Film::put(): the AOVs of the two films do not match!");
+
+    m_image.put(film.m_image);
+    for (int i = 0; i < EAOVCount; ++i)
+        if (m_aovs[i])
+            m_aovs[i]->put(*film.m_aovs[i]);
+
+    /* Each pixel belongs to a single block, so no locking is needed */
+    if (hasStatistics()) {
+        Vector2i offset = film.getOffset() - getOffset();
+        for (int y = 0; y < film.getSize().y(); ++y)
+            for (int x = 0; x < film.getSize().x(); ++x)
+                m_statistics[(y + offset.y()) * m_stride + x + offset.x()].put(
+                    film.m_statistics[y * film.m_stride + x]);
+    }
+}
+
+void Film::save(const std::string &name) const {
+    std::unique_ptr<Bitmap> bitmap(m_image.toBitmap());
+    bitmap->saveEXR(name);
+    bitmap->savePNG(name);
+
+    /* Prefix the file name (not the directory) with the name of the AOV */
+    size_t pos = name.find_last_of("/\\");
+    std::string directory = name.substr(0, pos + 1), base = name.substr(pos + 1);
+    for (int i = 0; i < EAOVCount; ++i) {
+        if (!(m_aovMask & (1u << i)))
+            continue;
+        std::string aovName = directory + aovNames[i] + "_" + base;
+        if (i == EAOVSampleCount) {
+            bitmap.reset(new Bitmap(getSize()));
+            for (int y = 0; y < getSize().y(); ++y)
+                for (int x = 0; x < getSize().x(); ++x)
+                    bitmap->coeffRef(y, x) = Color3f((float) m_statistics[y * m_stride + x].count);
+        } else {
+            bitmap.reset(m_aovs[i]->toBitmap());
+        }
+        bitmap->saveEXR(aovName);
+        /* Normals and depths do not survive tonemapping */
+        if (i == EAOVDirect || i == EAOVIndirect)
+            bitmap->savePNG(aovName);
+    }
+}
+
+uint32_t Film::parseAOVs(const std::string &names) {
+    uint32_t aovs = 0;
+    for (const std::string &name : tokenize(names)) {
+        if (name.empty())
+            continue;
+        int i = 0;
+        while (i < EAOVCount && toLower(name) != aovNames[i])
+            ++i;
+        if (i == EAOVCount)
+            throw NoriException("Film: unknown AOV \"%s\"", name);
+        aovs |= 1u << i;
+    }
+    return aovs;
+}
+
+const char *Film::getAOVName(EAOV aov) {
+    return aovNames[aov];
+}
+
+std::string Film::toString() const {
+    std::string aovs;
+    for (int i = 0; i < EAOVCount; ++i) {
+        if (!(m_aovMask & (1u << i)))
+            continue;
+        if (!aovs.empty())
+            aovs += ", ";
+        aovs += aovNames[i];
+    }
+    return tfm::format("Film[offset=%s, size=%s, aovs={%s}]",
+        getOffset().toString(), getSize().toString(), aovs);
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,102 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/sampler.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Visualizes the BVH traversal cost of each pixel
+ *
+ * Counts the ray-box tests, ray-triangle tests or entered nodes of the
+ * camera ray (and optionally of a shadow ray towards a sampled emitter)
+ * and maps the count to a false colour ramp that runs from dark blue
+ * (no work) over cyan, green and yellow to red at \c maxCount. Counts
+ * beyond \c maxCount are shown in white.
+ */
+class HeatMapIntegrator : public Integrator {
+public:
+    HeatMapIntegrator(const PropertyList &props) {
+        std::string metric = props.getString("metric", "boxes");
+        if (metric == "boxes")
+            m_metric = EBoxTests;
+        else if (metric == "triangles")
+            m_metric = ETriangleTests;
+        else if (metric == "nodes")
+            m_metric = ENodesVisited;
+        else
+            throw NoriException("HeatMapIntegrator: unknown metric \"%s\"", metric);
+
+        /* Count that is mapped to the end of the colour ramp */
+        m_maxCount = props.getFloat("maxCount", 200.0f);
+        if (m_maxCount <= 0)
+            throw NoriException("HeatMapIntegrator: maxCount must be positive");
+
+        /* Also count the work of a shadow ray from the first hit */
+        m_shadowRays = props.getBoolean("shadowRays", false);
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        const Accel *accel = scene->getAccel();
+        TraversalStats stats;
+        Intersection its;
+
+        if (accel->rayIntersect(ray, its, false, &stats) && m_shadowRays
+                && !scene->getLights().empty()) {
+            float pdf;
+            const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdf);
+            its.computeSurfaceData();
+            EmitterQueryRecord lRec(its.p);
+            emitter->sample(lRec, sampler->next2D(), 0.0f);
+            if (lRec.pdf > 0)
+                accel->rayOccluded(Ray3f(its.p, lRec.wi, Epsilon, lRec.dist - Epsilon), &stats);
+        }
+
+        uint32_t count = m_metric == EBoxTests ? stats.boxTests :
+            (m_metric == ETriangleTests ? stats.triangleTests : stats.nodesVisited);
+        return falseColor(count / m_maxCount);
+    }
+
+    std::string toString() const {
+        const char *metrics[] = { "boxes", "triangles", "nodes" };
+        return tfm::format(
+            "HeatMapIntegrator[\n"
+            "  metric = %s,\n"
+            "  maxCount = %f,\n"
+            "  shadowRays = %s\n"
+            "]",
+            metrics[m_metric], m_maxCount, m_shadowRays ? "true" : "false");
+    }
+
+protected:
+    enum EMetric {
+        EBoxTests = 0,
+        ETriangleTests,
+        ENodesVisited
+    };
+
+    /// Map a value in [0, 1] to the colour ramp
+    static Color3f falseColor(float value) {
+        static const Color3f ramp[] = {
+            Color3f(0.0f, 0.0f, 0.5f), Color3f(0.0f, 0.5f, 1.0f),
+            Color3f(0.0f, 1.0f, 0.5f), Color3f(1.0f, 1.0f, 0.0f),
+            Color3f(1.0f, 0.0f, 0.0f)
+        };
+        const int segments = sizeof(ramp) / sizeof(ramp[0]) - 1;
+        if (value > 1.0f)
+            return Color3f(1.0f);
+
+        float x = std::max(value, 0.0f) * segments;
+        int i = std::min((int) x, segments - 1);
+        float t = x - i;
+        return ramp[i] * (1.0f - t) + ramp[i + 1] * t;
+    }
+
+private:
+    EMetric m_metric;
+    float m_maxCount;
+    bool m_shadowRays;
+};
+
+NORI_REGISTER_CLASS(HeatMapIntegrator, "heatmap");
+NORI_NAMESPACE_END
@@ -48,10 +48,12 @@ public:
         return std::move(cloned);
     }
 
-    void prepare(const ImageBlock &block) {
+    void prepare(const ImageBlock &block, uint32_t pass) {
+        /* Each pass uses a different stream (the first one the same as
+           a non-progressive render) */
         m_random.seed(
             block.getOffset().x() + m_seed,
-            block.getOffset().y() + m_seed
+            block.getOffset().y() + m_seed + ((uint64_t) pass << 32)
         );
     }
 
@@ -0,0 +1,37 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/instance.h>
+
+NORI_NAMESPACE_BEGIN
+
+MeshInstance::MeshInstance(const PropertyList &propList) {
+    m_toWorld = propList.getTransform("toWorld", Transform());
+}
+
+std::string MeshInstance::toString() const {
+    return tfm::format(
+        "MeshInstance[\n"
+        "  toWorld = %s\n"
+        "]",
+        indent(m_toWorld.toString(), 12)
+    );
+}
+
+NORI_REGISTER_CLASS(MeshInstance, "instance");
+NORI_NAMESPACE_END
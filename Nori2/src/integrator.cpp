@@ -0,0 +1,82 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+
+NORI_NAMESPACE_BEGIN
+
+void RadianceSample::setPrimaryHit(const Intersection &its, uint32_t aovs) {
+    if (aovs & (1u << EAOVDepth))
+        depth = its.t;
+    if (aovs & (1u << EAOVNormal)) {
+        /* The hit record passed to shade() may or may not have been
+           completed, so derive the frame from a copy */
+        Intersection full(its);
+        full.computeSurfaceData();
+        normal = full.shFrame.n;
+    }
+}
+
+void Integrator::sample(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                        uint32_t aovs, RadianceSample &result) const {
+    result = RadianceSample();
+    result.setRadiance(Li(scene, sampler, ray));
+
+    Intersection its;
+    if ((aovs & ((1u << EAOVNormal) | (1u << EAOVDepth))) && scene->rayIntersect(ray, its, false))
+        result.setPrimaryHit(its, aovs);
+}
+
+void Integrator::sample(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                        Intersection *its, uint32_t aovs, RadianceSample &result) const {
+    result = RadianceSample();
+    if (its)
+        result.setPrimaryHit(*its, aovs);
+    result.setRadiance(Li(scene, sampler, ray, its));
+}
+
+Color3f Integrator::tracePath(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+    PathState state(ray);
+    Intersection its;
+    while (true) {
+        bool found = scene->rayIntersect(state.ray, its, false);
+        if (!shade(scene, sampler, state, found ? &its : nullptr))
+            break;
+    }
+    return state.radiance;
+}
+
+void Integrator::tracePath(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                           uint32_t aovs, RadianceSample &result) const {
+    result = RadianceSample();
+    PathState state(ray);
+    Intersection its;
+    while (true) {
+        bool found = scene->rayIntersect(state.ray, its, false);
+        if (state.depth == 0 && found)
+            result.setPrimaryHit(its, aovs);
+        if (!shade(scene, sampler, state, found ? &its : nullptr))
+            break;
+    }
+    result.radiance = state.radiance;
+    result.direct = state.direct;
+    result.indirect = state.radiance - state.direct;
+}
+
+NORI_NAMESPACE_END
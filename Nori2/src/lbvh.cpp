@@ -0,0 +1,367 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/lbvh.h>
+#include <tbb/tbb.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Build-related parameters
+enum {
+	/// Number of bits per axis of a Morton code
+	MORTON_BITS = 10,
+
+	/// Number of bits sorted by each pass of the radix sort
+	RADIX_BITS = 10,
+
+	/// Number of buckets of each radix sort pass
+	RADIX_BUCKETS = 1 << RADIX_BITS,
+
+	/// Number of primitives handled by one radix sort block
+	RADIX_BLOCK_SIZE = 1 << 16,
+
+	/// Emit and optimize the two children of a node in parallel above this many triangles
+	PARALLEL_THRESHOLD = 4096,
+
+	/// Process triangles in batches of 1K for the purpose of parallelization
+	GRAIN_SIZE = 1000,
+
+	/// Maximum number of leaves of a restructured treelet
+	TREELET_SIZE = 7
+};
+
+const uint32_t LBVHBuilder::INVALID_NODE;
+
+/// Insert two zero bits in front of each of the lower 10 bits of \c x
+static uint32_t expandBits(uint32_t x) {
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+LBVHBuilder::LBVHBuilder(Accel &bvh, bool optimize)
+	: m_bvh(bvh), m_optimize(optimize), m_nodeCount(0) { }
+
+void LBVHBuilder::build() {
+	n_UINT size = m_bvh.getTriangleCount();
+
+	/* Quantize the centroids relative to their bounding box */
+	BoundingBox3f centroids = tbb::parallel_reduce(
+		tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
+		BoundingBox3f(),
+		[&](const tbb::blocked_range<n_UINT> &range, BoundingBox3f result) {
+			for (n_UINT i = range.begin(); i != range.end(); ++i)
+				result.expandBy(m_bvh.getCentroid(i));
+			return result;
+		},
+		[](const BoundingBox3f &b1, const BoundingBox3f &b2) {
+			return BoundingBox3f::merge(b1, b2);
+		}
+	);
+
+	Vector3f extents = centroids.getExtents(), scale;
+	for (int i = 0; i < 3; ++i)
+		scale[i] = extents[i] > 0 ? (1 << MORTON_BITS) / extents[i] : 0.0f;
+
+	m_prims.resize(size);
+	tbb::parallel_for(
+		tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
+		[&](const tbb::blocked_range<n_UINT> &range) {
+			for (n_UINT i = range.begin(); i != range.end(); ++i) {
+				Vector3f p = (m_bvh.getCentroid(i) - centroids.min).cwiseProduct(scale);
+				uint32_t code = 0;
+				for (int j = 0; j < 3; ++j) {
+					uint32_t q = (uint32_t) std::min(std::max(p[j], 0.0f),
+						(float) ((1 << MORTON_BITS) - 1));
+					code |= expandBits(q) << (2 - j);
+				}
+				m_prims[i].code = code;
+				m_prims[i].prim = i;
+			}
+		}
+	);
+
+	radixSort();
+
+	/* Every leaf holds at least one triangle */
+	m_nodes.resize(2 * (size_t) size);
+	m_nodeCount = 0;
+	uint32_t root = emit(0, size, 3 * MORTON_BITS - 1);
+
+	if (m_optimize)
+		optimize(root);
+
+	m_bvh.m_nodes.clear();
+	m_bvh.m_indices.clear();
+	m_bvh.m_nodes.reserve(m_nodeCount);
+	m_bvh.m_indices.reserve(size);
+	flatten(root);
+}
+
+void LBVHBuilder::radixSort() {
+	n_UINT size = (n_UINT) m_prims.size();
+	n_UINT blocks = (size + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE;
+	std::vector<MortonPrimitive> temp(size);
+	std::vector<n_UINT> offsets(blocks * RADIX_BUCKETS);
+
+	for (int shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS) {
+		/* Count the digits within each block */
+		tbb::parallel_for(0u, blocks, [&](n_UINT block) {
+			n_UINT *counts = &offsets[block * RADIX_BUCKETS];
+			std::fill(counts, counts + RADIX_BUCKETS, 0u);
+			n_UINT end = std::min(size, (block + 1) * RADIX_BLOCK_SIZE);
+			for (n_UINT i = block * RADIX_BLOCK_SIZE; i < end; ++i)
+				counts[(m_prims[i].code >> shift) & (RADIX_BUCKETS - 1)]++;
+		});
+
+		/* Turn the counts into output positions (digit-major, so that
+		   the sort remains stable across blocks) */
+		n_UINT offset = 0;
+		for (n_UINT digit = 0; digit < RADIX_BUCKETS; ++digit) {
+			for (n_UINT block = 0; block < blocks; ++block) {
+				n_UINT count = offsets[block * RADIX_BUCKETS + digit];
+				offsets[block * RADIX_BUCKETS + digit] = offset;
+				offset += count;
+			}
+		}
+
+		/* Scatter */
+		tbb::parallel_for(0u, blocks, [&](n_UINT block) {
+			n_UINT *positions = &offsets[block * RADIX_BUCKETS];
+			n_UINT end = std::min(size, (block + 1) * RADIX_BLOCK_SIZE);
+			for (n_UINT i = block * RADIX_BLOCK_SIZE; i < end; ++i)
+				temp[positions[(m_prims[i].code >> shift) & (RADIX_BUCKETS - 1)]++] = m_prims[i];
+		});
+
+		m_prims.swap(temp);
+	}
+}
+
+uint32_t LBVHBuilder::emit(n_UINT start, n_UINT end, int bit) {
+	uint32_t node_idx = m_nodeCount++;
+	Node &node = m_nodes[node_idx];
+	n_UINT size = end - start;
+
+	if (size <= Accel::PACKET_SIZE) {
+		node.bbox.reset();
+		for (n_UINT i = start; i < end; ++i)
+			node.bbox.expandBy(m_bvh.getBoundingBox(m_prims[i].prim));
+		node.left = node.right = INVALID_NODE;
+		node.start = start;
+		node.size = size;
+		node.cost = (float) Accel::INTERSECTION_COST * Accel::packetCount(size)
+			* node.bbox.getSurfaceArea();
+		return node_idx;
+	}
+
+	/* Find the highest bit in which the codes of the range differ. All
+	   codes with that bit set follow those where it is not set. */
+	uint32_t first = m_prims[start].code, last = m_prims[end - 1].code;
+	while (bit >= 0 && ((first ^ last) & (1u << bit)) == 0)
+		--bit;
+
+	n_UINT split;
+	if (bit < 0) {
+		/* Identical codes: split the range in the middle */
+		split = start + size / 2;
+	} else {
+		uint32_t mask = 1u << bit;
+		split = (n_UINT) (std::partition_point(m_prims.begin() + start,
+			m_prims.begin() + end, [mask](const MortonPrimitive &p) {
+				return (p.code & mask) == 0;
+			}) - m_prims.begin());
+	}
+
+	uint32_t left, right;
+	if (size > PARALLEL_THRESHOLD) {
+		tbb::parallel_invoke(
+			[&] { left = emit(start, split, bit - 1); },
+			[&] { right = emit(split, end, bit - 1); }
+		);
+	} else {
+		left = emit(start, split, bit - 1);
+		right = emit(split, end, bit - 1);
+	}
+
+	node.left = left;
+	node.right = right;
+	node.size = size;
+	node.bbox = BoundingBox3f::merge(m_nodes[left].bbox, m_nodes[right].bbox);
+	node.cost = 2.0f * Accel::TRAVERSAL_COST * node.bbox.getSurfaceArea()
+		+ m_nodes[left].cost + m_nodes[right].cost;
+	return node_idx;
+}
+
+void LBVHBuilder::optimize(uint32_t node_idx) {
+	const Node &node = m_nodes[node_idx];
+	if (node.isLeaf())
+		return;
+
+	if (node.size > PARALLEL_THRESHOLD) {
+		tbb::parallel_invoke(
+			[&] { optimize(node.left); },
+			[&] { optimize(node.right); }
+		);
+	} else {
+		optimize(node.left);
+		optimize(node.right);
+	}
+
+	optimizeTreelet(node_idx);
+}
+
+void LBVHBuilder::optimizeTreelet(uint32_t node_idx) {
+	Node &root = m_nodes[node_idx];
+
+	/* Grow the treelet by repeatedly expanding the leaf with the
+	   largest surface area. Its inner nodes are reused below. */
+	uint32_t leaves[TREELET_SIZE], inner[TREELET_SIZE - 2];
+	int leafCount = 2, innerCount = 0;
+	leaves[0] = root.left;
+	leaves[1] = root.right;
+
+	while (leafCount < TREELET_SIZE) {
+		int largest = -1;
+		float largestArea = -1;
+		for (int i = 0; i < leafCount; ++i) {
+			const Node &node = m_nodes[leaves[i]];
+			if (!node.isLeaf() && node.bbox.getSurfaceArea() > largestArea) {
+				largest = i;
+				largestArea = node.bbox.getSurfaceArea();
+			}
+		}
+		if (largest < 0)
+			break;
+
+		const Node &node = m_nodes[leaves[largest]];
+		inner[innerCount++] = leaves[largest];
+		leaves[largest] = node.left;
+		leaves[leafCount++] = node.right;
+	}
+
+	/* Two leaves can only be arranged in one way */
+	if (leafCount < 3)
+		return;
+
+	/* Dynamic programming over all subsets of the treelet leaves. Subsets
+	   of a set have smaller bit masks, so they are always computed first. */
+	const uint32_t full = (1u << leafCount) - 1;
+	BoundingBox3f bounds[1 << TREELET_SIZE];
+	float cost[1 << TREELET_SIZE];
+	n_UINT sizes[1 << TREELET_SIZE];
+	uint32_t partition[1 << TREELET_SIZE];
+
+	for (uint32_t set = 1; set <= full; ++set) {
+		uint32_t lowest = set & (~set + 1), rest = set ^ lowest;
+		if (rest == 0) {
+			const Node &node = m_nodes[leaves[lowestBit(set)]];
+			bounds[set] = node.bbox;
+			cost[set] = node.cost;
+			sizes[set] = node.size;
+			continue;
+		}
+		bounds[set] = BoundingBox3f::merge(bounds[lowest], bounds[rest]);
+		sizes[set] = sizes[lowest] + sizes[rest];
+
+		/* Visit each partition once by keeping the lowest leaf on the left */
+		float best = std::numeric_limits<float>::infinity();
+		for (uint32_t left = (set - 1) & set; left != 0; left = (left - 1) & set) {
+			if ((left & lowest) == 0)
+				continue;
+			float c = cost[left] + cost[set ^ left];
+			if (c < best) {
+				best = c;
+				partition[set] = left;
+			}
+		}
+		cost[set] = 2.0f * Accel::TRAVERSAL_COST * bounds[set].getSurfaceArea() + best;
+	}
+
+	/* Only restructure when this is a strict improvement */
+	if (!(cost[full] < root.cost * (1 - 1e-5f)))
+		return;
+
+	struct Entry {
+		uint32_t node_idx, set;
+	} stack[TREELET_SIZE];
+	int stack_idx = 0, next = 0;
+	stack[stack_idx++] = { node_idx, full };
+
+	while (stack_idx > 0) {
+		Entry entry = stack[--stack_idx];
+		uint32_t sets[2] = { partition[entry.set], entry.set ^ partition[entry.set] };
+		uint32_t children[2];
+
+		for (int i = 0; i < 2; ++i) {
+			if ((sets[i] & (sets[i] - 1)) == 0) {
+				children[i] = leaves[lowestBit(sets[i])];
+			} else {
+				children[i] = inner[next++];
+				stack[stack_idx++] = { children[i], sets[i] };
+			}
+		}
+
+		Node &node = m_nodes[entry.node_idx];
+		node.left = children[0];
+		node.right = children[1];
+		node.bbox = bounds[entry.set];
+		node.size = sizes[entry.set];
+		node.cost = cost[entry.set];
+	}
+}
+
+n_UINT LBVHBuilder::flatten(uint32_t node_idx) {
+	const Node &node = m_nodes[node_idx];
+	std::vector<Accel::BVHNode> &nodes = m_bvh.m_nodes;
+	n_UINT result_idx = (n_UINT) nodes.size();
+
+	Accel::BVHNode result;
+	memset(&result, 0, sizeof(Accel::BVHNode));
+	result.bbox = node.bbox;
+
+	if (node.isLeaf()) {
+		result.leaf.flag = 1;
+		result.leaf.size = (uint32_t) node.size;
+		result.leaf.start = (n_UINT) m_bvh.m_indices.size();
+		for (n_UINT i = node.start; i < node.start + node.size; ++i)
+			m_bvh.m_indices.push_back(m_prims[i].prim);
+		nodes.push_back(result);
+	} else {
+		/* Traversal visits the left child first when the ray direction
+		   along the split axis is positive, so order the children along
+		   the axis that separates them best */
+		uint32_t left = node.left, right = node.right;
+		Vector3f delta = m_nodes[right].bbox.getCenter() - m_nodes[left].bbox.getCenter();
+		int axis;
+		delta.cwiseAbs().maxCoeff(&axis);
+		if (delta[axis] < 0)
+			std::swap(left, right);
+
+		result.inner.flag = 0;
+		result.inner.axis = (uint32_t) axis;
+		nodes.push_back(result);
+		flatten(left);
+		n_UINT right_idx = flatten(right);
+		nodes[result_idx].inner.rightChild = right_idx;
+	}
+	return result_idx;
+}
+
+NORI_NAMESPACE_END
@@ -20,22 +20,34 @@
 #include <nori/scene.h>
 #include <nori/camera.h>
 #include <nori/block.h>
+#include <nori/film.h>
+#include <nori/adaptive.h>
 #include <nori/timer.h>
 #include <nori/bitmap.h>
 #include <nori/sampler.h>
 #include <nori/integrator.h>
 #include <nori/gui.h>
+#include <nori/pathbatch.h>
 #include <tbb/parallel_for.h>
-#include <tbb/blocked_range.h>
-#include <tbb/task_scheduler_init.h>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
 #include <filesystem/resolver.h>
+#include <chrono>
 #include <thread>
+#include <mutex>
+#include <fstream>
 
 using namespace nori;
 
 static int threadCount = -1;
+static float timeBudget = 0;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block, ImageBlock &blockDirect, ImageBlock &blockIndirect) {
+/// Number of samples of a pixel in the current pass (planned per pixel with adaptive sampling)
+static uint32_t getPixelSampleCount(const AdaptiveSampling *adaptive, uint32_t sampleCount, int x, int y) {
+    return adaptive ? adaptive->getSampleCount(Point2i(x, y)) : sampleCount;
+}
+
+static void renderBlock(const Scene *scene, Sampler *sampler, Film &block, uint32_t sampleCount, const AdaptiveSampling *adaptive) {
     const Camera *camera = scene->getCamera();
     const Integrator *integrator = scene->getIntegrator();
 
@@ -48,26 +60,180 @@ static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
     /* For each pixel and pixel sample sample */
     for (int y=0; y<size.y(); ++y) {
         for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
+            uint32_t count = getPixelSampleCount(adaptive, sampleCount, x + offset.x(), y + offset.y());
+            for (uint32_t i=0; i<count; ++i) {
                 Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
                 Point2f apertureSample = sampler->next2D();
 
                 /* Sample a ray from the camera */
                 Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+                Color3f weight = camera->sampleRay(ray, pixelSample, apertureSample);
                 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
-                Color3f direct, indirect;
-                integrator->LiSeparated(scene, sampler, ray, direct, indirect);
+                /* Compute the incident radiance and the AOVs */
+                RadianceSample sample;
+                integrator->sample(scene, sampler, ray, block.getAOVs(), sample);
+                sample *= weight;
 
                 /* Store in the image block */
-                block.put(pixelSample, value);
-                blockDirect.put(pixelSample, direct);
-                blockIndirect.put(pixelSample, indirect);
+                block.put(pixelSample, sample);
+            }
+        }
+    }
+}
+
+/**
+ * Variant of renderBlock() for integrators that accept precomputed camera
+ * ray intersections: the camera rays of the block are traced through the
+ * BVH in packets, and each ray is shaded once its packet has been traced.
+ */
+static void renderBlockPackets(const Scene *scene, Sampler *sampler, Film &block, uint32_t sampleCount, const AdaptiveSampling *adaptive) {
+    typedef RayPacket<2 * NORI_SIMD_WIDTH> Packet;
+    const int packetSize = 2 * NORI_SIMD_WIDTH;
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+
+    /* Clear the block contents */
+    block.clear();
+
+    Packet packet;
+    Ray3f rays[packetSize];
+    Point2f pixelSamples[packetSize];
+    Color3f weights[packetSize];
+    int count = 0;
+
+    /* Trace the pending camera rays and shade them */
+    auto flush = [&]() {
+        scene->rayIntersect(packet);
+        for (int i = 0; i < count; ++i) {
+            Intersection its;
+            bool hit = packet.getIntersection(i, its);
+            RadianceSample sample;
+            integrator->sample(scene, sampler, rays[i], hit ? &its : nullptr, block.getAOVs(), sample);
+            sample *= weights[i];
+
+            /* Store in the image block */
+            block.put(pixelSamples[i], sample);
+        }
+        packet.active = 0;
+        count = 0;
+    };
+
+    /* For each pixel and pixel sample sample */
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            uint32_t pixelCount = getPixelSampleCount(adaptive, sampleCount, x + offset.x(), y + offset.y());
+            for (uint32_t i=0; i<pixelCount; ++i) {
+                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                /* Sample a ray from the camera */
+                weights[count] = camera->sampleRay(rays[count], pixelSample, apertureSample);
+                pixelSamples[count] = pixelSample;
+                packet.setRay(count, rays[count]);
+                if (++count == packetSize)
+                    flush();
             }
         }
     }
+
+    if (count > 0)
+        flush();
+}
+
+/**
+ * Variant of renderBlock() for integrators that trace their paths in
+ * batches: for each sample index, the paths of all pixels of the block
+ * (that take this many samples) are advanced bounce by bounce with a
+ * PathBatch.
+ */
+static void renderBlockBatched(const Scene *scene, Sampler *sampler, Film &block, uint32_t sampleCount,
+                               const AdaptiveSampling *adaptive, PathBatch &batch) {
+    const Camera *camera = scene->getCamera();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+
+    /* Clear the block contents */
+    block.clear();
+
+    std::vector<Point2f> pixelSamples(size.x() * size.y());
+    std::vector<Color3f> weights(size.x() * size.y());
+    std::vector<Ray3f> rays(size.x() * size.y());
+
+    uint32_t maxCount = adaptive ? adaptive->getMaxSampleCount(offset, size) : sampleCount;
+    for (uint32_t i=0; i<maxCount; ++i) {
+        /* Sample a camera ray for each pixel */
+        batch.clear();
+        for (int y=0; y<size.y(); ++y) {
+            for (int x=0; x<size.x(); ++x) {
+                if (getPixelSampleCount(adaptive, sampleCount, x + offset.x(), y + offset.y()) <= i)
+                    continue;
+                size_t idx = batch.size();
+                pixelSamples[idx] = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+                weights[idx] = camera->sampleRay(rays[idx], pixelSamples[idx], apertureSample);
+                batch.add(rays[idx]);
+            }
+        }
+
+        /* Trace all paths together */
+        batch.trace(scene, sampler, block.getAOVs());
+
+        /* Store in the image block */
+        for (size_t idx = 0; idx < batch.size(); ++idx) {
+            RadianceSample sample = batch.getSample(idx);
+            sample *= weights[idx];
+            block.put(pixelSamples[idx], sample);
+        }
+    }
+}
+
+/// Write the BVH and traversal statistics of a render as JSON (for regression tracking)
+static void writeStatistics(const Scene *scene, const std::string &filename, double renderTime, double samplesPerPixel) {
+    std::ofstream os(filename);
+    if (os.fail()) {
+        cerr << "Warning: unable to write the statistics \"" << filename << "\"" << endl;
+        return;
+    }
+
+    os << "{\n"
+       << "  \"renderTime\": " << renderTime << ",\n"
+       << "  \"samplesPerPixel\": " << samplesPerPixel << ",\n"
+       << "  \"bvh\": " << indent(scene->getAccel()->getStatistics().toJSON(), 2);
+#if defined(NORI_TRAVERSAL_STATS)
+    os << ",\n  \"traversal\": " << indent(Accel::getTraversalSummary().toJSON(), 2);
+#endif
+    os << "\n}\n";
+}
+
+/**
+ * Estimate the relative error of a progressive render. \c oddPasses holds
+ * the passes with odd index, i.e. half of the samples: the difference
+ * between the images of the even and the odd passes is then about twice
+ * the standard deviation of the full image. Returns the RMS relative
+ * error over all pixels.
+ */
+static float estimateRelativeError(const ImageBlock &image, const ImageBlock &oddPasses) {
+    int border = image.getBorderSize();
+    Vector2i size = image.getSize();
+    double sum = 0;
+    for (int y = border; y < size.y() + border; ++y) {
+        for (int x = border; x < size.x() + border; ++x) {
+            const Color4f &all = image(y, x), &odd = oddPasses(y, x);
+            Color4f even = all - odd;
+            if (even.w() <= 0 || odd.w() <= 0)
+                continue;
+            float e = even.divideByFilterWeight().getLuminance(),
+                  o = odd.divideByFilterWeight().getLuminance();
+            /* The offset keeps dark pixels from dominating */
+            float error = std::abs(e - o) / (e + o + 1e-2f);
+            sum += error * error;
+        }
+    }
+    return (float) std::sqrt(sum / std::max(size.x() * size.y(), 1));
 }
 
 static void render(Scene* scene, const std::string& filename, bool nogui) {
@@ -75,78 +241,224 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
     Vector2i outputSize = camera->getOutputSize();
     scene->getIntegrator()->preprocess(scene);
 
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    /* Determine the filename of the output bitmap */
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+
+    /* A render is done in one pass, unless it is progressive (a time
+       budget given on the command line implies a progressive render) */
+    ProgressiveSettings progressive = scene->getProgressiveSettings();
+    if (timeBudget > 0) {
+        progressive.enabled = true;
+        progressive.timeBudget = timeBudget;
+    }
+    uint32_t sampleCount = (uint32_t) scene->getSampler()->getSampleCount();
+    uint32_t passSampleCount = progressive.enabled ?
+        std::min(progressive.passSampleCount, sampleCount) : sampleCount;
+    uint64_t pixelCount = (uint64_t) outputSize.x() * outputSize.y();
+    uint64_t sampleBudget = sampleCount * pixelCount;
+
+    /* Without a previous pass to order the blocks by, a single-pass
+       render first takes one sample per pixel to measure their cost
+       (the samples are kept) */
+    SchedulingSettings scheduling = scene->getSchedulingSettings();
+    bool costPass = scheduling.costOrder && !progressive.enabled && sampleCount > 1;
 
     /* Allocate memory for the entire output image and clear it */
-    ImageBlock result(outputSize, camera->getReconstructionFilter());
-    ImageBlock resultDirect(outputSize, camera->getReconstructionFilter());
-    ImageBlock resultIndirect(outputSize, camera->getReconstructionFilter());
+    Film result(outputSize, camera->getReconstructionFilter(), scene->getAOVs(), progressive.adaptive);
     result.clear();
-    resultDirect.clear();
-    resultIndirect.clear();
+
+    /* Per-pixel sample counts of each pass */
+    std::unique_ptr<AdaptiveSampling> adaptive;
+    if (progressive.adaptive)
+        adaptive.reset(new AdaptiveSampling(outputSize, progressive.adaptiveThreshold,
+            std::min(progressive.adaptiveMinSampleCount, sampleCount), 4 * passSampleCount));
+
+    /* Passes with odd index, to estimate the noise level (adaptive
+       sampling estimates it from the pixel statistics instead) */
+    std::unique_ptr<ImageBlock> oddPasses;
+    if (progressive.enabled && progressive.noiseThreshold > 0 && !adaptive) {
+        oddPasses.reset(new ImageBlock(outputSize, camera->getReconstructionFilter()));
+        oddPasses->clear();
+    }
 
     /* Create a window that visualizes the partially rendered result */
     NoriScreen* screen = 0;
     if (!nogui)
     {
         nanogui::init();
-        screen = new NoriScreen(result);
+        screen = new NoriScreen(result.getImage());
     }
 
     /* Do the following in parallel and asynchronously */
+    double renderTime = 0;
+    uint64_t samplesTaken = 0;
     std::thread render_thread([&] {
-        tbb::task_scheduler_init init(threadCount);
-
         cout << "Rendering .. ";
         cout.flush();
         Timer timer;
 
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+        const Integrator *integrator = scene->getIntegrator();
+        PathBatchStats batchStats;
+        std::mutex batchStatsMutex;
 
-        auto map = [&](const tbb::blocked_range<int>& range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
-            ImageBlock blockDirect(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
-            ImageBlock blockIndirect(Vector2i(NORI_BLOCK_SIZE),camera->getReconstructionFilter());
+        Accel::resetTraversalSummary();
 
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
-
-            for (int i = range.begin(); i < range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
-                
-                blockDirect.setOffset(block.getOffset());
-                blockDirect.setSize(block.getSize());
+        /* Create a block generator (i.e. a work scheduler) */
+        BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
 
-                blockIndirect.setOffset(block.getOffset());
-                blockIndirect.setSize(block.getSize());
+        Timer checkpointTimer;
+        double passTime = 0;
+        for (uint32_t pass = 0; samplesTaken < sampleBudget; ++pass) {
+            /* Stop early if the next pass would overrun the time budget */
+            if (pass > 0 && progressive.timeBudget > 0 &&
+                    timer.elapsed() + passTime > progressive.timeBudget * 1000.0) {
+                cout << "time budget reached .. ";
+                break;
+            }
 
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
-                //sampler->prepare(blockDirect);
-                //sampler->prepare(blockIndirect);
+            Timer passTimer;
+            uint64_t passBudget = std::min((costPass && pass == 0 ? 1 : passSampleCount) * pixelCount,
+                                           sampleBudget - samplesTaken);
+            uint32_t passSamples = (uint32_t) (passBudget / pixelCount);
+
+            /* Place the samples of the pass where the error is highest */
+            if (adaptive) {
+                passBudget = adaptive->plan(result, passBudget);
+                if (progressive.noiseThreshold > 0 && adaptive->getRelativeError() < progressive.noiseThreshold) {
+                    cout << endl << "noise threshold reached .. ";
+                    break;
+                }
+                if (passBudget == 0) {
+                    cout << endl << "all pixels converged .. ";
+                    break;
+                }
+            }
 
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block, blockDirect, blockIndirect);
+            /* Start with the blocks that were most expensive in the previous pass */
+            if (pass > 0)
+                blockGenerator.reset(scheduling.splitBlocks ? threadCount : 0);
+
+            /* Each worker takes blocks from the generator until none are
+               left, so the threads finish the pass at about the same time */
+            auto work = [&](int) {
+                /* Allocate memory for a small image block to be rendered
+                   by the current thread */
+                Film block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter(), scene->getAOVs(),
+                           progressive.adaptive);
+
+                /* Create a clone of the sampler for the current thread */
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+                /* Bounce stage for batched integrators */
+                PathBatch batch(integrator->sortsRays(), integrator->comparesUnsorted());
+
+                /* Request image blocks from the block generator */
+                while (blockGenerator.next(block.getImage())) {
+                    block.setOffset(block.getImage().getOffset());
+                    block.setSize(block.getImage().getSize());
+
+                    /* Skip blocks whose pixels have all converged */
+                    if (adaptive && adaptive->getMaxSampleCount(block.getOffset(), block.getSize()) == 0)
+                        continue;
+
+                    auto start = std::chrono::steady_clock::now();
+
+                    /* Inform the sampler about the block to be rendered */
+                    sampler->prepare(block.getImage(), pass);
+
+                    /* Render all contained pixels */
+                    if (integrator->isBatched())
+                        renderBlockBatched(scene, sampler.get(), block, passSamples, adaptive.get(), batch);
+                    else if (integrator->usesPrimaryHits())
+                        renderBlockPackets(scene, sampler.get(), block, passSamples, adaptive.get());
+                    else
+                        renderBlock(scene, sampler.get(), block, passSamples, adaptive.get());
+
+                    if (scheduling.costOrder)
+                        blockGenerator.addCost(block.getImage(), (uint64_t)
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start).count());
+
+                    /* The image block has been processed. Now add it to
+                       the "big" block that represents the entire image */
+                    result.put(block);
+                    if (oddPasses && (pass & 1))
+                        oddPasses->put(block.getImage());
+                }
+
+                std::lock_guard<std::mutex> lock(batchStatsMutex);
+                batchStats += batch.getStatistics();
+            };
+
+            /// Default: parallel rendering
+            tbb::parallel_for(0, threadCount, work);
+
+            /// (equivalent to the following single-threaded call)
+            // work(0);
+
+            samplesTaken += adaptive ? passBudget : passSamples * pixelCount;
+            passTime = passTimer.elapsed();
+            if (!progressive.enabled)
+                continue;
+
+            /* The estimate needs as many even as odd passes */
+            float error = -1;
+            if (oddPasses && (pass & 1))
+                error = estimateRelativeError(result.getImage(), *oddPasses);
+
+            cout << endl << "  pass " << pass + 1 << ": " << (double) samplesTaken / pixelCount << " spp, "
+                 << timeString(passTime);
+            if (error >= 0)
+                cout << ", relative error " << error;
+            if (adaptive)
+                cout << ", " << adaptive->getConvergedPixels() << " of " << pixelCount << " pixels converged";
+            if (blockGenerator.getSplitCount() > 0)
+                cout << ", " << blockGenerator.getSplitCount() << " blocks split";
+            cout.flush();
+
+            if (error >= 0 && error < progressive.noiseThreshold) {
+                cout << endl << "noise threshold reached .. ";
+                break;
+            }
 
-                /* The image block has been processed. Now add it to
-                   the "big" block that represents the entire image */
-                result.put(block);
-                resultDirect.put(blockDirect);
-                resultIndirect.put(blockIndirect);
+            /* Write the image so far, e.g. for jobs that may be killed */
+            if (progressive.checkpointInterval > 0 && samplesTaken < sampleBudget &&
+                    checkpointTimer.elapsed() > progressive.checkpointInterval * 1000.0) {
+                cout << endl;
+                std::unique_ptr<Bitmap> bitmap(result.getImage().toBitmap());
+                bitmap->saveEXR(outputName);
+                checkpointTimer.reset();
             }
-        };
+        }
+        if (progressive.enabled)
+            cout << endl;
 
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
+        renderTime = timer.elapsed();
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
 
-        /// (equivalent to the following single-threaded call)
-        // map(range);
+        if (batchStats.rays > 0) {
+            /* Summed over all threads */
+            auto mraysPerSecond = [&](double seconds) {
+                return seconds > 0 ? batchStats.rays / seconds * 1e-6 : 0.0;
+            };
+            cout << "Secondary rays: " << batchStats.rays << " traced "
+                 << (integrator->sortsRays() ? "sorted" : "unsorted") << " at "
+                 << mraysPerSecond(batchStats.tracingTime) << " Mrays/s per thread";
+            if (integrator->comparesUnsorted())
+                cout << " (unsorted: " << mraysPerSecond(batchStats.unsortedTime) << " Mrays/s, speedup "
+                     << batchStats.unsortedTime / std::max(batchStats.tracingTime, 1e-9) << "x)";
+            cout << endl;
+        }
 
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+        PageCacheStats paging = scene->getAccel()->getPagingStatistics();
+        if (paging.pages > 0)
+            cout << "Geometry paging: " << paging.misses << " page misses, "
+                 << paging.hits << " hits, " << paging.evictions << " evictions, "
+                 << memString(paging.bytesRead) << " read (peak resident "
+                 << memString(paging.peakResident) << " of " << memString(paging.fileSize) << ")" << endl;
     });
 
     if (!nogui)
@@ -165,29 +477,14 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
     else
         render_thread.join();
 
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
-    std::unique_ptr<Bitmap> bitmapDirect(resultDirect.toBitmap());
-    std::unique_ptr<Bitmap> bitmapIndirect(resultIndirect.toBitmap());
+    if (progressive.enabled)
+        cout << "Rendered " << (double) samplesTaken / pixelCount << " of " << sampleCount << " samples per pixel" << endl;
 
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
-    auto pos = outputName.find_last_of("/\\");
-    std::string directName = outputName.substr(0, pos + 1) + "direct_" + outputName.substr(pos + 1);
-    auto indirectName = outputName.substr(0, pos + 1) + "indirect_" + outputName.substr(pos + 1);
-    /* Save using the OpenEXR format */
-    bitmap->saveEXR(outputName);
-    bitmapDirect->saveEXR(directName);
-    bitmapIndirect->saveEXR(indirectName);
-
-    /* Save tonemapped (sRGB) output using the PNG format */
-    bitmap->savePNG(outputName);
-    bitmapDirect->savePNG(directName);
-    bitmapIndirect->savePNG(indirectName);
+    /* Save using the OpenEXR format, along with tonemapped (sRGB)
+       PNG output and the requested AOVs */
+    result.save(outputName);
+
+    writeStatistics(scene, outputName + "_stats.json", renderTime, (double) samplesTaken / pixelCount);
 }
 
 int main(int argc, char **argv) {
@@ -215,8 +512,19 @@ int main(int argc, char **argv) {
 
             continue;
         }
-        if (token == "--nogui" || token == "-b")
+        if (token == "--time") {
+            /* Render progressively and stop after the given number of seconds */
+            if (i+1 >= argc || (timeBudget = (float) atof(argv[i+1])) <= 0) {
+                cerr << "\"--time\" argument expects a positive number of seconds following it." << endl;
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        if (token == "--nogui" || token == "-b") {
             nogui = true;
+            continue;
+        }
 
         filesystem::path path(argv[i]);
 
@@ -233,7 +541,7 @@ int main(int argc, char **argv) {
             } 
             else if (path.extension() == "exr") {
                 /* Alternatively, provide a basic OpenEXR image viewer */
-                Bitmap bitmap(argv[1]);
+                Bitmap bitmap(argv[i]);
                 ImageBlock block(Vector2i((int) bitmap.cols(), (int) bitmap.rows()), nullptr);
                 block.fromBitmap(bitmap);
                 nanogui::init();
@@ -243,7 +551,7 @@ int main(int argc, char **argv) {
                 nanogui::shutdown();
             } 
             else {
-                cerr << "Fatal error: unknown file \"" << argv[1]
+                cerr << "Fatal error: unknown file \"" << argv[i]
                      << "\", expected an extension of type .xml or .exr" << endl;
             }
         } catch (const std::exception &e) {
@@ -253,15 +561,19 @@ int main(int argc, char **argv) {
     }
 
     if (threadCount < 0) {
-        threadCount = tbb::task_scheduler_init::automatic;
+        threadCount = tbb::this_task_arena::max_concurrency();
     }
 
+    /* Limit the number of worker threads used for building the BVH and rendering */
+    tbb::global_control threadLimit(tbb::global_control::max_allowed_parallelism,
+                                    (size_t) threadCount);
+
     if (sceneName != "") {
         try{
-            std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+            std::unique_ptr<NoriObject> root(loadFromXML(sceneName));
             /* When the XML root object is a scene, start rendering it .. */
             if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), argv[1], nogui);
+                render(static_cast<Scene *>(root.get()), sceneName, nogui);
         } catch (const NoriException &e) {
             cerr << "Fatal error: " << e.what() << endl;
             return -1;
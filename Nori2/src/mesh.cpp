@@ -1,233 +1,403 @@
-/*
-    This file is part of Nori, a simple educational ray tracer
-
-    Copyright (c) 2015 by Wenzel Jakob
-
-    v1 - Dec 2020
-    Copyright (c) 2020 by Adrian Jarabo
-
-    Nori is free software; you can redistribute it and/or modify
-    it under the terms of the GNU General Public License Version 3
-    as published by the Free Software Foundation.
-
-    Nori is distributed in the hope that it will be useful,
-    but WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
-    GNU General Public License for more details.
-
-    You should have received a copy of the GNU General Public License
-    along with this program. If not, see <http://www.gnu.org/licenses/>.
-*/
-
-
-#include <nori/mesh.h>
-#include <nori/bbox.h>
-#include <nori/bsdf.h>
-#include <nori/emitter.h>
-#include <nori/warp.h>
-#include <Eigen/Geometry>
-
-NORI_NAMESPACE_BEGIN
-
-Mesh::Mesh() { }
-
-Mesh::~Mesh() {
-    m_pdf.clear();
-    delete m_bsdf;
-    delete m_emitter;
-}
-
-void Mesh::activate() {
-    if (!m_bsdf) {
-        /* If no material was assigned, instantiate a diffuse BRDF */
-        m_bsdf = static_cast<BSDF *>(
-            NoriObjectFactory::createInstance("diffuse", PropertyList()));
-    }
-    
-    m_pdf.reserve(m_F.cols());
-    float meshArea = 0.0f;
-    
-    for (uint32_t i = 0; i < m_F.cols(); ++i) { // num triángulos en la malla
-        float area = surfaceArea(i);
-        //cout << "Area:" <<  area << endl;
-        m_pdf.append(area);
-    }
-
-    m_pdf.normalize();
-    //cout << "M_PDF:" +  m_pdf.toString();
-}
-
-float Mesh::surfaceArea(n_UINT index) const {
-    n_UINT i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
-
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
-
-    return 0.5f * Vector3f((p1 - p0).cross(p2 - p0)).norm();
-}
-
-bool Mesh::rayIntersect(n_UINT index, const Ray3f &ray, float &u, float &v, float &t) const {
-    n_UINT i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
-
-    /* Find vectors for two edges sharing v[0] */
-    Vector3f edge1 = p1 - p0, edge2 = p2 - p0;
-
-    /* Begin calculating determinant - also used to calculate U parameter */
-    Vector3f pvec = ray.d.cross(edge2);
-
-    /* If determinant is near zero, ray lies in plane of triangle */
-    float det = edge1.dot(pvec);
-
-    if (det > -1e-8f && det < 1e-8f)
-        return false;
-    float inv_det = 1.0f / det;
-
-    /* Calculate distance from v[0] to ray origin */
-    Vector3f tvec = ray.o - p0;
-
-    /* Calculate U parameter and test bounds */
-    u = tvec.dot(pvec) * inv_det;
-    if (u < 0.0 || u > 1.0)
-        return false;
-
-    /* Prepare to test V parameter */
-    Vector3f qvec = tvec.cross(edge1);
-
-    /* Calculate V parameter and test bounds */
-    v = ray.d.dot(qvec) * inv_det;
-    if (v < 0.0 || u + v > 1.0)
-        return false;
-
-    /* Ray intersects triangle -> compute t */
-    t = edge2.dot(qvec) * inv_det;
-
-    return t >= ray.mint && t <= ray.maxt;
-}
-
-BoundingBox3f Mesh::getBoundingBox(n_UINT index) const {
-    BoundingBox3f result(m_V.col(m_F(0, index)));
-    result.expandBy(m_V.col(m_F(1, index)));
-    result.expandBy(m_V.col(m_F(2, index)));
-    return result;
-}
-
-Point3f Mesh::getCentroid(n_UINT index) const {
-    return (1.0f / 3.0f) *
-        (m_V.col(m_F(0, index)) +
-         m_V.col(m_F(1, index)) +
-         m_V.col(m_F(2, index)));
-}
-
-/**
- * \brief Uniformly sample a position on the mesh with
- * respect to surface area. Returns both position and normal
- */
-void Mesh::samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, Point2f &uv) const
-{
-    float pdfTriangle;
-    float sampleValue = sample.x();
-    size_t triangleIdx = m_pdf.sampleReuse(sampleValue, pdfTriangle); //índice del triángulo de la malla seleccionado
-    Point2f barycentric = Warp::squareToUniformTriangle(Point2f(sampleValue, sample.y()));
-
-
-    const MatrixXu &F = getIndices();
-    n_UINT idx0 = F(0, triangleIdx), idx1 = F(1, triangleIdx), idx2 = F(2, triangleIdx);
-	const MatrixXf &V = getVertexPositions();
-    const MatrixXf &N = getVertexNormals();
-    const MatrixXf &UV = getVertexTexCoords();
-
-    Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2); //punto dentro del triángulo
-    // Transforma usando las coordenadas baricéntricas
-    float bary0 = 1 - barycentric.x() - barycentric.y();
-    float bary1 = barycentric.x();
-    float bary2 = barycentric.y();
-    // Compute the sampled position using barycentric coordinates
-    p = bary0 * p0 + bary1 * p1 + bary2 * p2;
-
-    if (N.size() > 0) {
-        Normal3f n0 = N.col(idx0), n1 = N.col(idx1), n2 = N.col(idx2);
-        n = (bary0 * n0 + bary1 * n1 + bary2 * n2).normalized();
-    } else {
-        n = (p1 - p0).cross(p2 - p0).normalized();
-    }
-    n.normalize();
-
-    if (UV.size() > 0) {
-        Point2f uv0 = UV.col(idx0), uv1 = UV.col(idx1), uv2 = UV.col(idx2);
-        uv = bary0 * uv0 + bary1 * uv1 + bary2 * uv2;
-    } else {
-        uv = Point2f(0.0f, 0.0f);  // Default value if no UV coordinates are present
-    }
-}
-
-/// Return the surface area of the given triangle
-float Mesh::pdf(const Point3f &p) const
-{
-	return m_pdf.getNormalization();
-}
-
-
-void Mesh::addChild(NoriObject *obj, const std::string& name) {
-    switch (obj->getClassType()) {
-        case EBSDF:
-            if (m_bsdf)
-                throw NoriException(
-                    "Mesh: tried to register multiple BSDF instances!");
-            m_bsdf = static_cast<BSDF *>(obj);
-            break;
-
-        case EEmitter: {
-                Emitter *emitter = static_cast<Emitter *>(obj);
-                if (m_emitter)
-                    throw NoriException(
-                        "Mesh: tried to register multiple Emitter instances!");
-                m_emitter = emitter;
-            }
-            break;
-
-        default:
-            throw NoriException("Mesh::addChild(<%s>) is not supported!",
-                                classTypeName(obj->getClassType()));
-    }
-}
-
-std::string Mesh::toString() const {
-    return tfm::format(
-        "Mesh[\n"
-        "  name = \"%s\",\n"
-        "  vertexCount = %i,\n"
-        "  triangleCount = %i,\n"
-        "  bsdf = %s,\n"
-        "  emitter = %s\n"
-        "]\n",
-        m_name,
-        m_V.cols(),
-        m_F.cols(),
-        m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
-        m_emitter ? indent(m_emitter->toString()) : std::string("null")
-    );
-}
-
-std::string Intersection::toString() const {
-    if (!mesh)
-        return "Intersection[invalid]";
-
-    return tfm::format(
-        "Intersection[\n"
-        "  p = %s,\n"
-        "  t = %f,\n"
-        "  uv = %s,\n"
-        "  shFrame = %s,\n"
-        "  geoFrame = %s,\n"
-        "  mesh = %s\n"
-        "]",
-        p.toString(),
-        t,
-        uv.toString(),
-        indent(shFrame.toString()),
-        indent(geoFrame.toString()),
-        mesh ? mesh->toString() : std::string("null")
-    );
-}
-
-NORI_NAMESPACE_END
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    v1 - Dec 2020
+    Copyright (c) 2020 by Adrian Jarabo
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/mesh.h>
+#include <nori/bbox.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/instance.h>
+#include <nori/pagecache.h>
+#include <nori/warp.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+Mesh::Mesh() { }
+
+Mesh::~Mesh() {
+    m_pdf.clear();
+    delete m_bsdf;
+    delete m_emitter;
+    for (MeshInstance *instance : m_instances)
+        delete instance;
+}
+
+void Mesh::activate() {
+    if (!m_bsdf) {
+        /* If no material was assigned, instantiate a diffuse BRDF */
+        m_bsdf = static_cast<BSDF *>(
+            NoriObjectFactory::createInstance("diffuse", PropertyList()));
+    }
+    
+    m_pdf.reserve(m_F.cols());
+    float meshArea = 0.0f;
+    
+    for (uint32_t i = 0; i < m_F.cols(); ++i) { // num triángulos en la malla
+        float area = surfaceArea(i);
+        //cout << "Area:" <<  area << endl;
+        m_pdf.append(area);
+    }
+
+    m_pdf.normalize();
+    //cout << "M_PDF:" +  m_pdf.toString();
+}
+
+void Mesh::setVertexPositions(const MatrixXf &V) {
+    if (m_pager)
+        throw NoriException("Mesh::setVertexPositions(): the mesh \"%s\" has been paged out", m_name);
+    if (V.rows() != 3 || V.cols() != m_V.cols())
+        throw NoriException("Mesh::setVertexPositions(): expected %i vertices, got %i",
+            m_V.cols(), V.cols());
+
+    m_V = V;
+    m_bbox.reset();
+    for (int i = 0; i < m_V.cols(); ++i)
+        m_bbox.expandBy(m_V.col(i));
+
+    /* The triangle areas have changed as well */
+    if (m_pdf.size() > 0) {
+        m_pdf.clear();
+        m_pdf.reserve(m_F.cols());
+        for (uint32_t i = 0; i < m_F.cols(); ++i)
+            m_pdf.append(surfaceArea(i));
+        m_pdf.normalize();
+    }
+}
+
+void Mesh::getTriangle(n_UINT index, MeshTriangle &triangle) const {
+    if (m_pager) {
+        PageCache::Page page = m_pager->getPage(m_firstPage + index / m_pageTriangles);
+        memcpy(&triangle, page->data() + sizeof(MeshTriangle) * (index % m_pageTriangles),
+            sizeof(MeshTriangle));
+        return;
+    }
+
+    memset(&triangle, 0, sizeof(MeshTriangle));
+    for (int k = 0; k < 3; ++k) {
+        n_UINT idx = m_F(k, index);
+        for (int j = 0; j < 3; ++j)
+            triangle.p[k][j] = m_V(j, idx);
+        if (m_N.size() > 0)
+            for (int j = 0; j < 3; ++j)
+                triangle.n[k][j] = m_N(j, idx);
+        if (m_UV.size() > 0)
+            for (int j = 0; j < 2; ++j)
+                triangle.uv[k][j] = m_UV(j, idx);
+    }
+}
+
+void Mesh::getPositions(n_UINT index, Point3f &p0, Point3f &p1, Point3f &p2) const {
+    if (m_pager) {
+        MeshTriangle triangle;
+        getTriangle(index, triangle);
+        p0 = triangle.getPosition(0);
+        p1 = triangle.getPosition(1);
+        p2 = triangle.getPosition(2);
+        return;
+    }
+
+    p0 = m_V.col(m_F(0, index));
+    p1 = m_V.col(m_F(1, index));
+    p2 = m_V.col(m_F(2, index));
+}
+
+void Mesh::pageOut(PageCache &pager, size_t pageSize) {
+    if (m_pager)
+        return;
+
+    /* Triangles never straddle two pages */
+    size_t pageTriangles = std::max(pageSize / sizeof(MeshTriangle), (size_t) 1);
+    n_UINT count = getTriangleCount();
+    std::vector<MeshTriangle> buffer;
+    buffer.reserve(std::min(pageTriangles, (size_t) count));
+
+    size_t firstPage = pager.getPageCount();
+    for (n_UINT start = 0; start < count; start += (n_UINT) pageTriangles) {
+        n_UINT end = (n_UINT) std::min((size_t) count, start + pageTriangles);
+        buffer.resize(end - start);
+        for (n_UINT i = start; i < end; ++i)
+            getTriangle(i, buffer[i - start]);
+        pager.addPage(buffer.data(), sizeof(MeshTriangle) * buffer.size());
+    }
+
+    m_vertexCount = getVertexCount();
+    m_triangleCount = count;
+    m_hasNormals = m_N.size() > 0;
+    m_hasTexCoords = m_UV.size() > 0;
+    m_firstPage = firstPage;
+    m_pageTriangles = pageTriangles;
+    m_pager = &pager;
+
+    m_V = MatrixXf();
+    m_N = MatrixXf();
+    m_UV = MatrixXf();
+    m_F = MatrixXu();
+}
+
+float Mesh::surfaceArea(n_UINT index) const {
+    Point3f p0, p1, p2;
+    getPositions(index, p0, p1, p2);
+
+    return 0.5f * Vector3f((p1 - p0).cross(p2 - p0)).norm();
+}
+
+bool Mesh::rayIntersect(n_UINT index, const Ray3f &ray, float &u, float &v, float &t) const {
+    Point3f p0, p1, p2;
+    getPositions(index, p0, p1, p2);
+
+    /* Find vectors for two edges sharing v[0] */
+    Vector3f edge1 = p1 - p0, edge2 = p2 - p0;
+
+    /* Begin calculating determinant - also used to calculate U parameter */
+    Vector3f pvec = ray.d.cross(edge2);
+
+    /* If determinant is near zero, ray lies in plane of triangle */
+    float det = edge1.dot(pvec);
+
+    if (det > -1e-8f && det < 1e-8f)
+        return false;
+    float inv_det = 1.0f / det;
+
+    /* Calculate distance from v[0] to ray origin */
+    Vector3f tvec = ray.o - p0;
+
+    /* Calculate U parameter and test bounds */
+    u = tvec.dot(pvec) * inv_det;
+    if (u < 0.0 || u > 1.0)
+        return false;
+
+    /* Prepare to test V parameter */
+    Vector3f qvec = tvec.cross(edge1);
+
+    /* Calculate V parameter and test bounds */
+    v = ray.d.dot(qvec) * inv_det;
+    if (v < 0.0 || u + v > 1.0)
+        return false;
+
+    /* Ray intersects triangle -> compute t */
+    t = edge2.dot(qvec) * inv_det;
+
+    return t >= ray.mint && t <= ray.maxt;
+}
+
+BoundingBox3f Mesh::getBoundingBox(n_UINT index) const {
+    if (m_pager) {
+        Point3f p0, p1, p2;
+        getPositions(index, p0, p1, p2);
+        BoundingBox3f result(p0);
+        result.expandBy(p1);
+        result.expandBy(p2);
+        return result;
+    }
+
+    BoundingBox3f result(m_V.col(m_F(0, index)));
+    result.expandBy(m_V.col(m_F(1, index)));
+    result.expandBy(m_V.col(m_F(2, index)));
+    return result;
+}
+
+Point3f Mesh::getCentroid(n_UINT index) const {
+    if (m_pager) {
+        Point3f p0, p1, p2;
+        getPositions(index, p0, p1, p2);
+        return (1.0f / 3.0f) * (p0 + p1 + p2);
+    }
+
+    return (1.0f / 3.0f) *
+        (m_V.col(m_F(0, index)) +
+         m_V.col(m_F(1, index)) +
+         m_V.col(m_F(2, index)));
+}
+
+/**
+ * \brief Uniformly sample a position on the mesh with
+ * respect to surface area. Returns both position and normal
+ */
+void Mesh::samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, Point2f &uv) const
+{
+    float pdfTriangle;
+    float sampleValue = sample.x();
+    size_t triangleIdx = m_pdf.sampleReuse(sampleValue, pdfTriangle); //índice del triángulo de la malla seleccionado
+    Point2f barycentric = Warp::squareToUniformTriangle(Point2f(sampleValue, sample.y()));
+
+
+    MeshTriangle triangle;
+    getTriangle((n_UINT) triangleIdx, triangle);
+
+    Point3f p0 = triangle.getPosition(0), p1 = triangle.getPosition(1), p2 = triangle.getPosition(2); //punto dentro del triángulo
+    // Transforma usando las coordenadas baricéntricas
+    float bary0 = 1 - barycentric.x() - barycentric.y();
+    float bary1 = barycentric.x();
+    float bary2 = barycentric.y();
+    // Compute the sampled position using barycentric coordinates
+    p = bary0 * p0 + bary1 * p1 + bary2 * p2;
+
+    if (hasVertexNormals()) {
+        Normal3f n0 = triangle.getNormal(0), n1 = triangle.getNormal(1), n2 = triangle.getNormal(2);
+        n = (bary0 * n0 + bary1 * n1 + bary2 * n2).normalized();
+    } else {
+        n = (p1 - p0).cross(p2 - p0).normalized();
+    }
+    n.normalize();
+
+    if (hasVertexTexCoords()) {
+        Point2f uv0 = triangle.getTexCoords(0), uv1 = triangle.getTexCoords(1), uv2 = triangle.getTexCoords(2);
+        uv = bary0 * uv0 + bary1 * uv1 + bary2 * uv2;
+    } else {
+        uv = Point2f(0.0f, 0.0f);  // Default value if no UV coordinates are present
+    }
+}
+
+/// Return the surface area of the given triangle
+float Mesh::pdf(const Point3f &p) const
+{
+	return m_pdf.getNormalization();
+}
+
+
+void Mesh::addChild(NoriObject *obj, const std::string& name) {
+    switch (obj->getClassType()) {
+        case EBSDF:
+            if (m_bsdf)
+                throw NoriException(
+                    "Mesh: tried to register multiple BSDF instances!");
+            m_bsdf = static_cast<BSDF *>(obj);
+            break;
+
+        case EEmitter: {
+                Emitter *emitter = static_cast<Emitter *>(obj);
+                if (m_emitter)
+                    throw NoriException(
+                        "Mesh: tried to register multiple Emitter instances!");
+                m_emitter = emitter;
+            }
+            break;
+
+        case EInstance:
+            m_instances.push_back(static_cast<MeshInstance *>(obj));
+            break;
+
+        default:
+            throw NoriException("Mesh::addChild(<%s>) is not supported!",
+                                classTypeName(obj->getClassType()));
+    }
+}
+
+std::string Mesh::toString() const {
+    return tfm::format(
+        "Mesh[\n"
+        "  name = \"%s\",\n"
+        "  vertexCount = %i,\n"
+        "  triangleCount = %i,\n"
+        "  bsdf = %s,\n"
+        "  emitter = %s\n"
+        "]\n",
+        m_name,
+        getVertexCount(),
+        getTriangleCount(),
+        m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+        m_emitter ? indent(m_emitter->toString()) : std::string("null")
+    );
+}
+
+void Intersection::computeSurfaceData() {
+    /* Find the barycentric coordinates */
+    Vector3f b;
+    b << 1 - bary.sum(), bary;
+
+    /* Vertex attributes of the triangle (paged in if needed) */
+    MeshTriangle triangle;
+    mesh->getTriangle(f, triangle);
+
+    Point3f p0 = triangle.getPosition(0), p1 = triangle.getPosition(1),
+            p2 = triangle.getPosition(2);
+
+    /* Shade instanced geometry in world space */
+    if (instanceToWorld) {
+        const Matrix3x4f &M = *instanceToWorld;
+        p0 = M.leftCols<3>() * p0 + M.col(3);
+        p1 = M.leftCols<3>() * p1 + M.col(3);
+        p2 = M.leftCols<3>() * p2 + M.col(3);
+    }
+
+    /* Compute the intersection positon accurately
+       using barycentric coordinates */
+    p = b.x() * p0 + b.y() * p1 + b.z() * p2;
+
+    /* Compute proper texture coordinates if provided by the mesh */
+    if (mesh->hasVertexTexCoords())
+        uv = b.x() * triangle.getTexCoords(0) +
+            b.y() * triangle.getTexCoords(1) +
+            b.z() * triangle.getTexCoords(2);
+    else
+        uv = bary;
+
+    /* Compute the geometry frame */
+    geoFrame = Frame_Anisotropic((p1 - p0).cross(p2 - p0).normalized());
+
+    if (mesh->hasVertexNormals()) {
+        /* Compute the shading frame. Note that for simplicity,
+           the current implementation doesn't attempt to provide
+           tangents that are continuous across the surface. That
+           means that this code will need to be modified to be able
+           use anisotropic BRDFs, which need tangent continuity */
+
+        Vector3f normal = (p1 - p0).cross(p2 - p0).normalized();
+
+        Vector3f ref = Vector3f(1, 0, 0);
+        Vector3f s = normal.cross(ref).normalized();
+        Vector3f t = normal.cross(s);
+
+        /*shFrame = Frame_Anisotropic(
+            (b.x() * triangle.getNormal(0) +
+                b.y() * triangle.getNormal(1) +
+                b.z() * triangle.getNormal(2)).normalized());*/
+        shFrame = Frame_Anisotropic(s, t, normal);
+    }
+    else {
+        shFrame = geoFrame;
+    }
+}
+
+std::string Intersection::toString() const {
+    if (!mesh)
+        return "Intersection[invalid]";
+
+    return tfm::format(
+        "Intersection[\n"
+        "  p = %s,\n"
+        "  t = %f,\n"
+        "  uv = %s,\n"
+        "  shFrame = %s,\n"
+        "  geoFrame = %s,\n"
+        "  mesh = %s\n"
+        "]",
+        p.toString(),
+        t,
+        uv.toString(),
+        indent(shFrame.toString()),
+        indent(geoFrame.toString()),
+        mesh ? mesh->toString() : std::string("null")
+    );
+}
+
+NORI_NAMESPACE_END
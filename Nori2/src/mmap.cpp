@@ -0,0 +1,117 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/mmap.h>
+
+#if defined(PLATFORM_WINDOWS)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+MemoryMappedFile::~MemoryMappedFile() {
+    unmap();
+}
+
+#if defined(PLATFORM_WINDOWS)
+
+bool MemoryMappedFile::map(const std::string &filename) {
+    unmap();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_file = file;
+    m_mapping = mapping;
+    m_data = (const uint8_t *) data;
+    m_size = (size_t) size.QuadPart;
+    return true;
+}
+
+void MemoryMappedFile::unmap() {
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+    m_data = nullptr;
+    m_mapping = m_file = nullptr;
+    m_size = 0;
+}
+
+#else
+
+bool MemoryMappedFile::map(const std::string &filename) {
+    unmap();
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* The mapping remains valid after the descriptor has been closed */
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    m_data = (const uint8_t *) data;
+    m_size = (size_t) st.st_size;
+    return true;
+}
+
+void MemoryMappedFile::unmap() {
+    if (m_data)
+        munmap((void *) m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
+
+NORI_NAMESPACE_END
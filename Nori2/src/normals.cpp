@@ -10,15 +10,24 @@ public:
     Color3f Li(const Scene *scene , Sampler *sampler , const Ray3f &ray) const {
         /* Find the surface that is visible in the requested direction */
         Intersection its;
-        if ( !scene->rayIntersect(ray, its))
+        if ( !scene->rayIntersect(ray, its, false))
+            return Li(scene, sampler, ray, nullptr);
+        return Li(scene, sampler, ray, &its);
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, Intersection *its) const {
+        if (!its)
             return Color3f (0.0f) ;
+        its->computeSurfaceData();
         
         /* Return the component-wise absolute
         value of the shading normal as a color */
-        Normal3f n = its.shFrame.n.cwiseAbs();
+        Normal3f n = its->shFrame.n.cwiseAbs();
         return Color3f(n.x(), n.y(), n.z()) ;
     }
     
+    bool usesPrimaryHits() const { return true; }
+
     std::string toString ( ) const {
         return "NormalIntegrator[]" ;
     }
@@ -18,6 +18,7 @@
 
 #include <nori/mesh.h>
 #include <nori/timer.h>
+#include <nori/mmap.h>
 #include <filesystem/resolver.h>
 #include <unordered_map>
 #include <fstream>
@@ -44,6 +45,20 @@ public:
         cout.flush();
         Timer timer;
 
+        /* Optionally reuse the geometry flattened by a previous run */
+        bool cache = propList.getBoolean("cache", false);
+        std::string cacheFile = filename.str() + ".cache";
+        uint64_t key = 0;
+        if (cache) {
+            key = cacheKey(filename.str(), trafo);
+            if (loadCache(cacheFile, key)) {
+                m_name = filename.str();
+                cout << "done. (cached, V=" << m_V.cols() << ", F=" << m_F.cols()
+                     << ", took " << timer.elapsedString() << ")" << endl;
+                return;
+            }
+        }
+
         std::vector<Vector3f>   positions;
         std::vector<Vector2f>   texcoords;
         std::vector<Vector3f>   normals;
@@ -141,9 +156,97 @@ public:
              << memString(m_F.size() * sizeof(uint32_t) +
                           sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
              << ")" << endl;
+
+        if (cache)
+            saveCache(cacheFile, key);
     }
 
 protected:
+    /// Header of a geometry cache file, followed by the V, N, UV and F arrays
+    struct CacheHeader {
+        char magic[4];      ///< "NOBJ"
+        uint32_t version;   ///< Layout version
+        uint64_t key;       ///< Hash of the OBJ file and the transformation
+        uint64_t cols[4];   ///< Number of columns of V, N, UV and F
+        float bbox[6];      ///< Bounding box of the transformed vertices
+    };
+
+    /// Hash of the contents of an OBJ file and the transformation applied to it
+    static uint64_t cacheKey(const std::string &filename, const Transform &trafo) {
+        MemoryMappedFile file;
+        uint32_t version = CACHE_VERSION;
+        uint64_t key = hashBytes(&version, sizeof(uint32_t));
+        if (file.map(filename))
+            key = hashBytes(file.data(), file.size(), key);
+        return hashBytes(trafo.getMatrix().data(), sizeof(float) * 16, key);
+    }
+
+    /// Load the flattened geometry, unless the cache file is missing or stale
+    bool loadCache(const std::string &filename, uint64_t key) {
+        MemoryMappedFile file;
+        if (!file.map(filename) || file.size() < sizeof(CacheHeader))
+            return false;
+
+        CacheHeader header;
+        memcpy(&header, file.data(), sizeof(CacheHeader));
+        if (memcmp(header.magic, "NOBJ", 4) != 0 ||
+            header.version != CACHE_VERSION || header.key != key)
+            return false;
+
+        const uint64_t rows[4] = { 3, 3, 2, 3 };
+        uint64_t expected = sizeof(CacheHeader);
+        for (int i = 0; i < 4; ++i)
+            expected += 4 * rows[i] * header.cols[i];
+        if (expected != file.size())
+            return false;
+
+        const uint8_t *ptr = file.data() + sizeof(CacheHeader);
+        m_V.resize(3, header.cols[0]);
+        m_N.resize(3, header.cols[1]);
+        m_UV.resize(2, header.cols[2]);
+        m_F.resize(3, header.cols[3]);
+        memcpy(m_V.data(), ptr, sizeof(float) * m_V.size());
+        ptr += sizeof(float) * m_V.size();
+        memcpy(m_N.data(), ptr, sizeof(float) * m_N.size());
+        ptr += sizeof(float) * m_N.size();
+        memcpy(m_UV.data(), ptr, sizeof(float) * m_UV.size());
+        ptr += sizeof(float) * m_UV.size();
+        memcpy(m_F.data(), ptr, sizeof(uint32_t) * m_F.size());
+
+        m_bbox = BoundingBox3f(
+            Point3f(header.bbox[0], header.bbox[1], header.bbox[2]),
+            Point3f(header.bbox[3], header.bbox[4], header.bbox[5]));
+        return true;
+    }
+
+    /// Write the flattened geometry to a cache file
+    void saveCache(const std::string &filename, uint64_t key) const {
+        CacheHeader header;
+        memcpy(header.magic, "NOBJ", 4);
+        header.version = CACHE_VERSION;
+        header.key = key;
+        header.cols[0] = (uint64_t) m_V.cols();
+        header.cols[1] = (uint64_t) m_N.cols();
+        header.cols[2] = (uint64_t) m_UV.cols();
+        header.cols[3] = (uint64_t) m_F.cols();
+        for (int i = 0; i < 3; ++i) {
+            header.bbox[i] = m_bbox.min[i];
+            header.bbox[i + 3] = m_bbox.max[i];
+        }
+
+        std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+        os.write((const char *) &header, sizeof(CacheHeader));
+        os.write((const char *) m_V.data(), sizeof(float) * m_V.size());
+        os.write((const char *) m_N.data(), sizeof(float) * m_N.size());
+        os.write((const char *) m_UV.data(), sizeof(float) * m_UV.size());
+        os.write((const char *) m_F.data(), sizeof(uint32_t) * m_F.size());
+        if (os.fail())
+            cerr << "Warning: unable to write the geometry cache \"" << filename << "\"" << endl;
+    }
+
+    /// Bump whenever the layout of the cached data changes
+    static const uint32_t CACHE_VERSION = 1;
+
     /// Vertex indices used by the OBJ format
     struct OBJVertex {
         uint32_t p = (uint32_t) -1;
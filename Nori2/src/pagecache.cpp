@@ -0,0 +1,161 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/pagecache.h>
+#include <cstdio>
+
+NORI_NAMESPACE_BEGIN
+
+PageCache::PageCache(const std::string &filename, size_t budget)
+    : m_filename(filename), m_budget(budget), m_hits((uint64_t) 0) {
+    m_file.open(filename, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!m_file)
+        throw NoriException("PageCache: unable to create the page file \"%s\"", filename);
+}
+
+PageCache::~PageCache() {
+    m_file.close();
+    std::remove(m_filename.c_str());
+}
+
+size_t PageCache::addPage(const void *data, size_t size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry entry;
+    entry.offset = m_stats.fileSize;
+    entry.size = size;
+    {
+        std::lock_guard<std::mutex> fileLock(m_fileMutex);
+        m_file.seekp((std::streamoff) entry.offset);
+        m_file.write((const char *) data, (std::streamsize) size);
+        m_file.flush();
+        if (!m_file)
+            throw NoriException("PageCache: unable to write to \"%s\"", m_filename);
+    }
+    m_pages.push_back(entry);
+    m_stats.pages++;
+    m_stats.fileSize += size;
+    return m_pages.size() - 1;
+}
+
+PageCache::Page PageCache::readPage(size_t index) const {
+    const Entry &entry = m_pages[index];
+    std::shared_ptr<std::vector<uint8_t>> page =
+        std::make_shared<std::vector<uint8_t>>(entry.size);
+
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    m_file.seekg((std::streamoff) entry.offset);
+    m_file.read((char *) page->data(), (std::streamsize) entry.size);
+    if (!m_file)
+        throw NoriException("PageCache: unable to read page %i from \"%s\"", index, m_filename);
+    return page;
+}
+
+PageCache::Page PageCache::getPage(size_t index) const {
+    Entry &entry = m_pages[index];
+
+    /* Hits do not take the lock */
+    Page page = std::atomic_load(&entry.data);
+    if (page) {
+        /* Only write the bit if needed, as hot pages are shared by all threads */
+        if (!entry.referenced.load(std::memory_order_relaxed))
+            entry.referenced.store(true, std::memory_order_relaxed);
+        m_hits.local()++;
+        return page;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        page = std::atomic_load(&entry.data);
+        if (page) {
+            entry.referenced.store(true, std::memory_order_relaxed);
+            m_hits.local()++;
+            return page;
+        }
+        if (!entry.loading)
+            break;
+        /* Another thread is reading this page */
+        m_loaded.wait(lock);
+    }
+
+    /* Read the page without blocking requests for other pages */
+    entry.loading = true;
+    m_stats.misses++;
+    lock.unlock();
+    try {
+        page = readPage(index);
+    } catch (...) {
+        lock.lock();
+        entry.loading = false;
+        m_loaded.notify_all();
+        throw;
+    }
+    lock.lock();
+
+    entry.loading = false;
+    entry.referenced.store(true, std::memory_order_relaxed);
+    std::atomic_store(&entry.data, page);
+    m_clock.push_back(index);
+    m_resident += entry.size;
+    m_stats.bytesRead += entry.size;
+
+    /* Sweep the clock hand over the resident pages: referenced ones get
+       another round, the others are dropped (except for this one) */
+    while (m_resident > m_budget && m_clock.size() > 1) {
+        if (m_hand >= m_clock.size())
+            m_hand = 0;
+        Entry &victim = m_pages[m_clock[m_hand]];
+        if (m_clock[m_hand] == index || victim.referenced.exchange(false, std::memory_order_relaxed)) {
+            ++m_hand;
+            continue;
+        }
+        std::atomic_store(&victim.data, Page());
+        m_clock[m_hand] = m_clock.back();
+        m_clock.pop_back();
+        m_resident -= victim.size;
+        m_stats.evictions++;
+    }
+    m_stats.peakResident = std::max(m_stats.peakResident, (uint64_t) m_resident);
+
+    m_loaded.notify_all();
+    return page;
+}
+
+PageCacheStats PageCache::getStatistics() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    PageCacheStats stats = m_stats;
+    for (uint64_t hits : m_hits)
+        stats.hits += hits;
+    return stats;
+}
+
+std::string PageCache::toString() const {
+    PageCacheStats stats = getStatistics();
+    return tfm::format(
+        "PageCache[\n"
+        "  filename = \"%s\",\n"
+        "  budget = %s,\n"
+        "  pages = %i (%s),\n"
+        "  hits = %i,\n"
+        "  misses = %i,\n"
+        "  evictions = %i\n"
+        "]",
+        m_filename, memString(m_budget), stats.pages, memString(stats.fileSize),
+        stats.hits, stats.misses, stats.evictions);
+}
+
+NORI_NAMESPACE_END
@@ -15,56 +15,59 @@ Muestrear directamente los emisores (como las luces de área) y calcular la radi
 class PathTracing : public Integrator {
 public:
     PathTracing(const PropertyList &props) {
-        /* No parameters this time */
+        setBatching(props);
     }
 
-    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, Color3f &throughput) const {
-        Color3f Lo(0.0f); 
-        Intersection its;
-        if (!scene->rayIntersect(ray, its)) {
-            return scene->getBackground(ray) * throughput;
+    bool shade(const Scene *scene, Sampler *sampler, PathState &state, Intersection *its) const {
+        const Ray3f &ray = state.ray;
+        if (!its) {
+            state.add(scene->getBackground(ray) * state.throughput, state.isDirectEmission());
+            return false;
         }
+        its->computeSurfaceData();
 
 
-        if (its.mesh->isEmitter()) {
-            EmitterQueryRecord eRec(its.p);
+        if (its->mesh->isEmitter()) {
+            EmitterQueryRecord eRec(its->p);
             eRec.ref = ray.o;                   
             eRec.wi = ray.d;
-            eRec.n = its.shFrame.n;           
-            Lo += its.mesh->getEmitter()->eval(eRec) * throughput;
+            eRec.n = its->shFrame.n;           
+            state.add(its->mesh->getEmitter()->eval(eRec) * state.throughput, state.isDirectEmission());
         }
 
 
         Point2f sample = sampler->next2D();
-        BSDFQueryRecord bsdfRec(its.toLocal(-ray.d), sample);
+        BSDFQueryRecord bsdfRec(its->toLocal(-ray.d), sample);
 
-        const BSDF *bsdf = its.mesh->getBSDF();
+        const BSDF *bsdf = its->mesh->getBSDF();
         Color3f bsdfSample = bsdf->sample(bsdfRec, sample);
 
         if (bsdfSample.isZero() || bsdfSample.hasNaN()) {
-            return Lo; // No contribution from this path
+            return false; // No contribution from this path
         }
 
-        Vector3f woWorld = its.toWorld(bsdfRec.wo);
-        float cosTheta = std::max(0.0f, its.shFrame.n.dot(woWorld));
-        throughput *= bsdfSample; //* cosTheta;
+        Vector3f woWorld = its->toWorld(bsdfRec.wo);
+        state.throughput *= bsdfSample; //* cosTheta;
 
-        float rrProb = std::min(throughput.maxCoeff(), 0.95f); // Survival probability based on throughput
+        float rrProb = std::min(state.throughput.maxCoeff(), 0.95f); // Survival probability based on throughput
         if (sampler->next1D() > rrProb) {
-            return Lo;
+            return false;
         }
-        throughput /= rrProb;
+        state.throughput /= rrProb;
 
         // Trace the new ray
-        Ray3f newRay(its.p, woWorld);
-        Lo += Li(scene, sampler, newRay, throughput);
-        return Lo;
+        state.ray = Ray3f(its->p, woWorld);
+        state.wasSmooth = bsdfRec.measure == EDiscrete;
+        state.depth++;
+        return true;
     }
 
     Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
-        Color3f Lo(0.0f); // Accumulated radiance along the ray
-        Color3f throughput(1.0f);
-        return Li(scene, sampler, ray, throughput);
+        return tracePath(scene, sampler, ray);
+    }
+
+    void sample(const Scene *scene, Sampler *sampler, const Ray3f &ray, uint32_t aovs, RadianceSample &result) const {
+        tracePath(scene, sampler, ray, aovs, result);
     }
 
     std::string toString() const {
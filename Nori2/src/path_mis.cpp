@@ -15,44 +15,48 @@ Muestrear directamente los emisores (como las luces de área) y calcular la radi
 class PathTracingMIS : public Integrator {
 public:
     PathTracingMIS(const PropertyList &props) {
-        /* No parameters this time */
+        setBatching(props);
     }
 
-    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, Color3f throughput, bool wasSmooth, bool first) const {
-        Intersection its;
-        Color3f Lo(0.0f);
-        bool doit = wasSmooth || first;
+    bool shade(const Scene *scene, Sampler *sampler, PathState &state, Intersection *its) const {
+        const Ray3f &ray = state.ray;
+        Color3f &throughput = state.throughput;
+        bool wasSmooth = state.wasSmooth;
+        bool doit = wasSmooth || state.depth == 0;
 
         // Check for intersection
-        if (!scene->rayIntersect(ray, its)) {
-           return (doit ? throughput * scene->getBackground(ray) : Lo);
+        if (!its) {
+           if (doit)
+               state.add(throughput * scene->getBackground(ray), state.isDirectEmission());
+           return false;
         }
+        its->computeSurfaceData();
 
         
         float w_mat = 0.0f, w_em = 0.0f, p_em = 0.0f, p_mat = 0.0f;
 
         // Add emitted radiance if hitting an emitter directly
-        if (its.mesh->isEmitter() && doit) {
-            EmitterQueryRecord eRec(its.p);
+        if (its->mesh->isEmitter() && doit) {
+            EmitterQueryRecord eRec(its->p);
             eRec.ref = ray.o;
             eRec.wi = ray.d;
-            eRec.n = its.shFrame.n;
-            eRec.uv = its.uv;
-            Lo += throughput * its.mesh->getEmitter()->eval(eRec);
+            eRec.n = its->shFrame.n;
+            eRec.uv = its->uv;
+            state.add(throughput * its->mesh->getEmitter()->eval(eRec), state.isDirectEmission());
         }
 
         // MIS: Direct illumination from BSDF sampling
-        if (its.mesh->isEmitter()) {
-            const Emitter *em_mat = its.mesh->getEmitter();
-            EmitterQueryRecord eRec(em_mat, its.p, its.p, its.shFrame.n, its.uv);
+        if (its->mesh->isEmitter()) {
+            const Emitter *em_mat = its->mesh->getEmitter();
+            EmitterQueryRecord eRec(em_mat, its->p, its->p, its->shFrame.n, its->uv);
             eRec.ref = ray.o;
             eRec.wi = ray.d;
-            eRec.n = its.shFrame.n;
-            eRec.dist = its.t;
+            eRec.n = its->shFrame.n;
+            eRec.dist = its->t;
 
             Color3f Le = em_mat->eval(eRec);
-            BSDFQueryRecord bsdfQR(its.toLocal(-ray.d));
-            p_mat = its.mesh->getBSDF()->pdf(bsdfQR);
+            BSDFQueryRecord bsdfQR(its->toLocal(-ray.d));
+            p_mat = its->mesh->getBSDF()->pdf(bsdfQR);
             p_em = em_mat->pdf(eRec);
 
             Color3f Lmat = Le * throughput;
@@ -65,7 +69,7 @@ public:
                 }
             }
 
-            Lo += Lmat * w_mat;
+            state.add(Lmat * w_mat, state.isDirectEmission());
         }
 
         // MIS: Direct illumination from emitter sampling
@@ -74,64 +78,62 @@ public:
             const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdf);
 
             if (emitter && pdf > 0.0f) {
-                EmitterQueryRecord eRec(its.p);
+                EmitterQueryRecord eRec(its->p);
                 Color3f Le = emitter->sample(eRec, sampler->next2D(), 0.0f);
 
                 // Shadow ray check
-                Intersection lightIts;
-                Ray3f shadowRay(its.p, eRec.wi);
-                bool inShadow = scene->rayIntersect(shadowRay, lightIts);
+                if (!scene->occluded(its->p, eRec.wi, eRec.dist)) {
+                    BSDFQueryRecord bsdfQR(its->toLocal(-ray.d), its->toLocal(eRec.wi), its->uv, ESolidAngle);
+                    Color3f bsdfVal = its->mesh->getBSDF()->eval(bsdfQR);
 
-                if (!inShadow || lightIts.t >= eRec.dist - Epsilon) {
-                    BSDFQueryRecord bsdfQR(its.toLocal(-ray.d), its.toLocal(eRec.wi), its.uv, ESolidAngle);
-                    Color3f bsdfVal = its.mesh->getBSDF()->eval(bsdfQR);
-
-                    float cosTheta = std::max(0.0f, its.shFrame.n.dot(eRec.wi));
+                    float cosTheta = std::max(0.0f, its->shFrame.n.dot(eRec.wi));
                     float emitterPdf = eRec.pdf * pdf;
 
                     if (emitterPdf > Epsilon) {
                         Color3f Lem = Le * cosTheta * bsdfVal / emitterPdf;
 
-                        p_mat = its.mesh->getBSDF()->pdf(bsdfQR);
+                        p_mat = its->mesh->getBSDF()->pdf(bsdfQR);
                         p_em = emitterPdf;
 
                         if (p_em + p_mat > Epsilon) {
                             w_em = p_em / (p_em + p_mat);
-                            Lo += throughput * Lem * w_em;
+                            state.add(throughput * Lem * w_em, state.depth == 0);
                         }
                     }
                 }
             }
         }
         Point2f sample = sampler->next2D();
-        BSDFQueryRecord bsdfRec(its.toLocal(-ray.d));
-        Color3f brdfVal = its.mesh->getBSDF()->sample(bsdfRec, sample);
+        BSDFQueryRecord bsdfRec(its->toLocal(-ray.d));
+        Color3f brdfVal = its->mesh->getBSDF()->sample(bsdfRec, sample);
 
         if (brdfVal.isZero() || brdfVal.hasNaN()) {
-            return Lo;
+            return false;
         }
         throughput *= brdfVal;
 
         // Russian Roulette termination
         float rrProb = std::min(throughput.maxCoeff(), 0.95f);
         if (sampler->next1D() > rrProb) {
-            return Lo; 
+            return false; 
         }
 
-        Vector3f woWorld = its.toWorld(bsdfRec.wo);
+        Vector3f woWorld = its->toWorld(bsdfRec.wo);
         throughput /= rrProb;
 
-        // Trace the next ray recursively
-        Ray3f nextRay(its.p, woWorld);
-        Lo += Li(scene, sampler, nextRay, throughput, bsdfRec.measure == EDiscrete, false);
-
-        return Lo;
+        // Continue with the next ray
+        state.ray = Ray3f(its->p, woWorld);
+        state.wasSmooth = bsdfRec.measure == EDiscrete;
+        state.depth++;
+        return true;
     }
 
     Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
-        Color3f Lo(0.0f); // Accumulated radiance along the ray
-        Color3f throughput(1.0f);
-        return Li(scene, sampler, ray, throughput, false, true);
+        return tracePath(scene, sampler, ray);
+    }
+
+    void sample(const Scene *scene, Sampler *sampler, const Ray3f &ray, uint32_t aovs, RadianceSample &result) const {
+        tracePath(scene, sampler, ray, aovs, result);
     }
 
     std::string toString() const {
@@ -15,105 +15,33 @@ Muestrear directamente los emisores (como las luces de área) y calcular la radi
 class PathTracingNEE : public Integrator {
 public:
     PathTracingNEE(const PropertyList &props) {
-        /* No parameters this time */
+        setBatching(props);
     }
 
-    virtual void LiSeparated(const Scene *scene, Sampler *sampler, const Ray3f &ray, Color3f &direct, Color3f &indirect, Color3f throughput = Color3f(1.f), bool wasSmooth = false, bool first = true) const override{
-        direct = Color3f(0.f);
-        indirect = Color3f(0.f);
-
-        Intersection its;
-        if (!scene->rayIntersect(ray, its)) {
-            indirect = scene->getBackground(ray) * throughput;
-            return;
-        }
-
-        /**
-         * Emitter sampling
-         */
-        if (its.mesh->isEmitter() && (wasSmooth || first)) {
-            EmitterQueryRecord eRec(its.p);
-            eRec.ref = ray.o;                   
-            eRec.wi = ray.d;
-            eRec.n = its.shFrame.n;    
-            eRec.uv = its.uv;      
-            direct += its.mesh->getEmitter()->eval(eRec) * throughput; 
-        }
-
-        if (!wasSmooth) {
-            float pdfEmitter;
-            const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdfEmitter);
-
-            if (emitter && pdfEmitter > 0.0f) {
-
-                EmitterQueryRecord lRec(its.p);
-                Color3f Le = emitter->sample(lRec, sampler->next2D(), 0.0f);
-
-                Ray3f shadowRay(its.p, lRec.wi);
-                Intersection lightIts;
-                bool inShadow = scene->rayIntersect(shadowRay, lightIts);
-
-                // Verificar que no hay intersección o que el emisor está más cerca
-                if (!inShadow || lightIts.t >= (lRec.dist - Epsilon)) {
-                    BSDFQueryRecord lightBsdfRec(its.toLocal(-ray.d), its.toLocal(lRec.wi), its.uv, ESolidAngle);
-                    Color3f bsdfVal = its.mesh->getBSDF()->eval(lightBsdfRec);
-                    float cosTheta = std::max(0.0f, its.shFrame.n.dot(lRec.wi));
-
-                    if (lRec.pdf  > 0.0f) {
-                        direct += throughput * (Le * bsdfVal * cosTheta) / (lRec.pdf * pdfEmitter);
-                    }
-                }
-            }
-        }
-
-        Point2f sample = sampler->next2D();
-        BSDFQueryRecord bsdfRec(its.toLocal(-ray.d), sample);
-        const BSDF *bsdf = its.mesh->getBSDF();
-        Color3f bsdfSample = bsdf->sample(bsdfRec, sample);
-
-        if (bsdfSample.isZero() || bsdfSample.hasNaN()) {
-            return; 
-        }
-
-        Vector3f woWorld = its.toWorld(bsdfRec.wo);
-        throughput *= bsdfSample;// * cosTheta;
-
-        float rrProb = std::min(throughput.maxCoeff(), 0.95f); // Survival probability based on throughput
-        if (sampler->next1D() > rrProb) {
-            return;
-        }
-        throughput /= rrProb;
-
-        /**
-         * Trace new ray
-         */
-        Ray3f newRay(its.p, woWorld);
-        Color3f newDirect, newIndirect;
-        LiSeparated(scene, sampler, newRay, newDirect, newIndirect, throughput, bsdfRec.measure == EDiscrete, false);
-        indirect += newDirect + newIndirect;
-
-    }
-
-    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, Color3f &throughput, bool wasSmooth, bool first) const {
-        Color3f Lo(0.0f); 
-        Intersection its;
+    bool shade(const Scene *scene, Sampler *sampler, PathState &state, Intersection *its) const {
+        const Ray3f &ray = state.ray;
+        Color3f &throughput = state.throughput;
+        bool wasSmooth = state.wasSmooth;
         /**
          * Ray intersection
          */
-        if (!scene->rayIntersect(ray, its)) {
-            return scene->getBackground(ray) * throughput;
+        if (!its) {
+            state.add(scene->getBackground(ray) * throughput, state.isDirectEmission());
+            return false;
         }
+        its->computeSurfaceData();
 
         /**
          * Emitter sampling
          */
-        if (its.mesh->isEmitter() && (wasSmooth || first)) {
-            EmitterQueryRecord eRec(its.p);
+        if (its->mesh->isEmitter() && (wasSmooth || state.depth == 0)) {
+            EmitterQueryRecord eRec(its->p);
             eRec.ref = ray.o;                   
             eRec.wi = ray.d;
-            eRec.n = its.shFrame.n;    
-            eRec.uv = its.uv;       
-            return its.mesh->getEmitter()->eval(eRec) * throughput;
+            eRec.n = its->shFrame.n;    
+            eRec.uv = its->uv;       
+            state.add(its->mesh->getEmitter()->eval(eRec) * throughput, state.isDirectEmission());
+            return false;
         }
         
 
@@ -128,21 +56,17 @@ public:
 
             if (emitter && pdfEmitter > 0.0f) {
 
-                EmitterQueryRecord lRec(its.p);
+                EmitterQueryRecord lRec(its->p);
                 Color3f Le = emitter->sample(lRec, sampler->next2D(), 0.0f);
 
-                Ray3f shadowRay(its.p, lRec.wi);
-                Intersection lightIts;
-                bool inShadow = scene->rayIntersect(shadowRay, lightIts);
-
-                // Verificar que no hay intersección o que el emisor está más cerca
-                if (!inShadow || lightIts.t >= (lRec.dist - Epsilon)) {
-                    BSDFQueryRecord lightBsdfRec(its.toLocal(-ray.d), its.toLocal(lRec.wi), its.uv, ESolidAngle);
-                    Color3f bsdfVal = its.mesh->getBSDF()->eval(lightBsdfRec);
-                    float cosTheta = std::max(0.0f, its.shFrame.n.dot(lRec.wi));
+                // Verificar que no hay intersección antes del emisor
+                if (!scene->occluded(its->p, lRec.wi, lRec.dist)) {
+                    BSDFQueryRecord lightBsdfRec(its->toLocal(-ray.d), its->toLocal(lRec.wi), its->uv, ESolidAngle);
+                    Color3f bsdfVal = its->mesh->getBSDF()->eval(lightBsdfRec);
+                    float cosTheta = std::max(0.0f, its->shFrame.n.dot(lRec.wi));
 
                     if (lRec.pdf  > 0.0f) {
-                        Lo += throughput * (Le * bsdfVal * cosTheta) / (lRec.pdf * pdfEmitter);
+                        state.add(throughput * (Le * bsdfVal * cosTheta) / (lRec.pdf * pdfEmitter), state.depth == 0);
                     }
                 }
             }
@@ -152,15 +76,15 @@ public:
          * Direct lighting
          */
         Point2f sample = sampler->next2D();
-        BSDFQueryRecord bsdfRec(its.toLocal(-ray.d), sample);
-        const BSDF *bsdf = its.mesh->getBSDF();
+        BSDFQueryRecord bsdfRec(its->toLocal(-ray.d), sample);
+        const BSDF *bsdf = its->mesh->getBSDF();
         Color3f bsdfSample = bsdf->sample(bsdfRec, sample);
 
         if (bsdfSample.isZero() || bsdfSample.hasNaN()) {
-            return Lo; 
+            return false; 
         }
 
-        Vector3f woWorld = its.toWorld(bsdfRec.wo);
+        Vector3f woWorld = its->toWorld(bsdfRec.wo);
         throughput *= bsdfSample;// * cosTheta;
 
 
@@ -169,21 +93,25 @@ public:
          */
         float rrProb = std::min(throughput.maxCoeff(), 0.95f); // Survival probability based on throughput
         if (sampler->next1D() > rrProb) {
-            return Lo;
+            return false;
         }
         throughput /= rrProb;
 
         /**
-         * Trace new ray
+         * Continue with the new ray
          */
-        Ray3f newRay(its.p, woWorld);
-        Lo += Li(scene, sampler, newRay, throughput, bsdfRec.measure == EDiscrete, false);
-        return Lo;
+        state.ray = Ray3f(its->p, woWorld);
+        state.wasSmooth = bsdfRec.measure == EDiscrete;
+        state.depth++;
+        return true;
     }
 
     Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
-        Color3f throughput(1.0f);
-        return Li(scene, sampler, ray, throughput, false, true);
+        return tracePath(scene, sampler, ray);
+    }
+
+    void sample(const Scene *scene, Sampler *sampler, const Ray3f &ray, uint32_t aovs, RadianceSample &result) const {
+        tracePath(scene, sampler, ray, aovs, result);
     }
 
     std::string toString() const {
@@ -0,0 +1,127 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/pathbatch.h>
+#include <nori/scene.h>
+#include <algorithm>
+#include <chrono>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of bits per axis of the Morton code of a ray origin
+static const int ORIGIN_BITS = 9;
+
+/// Insert two zero bits between each of the lower 10 bits of \c x
+static uint32_t expandBits(uint32_t x) {
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+/// Seconds elapsed since \c start
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PathBatch::sortActive(const BoundingBox3f &bbox) {
+    const float cells = (float) (1 << ORIGIN_BITS);
+    Vector3f scale = bbox.getExtents().cwiseMax(Vector3f::Constant(Epsilon)).cwiseInverse() * cells;
+
+    m_keys.resize(m_active.size());
+    for (size_t i = 0; i < m_active.size(); ++i) {
+        const Ray3f &ray = m_paths[m_active[i]].ray;
+
+        /* Direction octant in the upper bits, so that rays travelling the
+           same way are grouped first and then ordered along a Z-curve
+           through their origins */
+        uint32_t key = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (ray.d[axis] < 0)
+                key |= 1u << (3 * ORIGIN_BITS + axis);
+            float p = (ray.o[axis] - bbox.min[axis]) * scale[axis];
+            uint32_t q = (uint32_t) std::min(std::max(p, 0.0f), cells - 1);
+            key |= expandBits(q) << (2 - axis);
+        }
+        m_keys[i] = ((uint64_t) key << 32) | m_active[i];
+    }
+
+    std::sort(m_keys.begin(), m_keys.end());
+    for (size_t i = 0; i < m_keys.size(); ++i)
+        m_active[i] = (uint32_t) m_keys[i];
+}
+
+void PathBatch::trace(const Scene *scene, Sampler *sampler, uint32_t aovs) {
+    const Integrator *integrator = scene->getIntegrator();
+    m_samples.assign(m_paths.size(), RadianceSample());
+
+    m_active.resize(m_paths.size());
+    for (size_t i = 0; i < m_paths.size(); ++i)
+        m_active[i] = (uint32_t) i;
+
+    for (int bounce = 0; !m_active.empty(); ++bounce) {
+        bool secondary = bounce > 0;
+
+        /* Baseline: trace the same rays in path order */
+        if (secondary && m_compareUnsorted) {
+            std::vector<uint32_t> order(m_active);
+            std::sort(order.begin(), order.end());
+            Intersection its;
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t idx : order)
+                scene->rayIntersect(m_paths[idx].ray, its, false);
+            m_stats.unsortedTime += secondsSince(start);
+        }
+
+        if (secondary && m_sortRays)
+            sortActive(scene->getBoundingBox());
+
+        /* Trace the rays of all live paths */
+        m_hits.resize(m_active.size());
+        m_found.resize(m_active.size());
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < m_active.size(); ++i)
+            m_found[i] = scene->rayIntersect(m_paths[m_active[i]].ray, m_hits[i], false);
+        if (secondary) {
+            m_stats.tracingTime += secondsSince(start);
+            m_stats.rays += m_active.size();
+        }
+
+        /* Shade the hits and keep the paths that continue */
+        size_t alive = 0;
+        for (size_t i = 0; i < m_active.size(); ++i) {
+            uint32_t idx = m_active[i];
+            if (!secondary && m_found[i])
+                m_samples[idx].setPrimaryHit(m_hits[i], aovs);
+            bool continues = integrator->shade(scene, sampler, m_paths[idx], m_found[i] ? &m_hits[i] : nullptr);
+            if (continues)
+                m_active[alive++] = idx;
+        }
+        m_active.resize(alive);
+    }
+
+    for (size_t idx = 0; idx < m_paths.size(); ++idx) {
+        RadianceSample &sample = m_samples[idx];
+        sample.radiance = m_paths[idx].radiance;
+        sample.direct = m_paths[idx].direct;
+        sample.indirect = sample.radiance - sample.direct;
+    }
+}
+
+NORI_NAMESPACE_END
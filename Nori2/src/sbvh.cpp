@@ -0,0 +1,419 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sbvh.h>
+#include <tbb/tbb.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Build-related parameters
+enum {
+	/// Number of bins per axis for both object and spatial splits
+	BIN_COUNT = 32,
+
+	/// Build the two children of a node in parallel above this many references
+	PARALLEL_THRESHOLD = 4096,
+
+	/// Process triangles in batches of 1K for the purpose of parallelization
+	GRAIN_SIZE = 1000,
+
+	/// Always create a leaf at this depth (traversal stacks hold 64 entries)
+	MAX_DEPTH = 60
+};
+
+/**
+ * Only search for a spatial split when the children of the best object
+ * split overlap by more than this fraction of the scene's surface area
+ * (the parameter alpha of Stich et al.)
+ */
+static const float SPATIAL_SPLIT_ALPHA = 1e-5f;
+
+/// Bin index of a coordinate, clamped to the valid range
+static int binIndex(float value, float min, float scale) {
+	int bin = (int) ((value - min) * scale);
+	return std::min(std::max(bin, 0), (int) BIN_COUNT - 1);
+}
+
+SBVHBuilder::SBVHBuilder(Accel &bvh, float budget)
+	: m_bvh(bvh), m_rootArea(bvh.m_bbox.getSurfaceArea()),
+	  m_maxRefs((size_t) (bvh.getTriangleCount() * (1.0 + budget))), m_refCount(0) { }
+
+void SBVHBuilder::build() {
+	n_UINT size = m_bvh.getTriangleCount();
+	std::vector<Reference> refs(size);
+
+	tbb::parallel_for(
+		tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
+		[&](const tbb::blocked_range<n_UINT> &range) {
+			for (n_UINT i = range.begin(); i != range.end(); ++i) {
+				refs[i].prim = i;
+				refs[i].bbox = m_bvh.getBoundingBox(i);
+			}
+		}
+	);
+	m_refCount = size;
+
+	std::unique_ptr<Node> root = buildNode(refs, m_bvh.m_bbox, 0);
+
+	m_bvh.m_nodes.clear();
+	m_bvh.m_indices.clear();
+	m_bvh.m_nodes.reserve(2 * m_refCount);
+	m_bvh.m_indices.reserve(m_refCount);
+	flatten(root.get());
+}
+
+std::unique_ptr<SBVHBuilder::Node> SBVHBuilder::buildNode(
+		std::vector<Reference> &refs, const BoundingBox3f &bbox, int depth) {
+	std::unique_ptr<Node> node(new Node());
+	node->bbox = bbox;
+
+	n_UINT size = (n_UINT) refs.size();
+	float leafCost = (float) Accel::INTERSECTION_COST * Accel::packetCount(size);
+
+	if (size > 1 && depth < MAX_DEPTH) {
+		Split object = findObjectSplit(refs, bbox), spatial;
+
+		/* Spatial splits only help when the object split produces
+		   overlapping children, and are skipped once the budget is spent */
+		if (m_refCount < m_maxRefs) {
+			BoundingBox3f overlap = object.leftBounds;
+			overlap.clip(object.rightBounds);
+			if (object.axis < 0 || (overlap.isValid() &&
+					overlap.getSurfaceArea() > SPATIAL_SPLIT_ALPHA * m_rootArea))
+				spatial = findSpatialSplit(refs, bbox);
+		}
+
+		std::vector<Reference> left, right;
+		int axis = -1;
+		if (spatial.cost < object.cost && spatial.cost < leafCost) {
+			axis = spatial.axis;
+			float pos = spatial.pos;
+			BoundingBox3f leftBounds = spatial.leftBounds, rightBounds = spatial.rightBounds;
+			n_UINT leftCount = spatial.leftCount, rightCount = spatial.rightCount;
+			left.reserve(leftCount);
+			right.reserve(rightCount);
+
+			for (const Reference &ref : refs) {
+				if (ref.bbox.max[axis] <= pos) {
+					left.push_back(ref);
+					continue;
+				} else if (ref.bbox.min[axis] >= pos) {
+					right.push_back(ref);
+					continue;
+				}
+
+				/* The reference straddles the plane. Check whether moving it
+				   entirely into one child is cheaper than splitting it
+				   ("reference unsplitting" in the paper) */
+				BoundingBox3f leftMerged = BoundingBox3f::merge(leftBounds, ref.bbox),
+					rightMerged = BoundingBox3f::merge(rightBounds, ref.bbox);
+				float splitCost = leftBounds.getSurfaceArea() * leftCount +
+					rightBounds.getSurfaceArea() * rightCount;
+				float leftCost = leftMerged.getSurfaceArea() * leftCount +
+					rightBounds.getSurfaceArea() * (rightCount - 1);
+				float rightCost = leftBounds.getSurfaceArea() * (leftCount - 1) +
+					rightMerged.getSurfaceArea() * rightCount;
+				bool duplicate = splitCost <= std::min(leftCost, rightCost);
+
+				/* Duplicating the reference needs room in the memory budget */
+				if (duplicate) {
+					size_t count = m_refCount;
+					duplicate = false;
+					while (count < m_maxRefs && !duplicate)
+						duplicate = m_refCount.compare_exchange_weak(count, count + 1);
+				}
+
+				if (duplicate) {
+					Reference leftRef, rightRef;
+					splitReference(ref, axis, pos, leftRef, rightRef);
+					/* Clipping a previously clipped reference can leave one side empty */
+					if (leftRef.bbox.isValid())
+						left.push_back(leftRef);
+					if (rightRef.bbox.isValid())
+						right.push_back(rightRef);
+				} else if (leftCost <= rightCost) {
+					left.push_back(ref);
+					leftBounds = leftMerged;
+					rightCount--;
+				} else {
+					right.push_back(ref);
+					rightBounds = rightMerged;
+					leftCount--;
+				}
+			}
+		} else if (object.cost < leafCost) {
+			axis = object.axis;
+			for (const Reference &ref : refs) {
+				if (ref.bbox.getCenter()[axis] < object.pos)
+					left.push_back(ref);
+				else
+					right.push_back(ref);
+			}
+		}
+
+		if (!left.empty() && !right.empty()) {
+			BoundingBox3f leftBounds, rightBounds;
+			for (const Reference &ref : left)
+				leftBounds.expandBy(ref.bbox);
+			for (const Reference &ref : right)
+				rightBounds.expandBy(ref.bbox);
+
+			/* The references of this node are no longer needed */
+			std::vector<Reference>().swap(refs);
+
+			node->axis = (uint32_t) axis;
+			if (size > PARALLEL_THRESHOLD) {
+				tbb::parallel_invoke(
+					[&] { node->left = buildNode(left, leftBounds, depth + 1); },
+					[&] { node->right = buildNode(right, rightBounds, depth + 1); }
+				);
+			} else {
+				node->left = buildNode(left, leftBounds, depth + 1);
+				node->right = buildNode(right, rightBounds, depth + 1);
+			}
+			return node;
+		}
+	}
+
+	node->prims.reserve(size);
+	for (const Reference &ref : refs)
+		node->prims.push_back(ref.prim);
+	return node;
+}
+
+SBVHBuilder::Split SBVHBuilder::findObjectSplit(
+		const std::vector<Reference> &refs, const BoundingBox3f &bbox) const {
+	BoundingBox3f centroids;
+	for (const Reference &ref : refs)
+		centroids.expandBy(ref.bbox.getCenter());
+
+	float tri_factor = (float) Accel::INTERSECTION_COST / bbox.getSurfaceArea();
+	Split splits[3];
+
+	auto binAxis = [&](int axis) {
+		float min = centroids.min[axis], extent = centroids.max[axis] - min;
+		if (!(extent > 0))
+			return;
+		float scale = BIN_COUNT / extent;
+
+		n_UINT counts[BIN_COUNT] = { 0 };
+		BoundingBox3f bounds[BIN_COUNT];
+		for (const Reference &ref : refs) {
+			int bin = binIndex(ref.bbox.getCenter()[axis], min, scale);
+			counts[bin]++;
+			bounds[bin].expandBy(ref.bbox);
+		}
+
+		/* Sweep from the right to accumulate the right children */
+		n_UINT rightCounts[BIN_COUNT];
+		BoundingBox3f rightBounds[BIN_COUNT], accum;
+		n_UINT count = 0;
+		for (int i = BIN_COUNT - 1; i > 0; --i) {
+			accum.expandBy(bounds[i]);
+			count += counts[i];
+			rightBounds[i] = accum;
+			rightCounts[i] = count;
+		}
+
+		/* Sweep from the left and evaluate the SAH at each bin boundary */
+		Split &best = splits[axis];
+		accum.reset();
+		count = 0;
+		for (int i = 0; i < BIN_COUNT - 1; ++i) {
+			accum.expandBy(bounds[i]);
+			count += counts[i];
+			n_UINT rightCount = rightCounts[i + 1];
+			if (count == 0 || rightCount == 0)
+				continue;
+
+			float cost = 2.0f * Accel::TRAVERSAL_COST + tri_factor *
+				(Accel::packetCount(count) * accum.getSurfaceArea() +
+				 Accel::packetCount(rightCount) * rightBounds[i + 1].getSurfaceArea());
+
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.pos = min + extent * (i + 1) / BIN_COUNT;
+				best.leftCount = count;
+				best.rightCount = rightCount;
+				best.leftBounds = accum;
+				best.rightBounds = rightBounds[i + 1];
+			}
+		}
+	};
+
+	if (refs.size() > PARALLEL_THRESHOLD)
+		tbb::parallel_for(0, 3, binAxis);
+	else
+		for (int axis = 0; axis < 3; ++axis)
+			binAxis(axis);
+
+	int best = 0;
+	for (int axis = 1; axis < 3; ++axis)
+		if (splits[axis].cost < splits[best].cost)
+			best = axis;
+	return splits[best];
+}
+
+SBVHBuilder::Split SBVHBuilder::findSpatialSplit(
+		const std::vector<Reference> &refs, const BoundingBox3f &bbox) const {
+	float tri_factor = (float) Accel::INTERSECTION_COST / bbox.getSurfaceArea();
+	Split splits[3];
+
+	auto binAxis = [&](int axis) {
+		float min = bbox.min[axis], extent = bbox.max[axis] - min;
+		if (!(extent > 0))
+			return;
+		float scale = BIN_COUNT / extent;
+
+		/* Each reference enters the bin containing its lower bound and
+		   exits the one containing its upper bound. The bins in between
+		   receive the part of the triangle that lies within them. */
+		n_UINT entries[BIN_COUNT] = { 0 }, exits[BIN_COUNT] = { 0 };
+		BoundingBox3f bounds[BIN_COUNT];
+		for (const Reference &ref : refs) {
+			int first = binIndex(ref.bbox.min[axis], min, scale),
+				last = binIndex(ref.bbox.max[axis], min, scale);
+
+			Reference remainder = ref;
+			for (int i = first; i < last; ++i) {
+				Reference leftRef, rightRef;
+				splitReference(remainder, axis,
+					min + extent * (i + 1) / BIN_COUNT, leftRef, rightRef);
+				bounds[i].expandBy(leftRef.bbox);
+				remainder = rightRef;
+			}
+			bounds[last].expandBy(remainder.bbox);
+			entries[first]++;
+			exits[last]++;
+		}
+
+		/* Sweep from the right to accumulate the right children */
+		n_UINT rightCounts[BIN_COUNT];
+		BoundingBox3f rightBounds[BIN_COUNT], accum;
+		n_UINT count = 0;
+		for (int i = BIN_COUNT - 1; i > 0; --i) {
+			accum.expandBy(bounds[i]);
+			count += exits[i];
+			rightBounds[i] = accum;
+			rightCounts[i] = count;
+		}
+
+		/* Sweep from the left and evaluate the SAH at each bin boundary */
+		Split &best = splits[axis];
+		accum.reset();
+		count = 0;
+		for (int i = 0; i < BIN_COUNT - 1; ++i) {
+			accum.expandBy(bounds[i]);
+			count += entries[i];
+			n_UINT rightCount = rightCounts[i + 1];
+			if (count == 0 || rightCount == 0)
+				continue;
+
+			float cost = 2.0f * Accel::TRAVERSAL_COST + tri_factor *
+				(Accel::packetCount(count) * accum.getSurfaceArea() +
+				 Accel::packetCount(rightCount) * rightBounds[i + 1].getSurfaceArea());
+
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.pos = min + extent * (i + 1) / BIN_COUNT;
+				best.leftCount = count;
+				best.rightCount = rightCount;
+				best.leftBounds = accum;
+				best.rightBounds = rightBounds[i + 1];
+			}
+		}
+	};
+
+	if (refs.size() > PARALLEL_THRESHOLD)
+		tbb::parallel_for(0, 3, binAxis);
+	else
+		for (int axis = 0; axis < 3; ++axis)
+			binAxis(axis);
+
+	int best = 0;
+	for (int axis = 1; axis < 3; ++axis)
+		if (splits[axis].cost < splits[best].cost)
+			best = axis;
+	return splits[best];
+}
+
+void SBVHBuilder::splitReference(const Reference &ref, int axis, float pos,
+		Reference &left, Reference &right) const {
+	n_UINT f = ref.prim;
+	const Mesh *mesh = m_bvh.m_meshes[m_bvh.findMesh(f)];
+	const MatrixXu &F = mesh->getIndices();
+	const MatrixXf &V = mesh->getVertexPositions();
+
+	left.prim = right.prim = ref.prim;
+	left.bbox.reset();
+	right.bbox.reset();
+
+	/* Walk along the edges of the triangle and assign the vertices and
+	   the intersections with the plane to the respective sides */
+	for (int i = 0; i < 3; ++i) {
+		Point3f v0 = V.col(F(i, f)), v1 = V.col(F((i + 1) % 3, f));
+		float p0 = v0[axis], p1 = v1[axis];
+
+		if (p0 <= pos)
+			left.bbox.expandBy(v0);
+		if (p0 >= pos)
+			right.bbox.expandBy(v0);
+
+		if ((p0 < pos && pos < p1) || (p1 < pos && pos < p0)) {
+			float t = std::min(std::max((pos - p0) / (p1 - p0), 0.0f), 1.0f);
+			Point3f p = v0 + (v1 - v0) * t;
+			p[axis] = pos;
+			left.bbox.expandBy(p);
+			right.bbox.expandBy(p);
+		}
+	}
+
+	/* The reference may already have been clipped by an earlier split */
+	left.bbox.clip(ref.bbox);
+	right.bbox.clip(ref.bbox);
+}
+
+n_UINT SBVHBuilder::flatten(const Node *node) {
+	std::vector<Accel::BVHNode> &nodes = m_bvh.m_nodes;
+	n_UINT node_idx = (n_UINT) nodes.size();
+
+	Accel::BVHNode result;
+	memset(&result, 0, sizeof(Accel::BVHNode));
+	result.bbox = node->bbox;
+
+	if (!node->left) {
+		result.leaf.flag = 1;
+		result.leaf.size = (uint32_t) node->prims.size();
+		result.leaf.start = (n_UINT) m_bvh.m_indices.size();
+		m_bvh.m_indices.insert(m_bvh.m_indices.end(),
+			node->prims.begin(), node->prims.end());
+		nodes.push_back(result);
+	} else {
+		result.inner.flag = 0;
+		result.inner.axis = node->axis;
+		nodes.push_back(result);
+		flatten(node->left.get());
+		n_UINT right = flatten(node->right.get());
+		nodes[node_idx].inner.rightChild = right;
+	}
+	return node_idx;
+}
+
+NORI_NAMESPACE_END
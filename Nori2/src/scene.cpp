@@ -25,11 +25,67 @@
 #include <nori/sampler.h>
 #include <nori/camera.h>
 #include <nori/emitter.h>
+#include <nori/instance.h>
+#include <nori/film.h>
 
 NORI_NAMESPACE_BEGIN
 
-Scene::Scene(const PropertyList &) {
+Scene::Scene(const PropertyList &props) {
     m_accel = new Accel();
+    /* Branching factor of the BVH (2, 4 or 8) */
+    m_accel->setWidth(props.getInteger("bvhWidth", 2));
+    /* BVH construction algorithm ("sah", "sbvh" or "lbvh"), the number of extra
+       triangle references the spatial split builder may create, and whether
+       the linear builder restructures treelets */
+    std::string builder = props.getString("bvhBuilder", "sah");
+    if (builder == "sbvh")
+        m_accel->setBuilder(Accel::ESpatialSplits, props.getFloat("sbvhBudget", 0.3f));
+    else if (builder == "lbvh")
+        m_accel->setBuilder(Accel::ELinear);
+    else if (builder != "sah")
+        throw NoriException("Scene: unknown BVH builder \"%s\"", builder);
+    m_accel->setTreeletOptimization(props.getBoolean("lbvhTreelets", true));
+    /* Quantize the child bounds of wide BVH nodes to save memory */
+    m_accel->setCompression(props.getBoolean("bvhCompression", false));
+    /* Memory layout of the wide BVH nodes ("dfs", "bfs", "treelet" or "veb") */
+    std::string layout = props.getString("bvhLayout", "dfs");
+    if (layout == "bfs")
+        m_accel->setNodeLayout(Accel::EBreadthFirst);
+    else if (layout == "treelet")
+        m_accel->setNodeLayout(Accel::ETreelets);
+    else if (layout == "veb")
+        m_accel->setNodeLayout(Accel::EVanEmdeBoas);
+    else if (layout != "dfs")
+        throw NoriException("Scene: unknown BVH node layout \"%s\"", layout);
+    /* Relative SAH cost increase after which a refit rebuilds a subtree */
+    m_accel->setRebuildThreshold(props.getFloat("bvhRebuildThreshold", 0.5f));
+    /* Keep the binary nodes of a wide BVH so that it can be refitted */
+    m_accel->setRefitSupport(props.getBoolean("bvhRefit", false));
+    /* Optional file for caching the BVH across runs */
+    m_accel->setCacheFile(props.getString("bvhCache", ""));
+    /* Optional scratch file for keeping the triangle packets out of core,
+       and the memory budget (in MiB) for the packets paged in from it */
+    m_accel->setPaging(props.getString("geometryPageFile", ""),
+                       (size_t) props.getInteger("geometryBudget", 512) << 20);
+    /* Auxiliary images to render, e.g. "direct,indirect,normal,depth" */
+    m_aovs = Film::parseAOVs(props.getString("aovs", ""));
+    /* Progressive rendering in passes, with optional budgets */
+    m_progressive.enabled = props.getBoolean("progressive", false);
+    m_progressive.passSampleCount = (uint32_t) std::max(props.getInteger("passSampleCount", 1), 1);
+    m_progressive.timeBudget = props.getFloat("timeBudget", 0.0f);
+    m_progressive.noiseThreshold = props.getFloat("noiseThreshold", 0.0f);
+    m_progressive.checkpointInterval = props.getFloat("checkpointInterval", 0.0f);
+    /* Adaptive sampling (implies a progressive render) */
+    m_progressive.adaptive = props.getBoolean("adaptive", false);
+    m_progressive.enabled |= m_progressive.adaptive;
+    m_progressive.adaptiveThreshold = props.getFloat("adaptiveThreshold", 0.02f);
+    m_progressive.adaptiveMinSampleCount = (uint32_t) std::max(props.getInteger("adaptiveMinSampleCount", 4), 1);
+    /* Order of the image blocks: "cost" (most expensive in the previous pass first) or "spiral" */
+    std::string blockOrder = props.getString("blockOrder", "cost");
+    if (blockOrder != "cost" && blockOrder != "spiral")
+        throw NoriException("Scene: unknown block order \"%s\"", blockOrder);
+    m_scheduling.costOrder = blockOrder == "cost";
+    m_scheduling.splitBlocks = props.getBoolean("blockSplitting", true);
     m_enviromentalEmitter = 0;
 }
 
@@ -94,7 +150,14 @@ void Scene::addChild(NoriObject *obj, const std::string& name) {
     switch (obj->getClassType()) {
         case EMesh: {
                 Mesh *mesh = static_cast<Mesh *>(obj);
-                m_accel->addMesh(mesh);
+                if (mesh->getInstances().empty()) {
+                    m_accel->addMesh(mesh);
+                } else {
+                    if (mesh->isEmitter())
+                        throw NoriException("Scene::addChild(): instanced emitters are not supported!");
+                    for (const MeshInstance *instance : mesh->getInstances())
+                        m_accel->addInstance(mesh, instance->getTransform());
+                }
                 m_meshes.push_back(mesh);
                 if (mesh->isEmitter()) {
                     m_emitters.push_back(mesh->getEmitter()); // Añade el emisor de la malla a la lista global de emisores